@@ -2,6 +2,10 @@
 
 #include "model_loading.h"
 #include "assimp_model_loading.h"
+#include "vertex_compression.h"
+#include "entities.h"
+#include "geometry_arena.h"
+#include "mesh_cache.h"
 
 #include <assimp/cimport.h>
 #include <assimp/scene.h>
@@ -88,13 +92,31 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 bas
 
     // add the submesh into the mesh
     Submesh submesh = {};
-    submesh.vertexBufferLayout = vertexBufferLayout;
-    submesh.vertices.swap(vertices);
+    CompressSubmeshVertices(submesh, vertices, vertexBufferLayout);
     submesh.indices.swap(indices);
     myMesh->submeshes.push_back( submesh );
 }
 
-void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial, String directory)
+u32& MaterialTextureIdx(Material& material, u32 slot)
+{
+    switch (slot)
+    {
+        case 0:  return material.albedoTextureIdx;
+        case 1:  return material.emissiveTextureIdx;
+        case 2:  return material.specularTextureIdx;
+        case 3:  return material.normalsTextureIdx;
+        default: return material.bumpTextureIdx;
+    }
+}
+
+TextureUsage MaterialTextureUsage(u32 slot)
+{
+    return slot == 3 ? TextureUsage_NormalMap : TextureUsage_Color;
+}
+
+// Reads the material without loading its textures, only their paths. No
+// frame arena strings, the loader thread runs it too.
+void ReadAssimpMaterial(aiMaterial *material, Material& myMaterial, const std::string& directory, std::string texturePaths[MATERIAL_TEXTURE_COUNT])
 {
     aiString name;
     aiColor3D diffuseColor;
@@ -112,46 +134,35 @@ void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial,
     myMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
     myMaterial.smoothness = shininess / 256.0f;
 
-    aiString aiFilename;
-    if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
-    {
-        material->GetTexture(aiTextureType_DIFFUSE, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.albedoTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_EMISSIVE) > 0)
-    {
-        material->GetTexture(aiTextureType_EMISSIVE, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.emissiveTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_SPECULAR) > 0)
-    {
-        material->GetTexture(aiTextureType_SPECULAR, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.specularTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
-    {
-        material->GetTexture(aiTextureType_NORMALS, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.normalsTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_HEIGHT) > 0)
+    // same order as MaterialTextureIdx
+    const aiTextureType textureTypes[MATERIAL_TEXTURE_COUNT] = {
+        aiTextureType_DIFFUSE, aiTextureType_EMISSIVE, aiTextureType_SPECULAR, aiTextureType_NORMALS, aiTextureType_HEIGHT
+    };
+
+    for (u32 slot = 0; slot < MATERIAL_TEXTURE_COUNT; ++slot)
     {
-        material->GetTexture(aiTextureType_HEIGHT, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.bumpTextureIdx = LoadTexture2D(app, filepath.str);
+        MaterialTextureIdx(myMaterial, slot) = UINT32_MAX;
+        texturePaths[slot].clear();
+
+        aiString aiFilename;
+        if (material->GetTextureCount(textureTypes[slot]) > 0)
+        {
+            material->GetTexture(textureTypes[slot], 0, &aiFilename);
+            texturePaths[slot] = directory + "/" + aiFilename.C_Str();
+        }
     }
 
     //myMaterial.createNormalFromBump();
 }
 
+// Directory part of a path, like GetDirectoryPart
+static std::string DirectoryOf(const char* filename)
+{
+    std::string path = filename;
+    size_t separator = path.find_last_of("/\\");
+    return separator == std::string::npos ? std::string() : path.substr(0, separator);
+}
+
 void ProcessAssimpNode(const aiScene* scene, aiNode *node, Mesh *myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
 {
     // process all the node's meshes (if any)
@@ -168,49 +179,248 @@ void ProcessAssimpNode(const aiScene* scene, aiNode *node, Mesh *myMesh, u32 bas
     }
 }
 
-u32 LoadModel(App* app, const char* filename)
+// Adds a node and its subtree to the node table of an instanced import. An
+// aiMesh becomes a submesh on its first reference only.
+static void ImportAssimpNode(const aiScene* scene, const aiNode* node, u32 parentIdx, std::vector<u32>& meshSubmeshes, ImportedModel& imported)
 {
-    const aiScene* scene = aiImportFile(filename,
-                                        aiProcess_Triangulate           |
-                                        aiProcess_GenSmoothNormals      |
-                                        aiProcess_CalcTangentSpace      |
-                                        aiProcess_JoinIdenticalVertices |
-                                        aiProcess_PreTransformVertices  |
-                                        aiProcess_ImproveCacheLocality  |
-                                        aiProcess_OptimizeMeshes        |
-                                        aiProcess_SortByPType);
+    aiVector3D scaling, position;
+    aiQuaternion rotation;
+    node->mTransformation.Decompose(scaling, rotation, position);
+
+    ImportedNode myNode = {};
+    myNode.transform.position = vec3(position.x, position.y, position.z);
+    myNode.transform.rotation = quat(rotation.w, rotation.x, rotation.y, rotation.z);
+    myNode.transform.scale = vec3(scaling.x, scaling.y, scaling.z);
+    myNode.parentIdx = parentIdx;
+    myNode.firstMesh = (u32)imported.nodeMeshes.size();
+    myNode.meshCount = node->mNumMeshes;
+
+    for (unsigned int i = 0; i < node->mNumMeshes; i++)
+    {
+        const u32 aiMeshIdx = node->mMeshes[i];
+        if (meshSubmeshes[aiMeshIdx] == UINT32_MAX)
+        {
+            meshSubmeshes[aiMeshIdx] = (u32)imported.mesh.submeshes.size();
+            ProcessAssimpMesh(scene, scene->mMeshes[aiMeshIdx], &imported.mesh, 0, imported.submeshMaterials);
+        }
+        imported.nodeMeshes.push_back(meshSubmeshes[aiMeshIdx]);
+    }
+
+    const u32 nodeIdx = (u32)imported.nodes.size();
+    imported.nodes.push_back(myNode);
+
+    for (unsigned int i = 0; i < node->mNumChildren; i++)
+    {
+        ImportAssimpNode(scene, node->mChildren[i], nodeIdx, meshSubmeshes, imported);
+    }
+}
+
+// Part of the mesh cache key, a change in them imports the models again
+static const u32 ModelImportFlags = aiProcess_Triangulate           |
+                                    aiProcess_GenSmoothNormals      |
+                                    aiProcess_CalcTangentSpace      |
+                                    aiProcess_JoinIdenticalVertices |
+                                    aiProcess_PreTransformVertices  |
+                                    aiProcess_OptimizeMeshes        |
+                                    aiProcess_SortByPType;
+
+// without the two steps that bake every node reference into its own copy
+static const u32 InstancedModelImportFlags = ModelImportFlags & ~(aiProcess_PreTransformVertices | aiProcess_OptimizeMeshes);
+
+bool ImportModel(const char* filename, ImportedModel& imported, bool instanced)
+{
+    const aiScene* scene = aiImportFile(filename, instanced ? InstancedModelImportFlags : ModelImportFlags);
 
     if (!scene)
     {
         ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
-        return UINT32_MAX;
+        return false;
     }
-    
-    app->meshes.push_back(Mesh{});
-    Mesh& mesh = app->meshes.back();
-    u32 meshIdx = (u32)app->meshes.size() - 1u;
 
-    app->models.push_back(Model{});
-    Model& model = app->models.back();
-    model.meshIdx = meshIdx;
-    u32 modelIdx = (u32)app->models.size() - 1u;
-
-    String directory = GetDirectoryPart(MakeString(filename));
+    std::string directory = DirectoryOf(filename);
 
     // Create a list of materials
-    u32 baseMeshMaterialIndex = (u32)app->materials.size();
+    imported.materials.resize(scene->mNumMaterials);
+    imported.texturePaths.resize(scene->mNumMaterials * MATERIAL_TEXTURE_COUNT);
     for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
     {
-        app->materials.push_back(Material{});
-        Material& material = app->materials.back();
-        ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
+        imported.materials[i] = Material{};
+        ReadAssimpMaterial(scene->mMaterials[i], imported.materials[i], directory, &imported.texturePaths[i * MATERIAL_TEXTURE_COUNT]);
     }
 
-    ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.materialIdx);
+    if (instanced)
+    {
+        std::vector<u32> meshSubmeshes(scene->mNumMeshes, UINT32_MAX);
+        ImportAssimpNode(scene, scene->mRootNode, UINT32_MAX, meshSubmeshes, imported);
+    }
+    else
+    {
+        ProcessAssimpNode(scene, scene->mRootNode, &imported.mesh, 0, imported.submeshMaterials);
+    }
 
     aiReleaseImport(scene);
 
-    LoadMeshGlBuffers(mesh);
+    return true;
+}
+
+bool ImportPreparedModel(const char* filename, ImportedModel& imported, bool instanced)
+{
+    const u32 importFlags = instanced ? InstancedModelImportFlags : ModelImportFlags;
+    if (ReadMeshCache(filename, importFlags, imported))
+        return true;
+
+    if (!ImportModel(filename, imported, instanced))
+        return false;
+
+    PrepareMeshGeometry(imported.mesh);
+
+    Mesh& mesh = imported.mesh;
+    imported.geometry.resize(mesh.submeshes.size());
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        PrepareSubmeshGeometry(mesh.submeshes[i], imported.geometry[i]);
+
+    WriteMeshCache(filename, importFlags, imported);
+    return true;
+}
+
+void ReleaseImportedGeometry(ImportedModel& imported)
+{
+    imported.geometry.clear();
+    UnmapFile(imported.cacheFile);
+}
+
+// Adds the materials of an import to app->materials, returns the first one.
+// Textures are loaded synchronously, all of them decoded together.
+static u32 AddImportedMaterials(App* app, ImportedModel& imported)
+{
+    std::vector<const char*> texturePaths;
+    std::vector<TextureUsage> textureUsages;
+    for (u32 i = 0; i < imported.texturePaths.size(); ++i)
+    {
+        if (imported.texturePaths[i].empty())
+            continue;
+        texturePaths.push_back(imported.texturePaths[i].c_str());
+        textureUsages.push_back(MaterialTextureUsage(i % MATERIAL_TEXTURE_COUNT));
+    }
+
+    std::vector<u32> texIndices(texturePaths.size());
+    LoadTextures2D(app, texturePaths.size(), texturePaths.data(), textureUsages.data(), texIndices.data());
+
+    u32 baseMeshMaterialIndex = (u32)app->materials.size();
+    u32 loadedIdx = 0;
+    for (u32 i = 0; i < imported.materials.size(); ++i)
+    {
+        Material& material = imported.materials[i];
+        for (u32 slot = 0; slot < MATERIAL_TEXTURE_COUNT; ++slot)
+        {
+            if (!imported.texturePaths[i * MATERIAL_TEXTURE_COUNT + slot].empty())
+                MaterialTextureIdx(material, slot) = texIndices[loadedIdx++];
+        }
+        app->materials.push_back(material);
+    }
+    return baseMeshMaterialIndex;
+}
+
+u32 AddEmptyModel(App* app)
+{
+    app->meshes.push_back(Mesh{});
+    u32 meshIdx = (u32)app->meshes.size() - 1u;
+
+    app->models.push_back(Model{});
+    app->models.back().meshIdx = meshIdx;
+
+    return (u32)app->models.size() - 1u;
+}
+
+void SetImportedModel(App* app, u32 modelIdx, ImportedModel& imported, u32 baseMeshMaterialIndex)
+{
+    Model& model = app->models[modelIdx];
+    Mesh& mesh = app->meshes[model.meshIdx];
+
+    // a reloaded model gives its old geometry back to the arenas
+    for (Submesh& submesh : mesh.submeshes)
+        FreeSubmeshGeometry(app, submesh);
+
+    mesh.submeshes.swap(imported.mesh.submeshes);
+
+    model.materialIdx.clear();
+    for (u32 materialIdx : imported.submeshMaterials)
+        model.materialIdx.push_back(baseMeshMaterialIndex + materialIdx);
+}
+
+u32 AddImportedModel(App* app, ImportedModel& imported, u32 baseMeshMaterialIndex)
+{
+    u32 modelIdx = AddEmptyModel(app);
+    SetImportedModel(app, modelIdx, imported, baseMeshMaterialIndex);
+    return modelIdx;
+}
+
+u32 LoadModel(App* app, const char* filename)
+{
+    ImportedModel imported;
+    if (!ImportPreparedModel(filename, imported))
+        return UINT32_MAX;
+
+    u32 baseMeshMaterialIndex = AddImportedMaterials(app, imported);
+    u32 modelIdx = AddImportedModel(app, imported, baseMeshMaterialIndex);
+
+    Mesh& mesh = app->meshes[app->models[modelIdx].meshIdx];
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        AllocatePreparedSubmeshGeometry(app, mesh.submeshes[i], imported.geometry[i]);
+    ReleaseImportedGeometry(imported);
 
     return modelIdx;
-}
\ No newline at end of file
+}
+
+u32 LoadModelInstances(App* app, const char* filename, const Transform& transform, u32 parentIdx, u8 flags)
+{
+    ImportedModel imported;
+    if (!ImportPreparedModel(filename, imported, true))
+        return UINT32_MAX;
+
+    u32 baseMeshMaterialIndex = AddImportedMaterials(app, imported);
+
+    // one model per submesh, uploaded once whatever the number of nodes drawing it
+    std::vector<u32> submeshModels(imported.mesh.submeshes.size());
+    for (u32 i = 0; i < submeshModels.size(); ++i)
+    {
+        submeshModels[i] = AddEmptyModel(app);
+        Model& model = app->models[submeshModels[i]];
+        Mesh& mesh = app->meshes[model.meshIdx];
+
+        mesh.submeshes.push_back(std::move(imported.mesh.submeshes[i]));
+        model.materialIdx.push_back(baseMeshMaterialIndex + imported.submeshMaterials[i]);
+        AllocatePreparedSubmeshGeometry(app, mesh.submeshes[0], imported.geometry[i]);
+    }
+    ReleaseImportedGeometry(imported);
+
+    const u32 rootIdx = CreateEntity(app, ENTITY_NO_MODEL, transform, parentIdx, flags);
+
+    std::vector<u32> nodeEntities(imported.nodes.size());
+    u32 instanceCount = 0;
+    for (u32 i = 0; i < imported.nodes.size(); ++i)
+    {
+        const ImportedNode& node = imported.nodes[i];
+        const u32 nodeParentIdx = node.parentIdx == UINT32_MAX ? rootIdx : nodeEntities[node.parentIdx];
+
+        // a node with a single mesh is drawn itself, several meshes hang below it
+        u32 modelIdx = ENTITY_NO_MODEL;
+        if (node.meshCount == 1)
+            modelIdx = submeshModels[imported.nodeMeshes[node.firstMesh]];
+
+        nodeEntities[i] = CreateEntity(app, modelIdx, node.transform, nodeParentIdx, flags);
+
+        if (node.meshCount > 1)
+        {
+            for (u32 j = 0; j < node.meshCount; ++j)
+            {
+                CreateEntity(app, submeshModels[imported.nodeMeshes[node.firstMesh + j]], Transform(), nodeEntities[i], flags);
+            }
+        }
+        instanceCount += node.meshCount;
+    }
+
+    ILOG("%s: %u unique meshes, %u instances", filename, (u32)submeshModels.size(), instanceCount);
+
+    return rootIdx;
+}
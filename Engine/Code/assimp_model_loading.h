@@ -1,5 +1,65 @@
 #pragma once
 
 #include "engine.h"
+#include "geometry_arena.h"
 
-u32 LoadModel(App* app, const char* filename);
\ No newline at end of file
+#define MATERIAL_TEXTURE_COUNT 5 // albedo, emissive, specular, normals, bump
+
+u32&         MaterialTextureIdx(Material& material, u32 slot);
+TextureUsage MaterialTextureUsage(u32 slot); // the normals slot holds a normal map
+
+// Node of the source scene graph, instanced imports only
+struct ImportedNode
+{
+    Transform transform; // local, the node matrix decomposed (shear is lost)
+    u32       parentIdx; // into nodes, parents come first. UINT32_MAX for the root
+    u32       firstMesh; // into nodeMeshes
+    u32       meshCount;
+};
+
+// CPU side of LoadModel, it touches nothing in App so any thread can run it
+struct ImportedModel
+{
+    Mesh                     mesh;
+    std::vector<u32>         submeshMaterials; // into materials
+    std::vector<Material>    materials;        // textures not loaded yet (UINT32_MAX)
+    std::vector<std::string> texturePaths;     // MATERIAL_TEXTURE_COUNT per material, empty if none
+
+    // instanced imports keep the node graph, with one submesh per referenced
+    // aiMesh however many nodes reference it
+    std::vector<ImportedNode> nodes;
+    std::vector<u32>          nodeMeshes; // into mesh.submeshes
+
+    // gpu streams of the submeshes, ImportPreparedModel only. Read from the
+    // mesh cache they point into its mapping, kept until ReleaseImportedGeometry.
+    std::vector<SubmeshGeometryData> geometry;
+    MappedFile                       cacheFile;
+};
+
+// A baked import pre-transforms every node into a single mesh, an instanced
+// one keeps the nodes (see LoadModelInstances)
+bool ImportModel(const char* filename, ImportedModel& imported, bool instanced = false);
+
+// ImportModel + PrepareMeshGeometry + the gpu streams, read from the mesh
+// cache of the file when it is up to date and saved to it otherwise (see
+// mesh_cache.h)
+bool ImportPreparedModel(const char* filename, ImportedModel& imported, bool instanced = false);
+
+// Once the streams are uploaded, unmaps the mesh cache
+void ReleaseImportedGeometry(ImportedModel& imported);
+
+// Model with an empty mesh, it draws nothing until SetImportedModel fills it
+u32 AddEmptyModel(App* app);
+
+// Mesh and materials of a model from an import, its submeshes move out of
+// it. The arena ranges of the submeshes it replaces are freed, the gpu
+// geometry of the new ones is up to the caller (see AllocateSubmeshGeometry).
+void SetImportedModel(App* app, u32 modelIdx, ImportedModel& imported, u32 baseMeshMaterialIndex);
+u32  AddImportedModel(App* app, ImportedModel& imported, u32 baseMeshMaterialIndex);
+
+u32 LoadModel(App* app, const char* filename);
+
+// Keeps the node graph instead of baking it: every referenced aiMesh is
+// uploaded once as its own model and every node becomes an entity under a
+// root entity with the given transform. Returns the root entity.
+u32 LoadModelInstances(App* app, const char* filename, const Transform& transform, u32 parentIdx = ENTITY_NO_PARENT, u8 flags = 0);
@@ -0,0 +1,98 @@
+#include "buddy_allocator.h"
+#include "buffer_management.h"
+
+static u32 BlockOrder(const BuddyAllocator& allocator, u32 size)
+{
+    u32 order = 0;
+    while ((allocator.minBlockSize << order) < size)
+        order++;
+    return order;
+}
+
+static bool RemoveFreeBlock(BuddyAllocator& allocator, u32 order, u32 offset)
+{
+    std::vector<u32>& blocks = allocator.freeBlocks[order];
+    for (u32 i = 0; i < blocks.size(); ++i)
+    {
+        if (blocks[i] == offset)
+        {
+            blocks[i] = blocks.back();
+            blocks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+BuddyAllocator CreateBuddyAllocator(u32 capacity, u32 minBlockSize)
+{
+    ASSERT(IsPowerOf2(minBlockSize), "The minimum block size must be a power of 2");
+
+    BuddyAllocator allocator = {};
+    allocator.minBlockSize = minBlockSize;
+    allocator.maxOrder = BlockOrder(allocator, capacity);
+    allocator.freeBlocks.resize(allocator.maxOrder + 1);
+    allocator.freeBlocks[allocator.maxOrder].push_back(0);
+    return allocator;
+}
+
+u32 BuddyCapacity(const BuddyAllocator& allocator)
+{
+    return allocator.minBlockSize << allocator.maxOrder;
+}
+
+u32 BuddyAllocate(BuddyAllocator& allocator, u32 size)
+{
+    const u32 order = BlockOrder(allocator, size);
+
+    // smallest free block that fits
+    u32 freeOrder = order;
+    while (freeOrder <= allocator.maxOrder && allocator.freeBlocks[freeOrder].empty())
+        freeOrder++;
+
+    if (freeOrder > allocator.maxOrder)
+        return BUDDY_ALLOCATION_FAILED;
+
+    u32 offset = allocator.freeBlocks[freeOrder].back();
+    allocator.freeBlocks[freeOrder].pop_back();
+
+    // split it until it has the requested order, freeing the upper halves
+    while (freeOrder > order)
+    {
+        freeOrder--;
+        allocator.freeBlocks[freeOrder].push_back(offset + (allocator.minBlockSize << freeOrder));
+    }
+
+    return offset;
+}
+
+void BuddyFree(BuddyAllocator& allocator, u32 offset, u32 size)
+{
+    u32 order = BlockOrder(allocator, size);
+
+    // merge with the buddy while it is free
+    while (order < allocator.maxOrder)
+    {
+        const u32 buddy = offset ^ (allocator.minBlockSize << order);
+        if (!RemoveFreeBlock(allocator, order, buddy))
+            break;
+
+        offset = offset < buddy ? offset : buddy;
+        order++;
+    }
+
+    allocator.freeBlocks[order].push_back(offset);
+}
+
+void BuddyGrow(BuddyAllocator& allocator)
+{
+    // the current range becomes the lower half of a block twice as big
+    const u32 oldOrder = allocator.maxOrder;
+    allocator.maxOrder++;
+    allocator.freeBlocks.resize(allocator.maxOrder + 1);
+
+    if (RemoveFreeBlock(allocator, oldOrder, 0))
+        allocator.freeBlocks[allocator.maxOrder].push_back(0);
+    else
+        allocator.freeBlocks[oldOrder].push_back(allocator.minBlockSize << oldOrder);
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "platform.h"
+
+#define BUDDY_ALLOCATION_FAILED UINT32_MAX
+
+// Power of two buddy allocator over an abstract range of units (vertices,
+// indices...). It only hands out offsets, the memory itself lives elsewhere
+// (e.g. in a gpu buffer owned by a geometry arena).
+struct BuddyAllocator
+{
+    u32 minBlockSize; // units of the smallest block
+    u32 maxOrder;     // the whole range is a single block of this order
+    std::vector<std::vector<u32>> freeBlocks; // offsets of the free blocks of each order
+};
+
+BuddyAllocator CreateBuddyAllocator(u32 capacity, u32 minBlockSize);
+u32            BuddyCapacity(const BuddyAllocator& allocator);
+u32            BuddyAllocate(BuddyAllocator& allocator, u32 size);
+void           BuddyFree(BuddyAllocator& allocator, u32 offset, u32 size);
+void           BuddyGrow(BuddyAllocator& allocator);
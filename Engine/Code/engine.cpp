@@ -11,10 +11,24 @@
 #include <stb_image_write.h>
 #include "assimp_model_loading.h"
 #include "generator_model_loading.h"
+#include "model_loading.h"
+#include "geometry_arena.h"
+#include "meshlets.h"
+#include "render_queue.h"
+#include "static_batching.h"
+#include "entity_transforms.h"
+#include "entities.h"
+#include "simulation.h"
+#include "job_system.h"
+#include "gl_state.h"
+#include "materials.h"
+#include "gl_extensions.h"
+#include "resource_loader.h"
+#include "texture_cooker.h"
 
 using namespace glm;
 
-GLuint CreateProgramFromSource(String programSource, const char* shaderName)
+GLuint CreateProgramFromSource(String programSource, const char* shaderName, const char* defines)
 {
     GLchar  infoLogBuffer[1024] = {};
     GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
@@ -30,24 +44,28 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
     const GLchar* vertexShaderSource[] = {
         versionString,
         shaderNameDefine,
+        defines,
         vertexShaderDefine,
         programSource.str
     };
     const GLint vertexShaderLengths[] = {
         (GLint) strlen(versionString),
         (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(defines),
         (GLint) strlen(vertexShaderDefine),
         (GLint) programSource.len
     };
     const GLchar* fragmentShaderSource[] = {
         versionString,
         shaderNameDefine,
+        defines,
         fragmentShaderDefine,
         programSource.str
     };
     const GLint fragmentShaderLengths[] = {
         (GLint) strlen(versionString),
         (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(defines),
         (GLint) strlen(fragmentShaderDefine),
         (GLint) programSource.len
     };
@@ -93,24 +111,94 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
     return programHandle;
 }
 
-u32 LoadProgram(App* app, const char* filepath, const char* programName)
+GLuint CreateComputeProgramFromSource(String programSource, const char* shaderName)
+{
+    GLchar  infoLogBuffer[1024] = {};
+    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+    GLsizei infoLogSize;
+    GLint   success;
+
+    char versionString[] = "#version 430\n";
+    char shaderNameDefine[128];
+    sprintf_s(shaderNameDefine, "#define %s\n", shaderName);
+    char computeShaderDefine[] = "#define COMPUTE\n";
+
+    const GLchar* computeShaderSource[] = {
+        versionString,
+        shaderNameDefine,
+        computeShaderDefine,
+        programSource.str
+    };
+    const GLint computeShaderLengths[] = {
+        (GLint) strlen(versionString),
+        (GLint) strlen(shaderNameDefine),
+        (GLint) strlen(computeShaderDefine),
+        (GLint) programSource.len
+    };
+
+    GLuint cshader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(cshader, ARRAY_COUNT(computeShaderSource), computeShaderSource, computeShaderLengths);
+    glCompileShader(cshader);
+    glGetShaderiv(cshader, GL_COMPILE_STATUS, &success);
+    if (!success)
+    {
+        glGetShaderInfoLog(cshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glCompileShader() failed with compute shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+    }
+
+    GLuint programHandle = glCreateProgram();
+    glAttachShader(programHandle, cshader);
+    glLinkProgram(programHandle);
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glGetProgramInfoLog(programHandle, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glLinkProgram() failed with program %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+    }
+
+    glDetachShader(programHandle, cshader);
+    glDeleteShader(cshader);
+
+    return programHandle;
+}
+
+u32 LoadProgram(App* app, const char* filepath, const char* programName, const char* defines = "")
+{
+    String programSource = ReadTextFile(filepath);
+
+    Program program = {};
+    program.handle = CreateProgramFromSource(programSource, programName, defines);
+    program.filepath = filepath;
+    program.programName = programName;
+    program.defines = defines;
+    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    FillProgramReflection(program);
+    FillDrawUniformLocations(program);
+    app->programs.push_back(program);
+
+    return app->programs.size() - 1;
+}
+
+u32 LoadComputeProgram(App* app, const char* filepath, const char* programName)
 {
     String programSource = ReadTextFile(filepath);
 
     Program program = {};
-    program.handle = CreateProgramFromSource(programSource, programName);
+    program.handle = CreateComputeProgramFromSource(programSource, programName);
     program.filepath = filepath;
     program.programName = programName;
     program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+    program.compute = true;
+    FillProgramReflection(program);
     app->programs.push_back(program);
 
     return app->programs.size() - 1;
 }
 
-Image LoadImage(const char* filename)
+Image LoadImage(const char* filename, bool flipVertically)
 {
     Image img = {};
-    stbi_set_flip_vertically_on_load(true);
+    stbi_set_flip_vertically_on_load_thread(flipVertically); // the resource loader decodes on the workers
     img.pixels = stbi_load(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
     if (img.pixels)
     {
@@ -156,30 +244,65 @@ GLuint CreateTexture2DFromImage(Image image)
     return texHandle;
 }
 
-u32 LoadTexture2D(App* app, const char* filepath)
+u32 FindTexture2D(App* app, const char* filepath, TextureUsage usage)
 {
     for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
-        if (app->textures[texIdx].filepath == filepath)
+        if (app->textures[texIdx].filepath == filepath && app->textures[texIdx].usage == usage)
             return texIdx;
+    return UINT32_MAX;
+}
 
-    Image image = LoadImage(filepath);
-
-    if (image.pixels)
+void LoadTextures2D(App* app, u32 count, const char* const* filepaths, const TextureUsage* usages, u32* texIndices)
+{
+    // files not loaded yet, once each per usage
+    std::vector<const char*> newFiles;
+    std::vector<TextureUsage> newUsages;
+    for (u32 i = 0; i < count; ++i)
     {
-        Texture tex = {};
-        tex.handle = CreateTexture2DFromImage(image);
-        tex.filepath = filepath;
+        const TextureUsage usage = usages ? usages[i] : TextureUsage_Color;
+        texIndices[i] = FindTexture2D(app, filepaths[i], usage);
+        if (texIndices[i] != UINT32_MAX)
+            continue;
+
+        bool requested = false;
+        for (u32 j = 0; j < newFiles.size(); ++j)
+            requested = requested || (strcmp(newFiles[j], filepaths[i]) == 0 && newUsages[j] == usage);
+        if (!requested)
+        {
+            newFiles.push_back(filepaths[i]);
+            newUsages.push_back(usage);
+        }
+    }
 
-        u32 texIdx = app->textures.size();
-        app->textures.push_back(tex);
+    // decoded/cooked on every thread, uploaded here in order
+    std::vector<DecodedTexture> decoded(newFiles.size());
+    std::vector<u8> decodedOk(newFiles.size(), 0);
+    ParallelFor(newFiles.size(), 1, [&](u32 begin, u32 end)
+    {
+        for (u32 i = begin; i < end; ++i)
+            decodedOk[i] = DecodeTexture(newFiles[i], true, app->s3tcTextures, newUsages[i], decoded[i]);
+    });
 
-        FreeImage(image);
-        return texIdx;
-    }
-    else
+    for (u32 i = 0; i < newFiles.size(); ++i)
     {
-        return UINT32_MAX;
+        if (!decodedOk[i])
+            continue;
+
+        Texture tex;
+        CreateTextureFromDecoded(newFiles[i], decoded[i], tex);
+        app->textures.push_back(tex);
     }
+
+    for (u32 i = 0; i < count; ++i)
+        if (texIndices[i] == UINT32_MAX)
+            texIndices[i] = FindTexture2D(app, filepaths[i], usages ? usages[i] : TextureUsage_Color);
+}
+
+u32 LoadTexture2D(App* app, const char* filepath, TextureUsage usage)
+{
+    u32 texIdx;
+    LoadTextures2D(app, 1, &filepath, &usage, &texIdx);
+    return texIdx;
 }
 
 void Init(App* app)
@@ -196,11 +319,24 @@ void Init(App* app)
     // Fill opengl info once at init
     FillOpenGLInfo(app);
 
+    // Optional extensions
+    app->bindlessTextures = LoadBindlessTextureExtension();
+    ILOG("Bindless textures: %s", app->bindlessTextures ? "enabled" : "not supported, using texture arrays");
+    app->s3tcTextures = HasGLExtension("GL_EXT_texture_compression_s3tc");
+    ILOG("S3TC textures: %s", app->s3tcTextures ? "enabled" : "not supported, color textures stay uncompressed");
+
+    // scene pass programs sample materials through bindless handles when available
+    const char* materialDefines = app->bindlessTextures ? BINDLESS_TEXTURES_DEFINES : "";
+    const std::string pullingDefines = std::string("#define VERTEX_PULLING\n") + materialDefines;
+
     // SSAO ------------------------------------------------------
-    // SSAO kernel
+    // SSAO kernel, constant so it is uploaded once to its own ubo
     std::uniform_real_distribution<float> randomFloats(0.0f, 1.0f);
     std::default_random_engine generator;
-    
+
+    app->ssaoKernelBuffer = CreateBuffer(64 * sizeof(vec4), GL_UNIFORM_BUFFER, GL_STATIC_DRAW);
+    MapBuffer(app->ssaoKernelBuffer, GL_WRITE_ONLY);
+
     for (unsigned int i = 0; i < 64; ++i)
     {
         glm::vec3 sample(
@@ -214,9 +350,11 @@ void Init(App* app)
         float scale = (float)i / 64.0f;
         scale = Lerp(0.1f, 1.0f, scale * scale);
         sample *= scale;
-        app->ssaoKernel.push_back(sample);
+        PushVec3(app->ssaoKernelBuffer, sample);
     }
 
+    UnmapBuffer(app->ssaoKernelBuffer);
+
     // SSAO noise
     std::vector<glm::vec3> ssaoNoise;
     for (unsigned int i = 0; i < 16; ++i)
@@ -466,7 +604,7 @@ void Init(App* app)
             "Cubemap/back.png"
     };
 
-    app->cubeMapId = LoadCubemap(facePaths);
+    app->cubeMapId = LoadCubemap(app, facePaths);
 
     // load z pre pass program --------------------------------------
     app->zPrePassProgramIdx = LoadProgram(app, "shaders.glsl", "Z_PRE_PASS");
@@ -474,7 +612,7 @@ void Init(App* app)
     FillInputVertexShaderLayout(zPreProg);
 
     // load forward render program ----------------------------------
-    app->fordwardProgramIdx = LoadProgram(app, "shaders.glsl", "FORWARD");
+    app->fordwardProgramIdx = LoadProgram(app, "shaders.glsl", "FORWARD", materialDefines);
     Program& forwardProg = app->programs[app->fordwardProgramIdx];
     FillInputVertexShaderLayout(forwardProg);
 
@@ -489,7 +627,7 @@ void Init(App* app)
     FillInputVertexShaderLayout(ssaoBlurProg);
 
     // load geometry first pass program -----------------------------
-    app->geometryPassProgramIdx = LoadProgram(app, "shaders.glsl", "GEOMETRY_PASS");
+    app->geometryPassProgramIdx = LoadProgram(app, "shaders.glsl", "GEOMETRY_PASS", materialDefines);
     Program& p = app->programs[app->geometryPassProgramIdx];
     FillInputVertexShaderLayout(p);
 
@@ -510,6 +648,21 @@ void Init(App* app)
     Program& skyboxProgram = app->programs[app->skyboxProgramIdx];
     FillInputVertexShaderLayout(skyboxProgram);
 
+    // meshlet culling compute program --------------------------
+    app->meshletCullingProgramIdx = LoadComputeProgram(app, "shaders.glsl", "MESHLET_CULLING");
+
+    // vertex pulling variants (fetch attributes from ssbos) -----
+    app->zPrePassPullingProgramIdx = LoadProgram(app, "shaders.glsl", "Z_PRE_PASS", "#define VERTEX_PULLING\n");
+    FillInputVertexShaderLayout(app->programs[app->zPrePassPullingProgramIdx]);
+    app->geometryPassPullingProgramIdx = LoadProgram(app, "shaders.glsl", "GEOMETRY_PASS", pullingDefines.c_str());
+    FillInputVertexShaderLayout(app->programs[app->geometryPassPullingProgramIdx]);
+    app->forwardPullingProgramIdx = LoadProgram(app, "shaders.glsl", "FORWARD", pullingDefines.c_str());
+    FillInputVertexShaderLayout(app->programs[app->forwardPullingProgramIdx]);
+    glGenVertexArrays(1, &app->emptyVao);
+
+    // Geometry arenas (shared vertex/index buffers) ----------
+    InitGeometryArenas(app);
+
     // Quad mesh  ----------------------------------
 
     {
@@ -545,22 +698,15 @@ void Init(App* app)
             ind.push_back(indices[i]);
         }
 
+        // the quad keeps the float format, too small to be worth compressing
         Submesh submesh = {};
         submesh.vertexBufferLayout = vertexBufferLayout;
-        submesh.vertices.swap(v);
+        submesh.vertices.assign((const u8*)v.data(), (const u8*)(v.data() + v.size()));
         submesh.indices.swap(ind);
         mesh.submeshes.push_back(submesh);
 
         // Geometry
-        glGenBuffers(1, &mesh.vertexBufferHandle);
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-        glGenBuffers(1, &mesh.indexBufferHandle);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        LoadMeshGlBuffers(app, mesh);
     }
 
    // ------------------------------------------------------------------------
@@ -574,6 +720,7 @@ void Init(App* app)
    defaultMaterial.name = "defaultMaterial";
    defaultMaterial.albedo = vec3(.8f, .8f, .8f);
    defaultMaterial.albedoTextureIdx = app->whiteTexIdx;
+   defaultMaterial.normalsTextureIdx = UINT32_MAX; // no normal map
 
    // Load Default Models
 
@@ -588,57 +735,52 @@ void Init(App* app)
 
    // Models
    {
-       Entity defaultElement = {};
-
-       defaultElement.modelIndex = app->defaultModelsId[(int)DefaultModelType::Plane];
-
-       defaultElement.worldMatrix = TransformWorldMatrix({ 0.f,-3.8f,0.f }, { 0,0,0 }, vec3(3.0));
-       app->entities.push_back(defaultElement);
-
-       defaultElement.worldMatrix = TransformWorldMatrix({- 10.f,-3.8f,3.f }, { 0, 0,-90 }, vec3(1, 1, 1));
-       app->entities.push_back(defaultElement);
-
-       defaultElement.modelIndex = app->defaultModelsId[(int)DefaultModelType::Cone];
-
-       defaultElement.worldMatrix = TransformWorldMatrix(vec3(7.f, 4.f, 2.f), vec3(-30.f, 0.f, 30.f), vec3(2.f));
-       app->entities.push_back(defaultElement);
+       // nothing in the default scene moves after Init, it all goes to the static batch
+       const u8 flags = EntityFlag_Static;
 
-       defaultElement.modelIndex = app->defaultModelsId[(int)DefaultModelType::Torus];
+       u32 model = app->defaultModelsId[(int)DefaultModelType::Plane];
+       CreateEntity(app, model, MakeTransform({ 0.f,-3.8f,0.f }, { 0,0,0 }, vec3(3.0)), ENTITY_NO_PARENT, flags);
+       CreateEntity(app, model, MakeTransform({- 10.f,-3.8f,3.f }, { 0, 0,-90 }, vec3(1, 1, 1)), ENTITY_NO_PARENT, flags);
 
-       defaultElement.worldMatrix = TransformWorldMatrix({ 0.f,3, 5.f }, { 0,0,0 }, vec3(1.f));
-       app->entities.push_back(defaultElement);
+       model = app->defaultModelsId[(int)DefaultModelType::Cone];
+       CreateEntity(app, model, MakeTransform(vec3(7.f, 4.f, 2.f), vec3(-30.f, 0.f, 30.f), vec3(2.f)), ENTITY_NO_PARENT, flags);
 
-       defaultElement.modelIndex = app->defaultModelsId[(int)DefaultModelType::Cube];
+       model = app->defaultModelsId[(int)DefaultModelType::Torus];
+       CreateEntity(app, model, MakeTransform({ 0.f,3, 5.f }, { 0,0,0 }, vec3(1.f)), ENTITY_NO_PARENT, flags);
 
-       defaultElement.worldMatrix = TransformWorldMatrix({ 0.f,3.8,-5.f }, { 30,-30,30 }, vec3(2.f));
-       app->entities.push_back(defaultElement);
+       model = app->defaultModelsId[(int)DefaultModelType::Cube];
+       CreateEntity(app, model, MakeTransform({ 0.f,3.8,-5.f }, { 30,-30,30 }, vec3(2.f)), ENTITY_NO_PARENT, flags);
 
-       defaultElement.modelIndex = app->defaultModelsId[(int)DefaultModelType::Sphere];
+       model = app->defaultModelsId[(int)DefaultModelType::Sphere];
+       CreateEntity(app, model, MakeTransform({ -7.f,0.5 ,7.f }, { 30,-30,30 }, vec3(2.f)), ENTITY_NO_PARENT, flags);
 
-       defaultElement.worldMatrix = TransformWorldMatrix({ -7.f,0.5 ,7.f }, { 30,-30,30 }, vec3(2.f));
-       app->entities.push_back(defaultElement);
+       model = app->defaultModelsId[(int)DefaultModelType::Suzanne];
+       CreateEntity(app, model, MakeTransform({ -5.f,3.8, 10.f }, { 30,-30,30 }, vec3(2.f)), ENTITY_NO_PARENT, flags);
 
-       defaultElement.modelIndex = app->defaultModelsId[(int)DefaultModelType::Suzanne];
 
-       defaultElement.worldMatrix = TransformWorldMatrix({ -5.f,3.8, 10.f }, { 30,-30,30 }, vec3(2.f));
-       app->entities.push_back(defaultElement);
+       // streamed, drawn once it arrives. Its entities stay out of the static batch, built before that
+       u32 patrick = StreamModel(app, "Patrick/Patrick.obj");
 
+       CreateEntity(app, patrick, MakeTransform(vec3(0, 0., 5.), vec3(0.f), vec3(1.0)));
+       CreateEntity(app, patrick, MakeTransform(vec3(6, 0., 10.), vec3(0.f, 30, 0), vec3(1.0)));
+       CreateEntity(app, patrick, MakeTransform(vec3(-6, 0. ,0.), vec3(30.f, -180, 0), vec3(1.0)));
+       CreateEntity(app, patrick, MakeTransform(vec3(6, 0., 0.), vec3(30.f, -60, 0), vec3(0.5)));
 
-       Entity patrick = {};
-       patrick.modelIndex = LoadModel(app, "Patrick/Patrick.obj");
+       // node graph import, one entity per node drawing meshes uploaded once.
+       // Kept dynamic, the static batch would copy the meshes of every instance
+       LoadModelInstances(app, "Suzanne/suzanne.obj", MakeTransform({ 5.f,3.8, 10.f }, { 30,30,-30 }, vec3(2.f)));
 
-       patrick.worldMatrix = TransformWorldMatrix(vec3(0, 0., 5.), vec3(0.f), vec3(1.0));
-       app->entities.push_back(patrick);
+       // the batches are built from the world matrices
+       UpdateEntityHierarchy(app);
+       BuildStaticBatches(app);
 
-       patrick.worldMatrix = TransformWorldMatrix(vec3(6, 0., 10.), vec3(0.f, 30, 0), vec3(1.0));
-       app->entities.push_back(patrick);
-
-       patrick.worldMatrix = TransformWorldMatrix(vec3(-6, 0. ,0.), vec3(30.f, -180, 0), vec3(1.0));
-       app->entities.push_back(patrick);
-
-
-       patrick.worldMatrix = TransformWorldMatrix(vec3(6, 0., 0.), vec3(30.f, -60, 0), vec3(0.5));
-       app->entities.push_back(patrick);
+       // moved every frame by AnimateScene through their local transforms, the
+       // hierarchy takes the planet around the pivot and the moon around the planet
+       app->orbitPivotEntity = CreateEntity(app, ENTITY_NO_MODEL, MakeTransform(vec3(0.f, 3.f, 5.f), vec3(0.f), vec3(1.f)));
+       model = app->defaultModelsId[(int)DefaultModelType::Sphere];
+       app->orbitPlanetEntity = CreateEntity(app, model, MakeTransform(vec3(4.f, 0.f, 0.f), vec3(0.f), vec3(0.6f)), app->orbitPivotEntity);
+       model = app->defaultModelsId[(int)DefaultModelType::Cube];
+       CreateEntity(app, model, MakeTransform(vec3(2.5f, 0.f, 0.f), vec3(0.f), vec3(0.3f)), app->orbitPlanetEntity);
 
 
    }
@@ -648,7 +790,6 @@ void Init(App* app)
        vec3 colorGreen =  vec3(0.0, 1.0, 0.0 );
        vec3 colorBlue =   vec3(0.0, 0.0, 1.0 );
        vec3 colorYellow = vec3(1.0, 1.0, 0.0 ) * 0.5f;
-       vec3 colorWhite =  vec3(1.0, 1.0, 1.0 );
        vec3 colorPurple =  vec3(1.0, 0.0, 1.0 ) * 0.5f;
        vec3 colorOrange =  vec3(1.0, 0.6, 0.0 ) * 0.5f;
 
@@ -713,29 +854,117 @@ void Init(App* app)
        light.position = { -6.0, -6.0, -10.0 };
        app->lights.push_back(light);
    }
+
+   // the first frame is simulated here, Render always has a published one
+   UpdateSimulation(app);
 }
 
-uint LoadCubemap(std::vector<std::string> facesPaths)
+uint LoadCubemap(App* app, std::vector<std::string> facesPaths)
 {
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    // the faces are cooked/decoded in parallel, uploaded after. The freshly
+    // cooked ones keep their pixels in case the faces can't be compressed together.
+    DecodedTexture faces[6];
+    u8 decodedOk[6] = {};
+    ParallelFor(6, 1, [&](u32 begin, u32 end)
+    {
+        for (u32 i = begin; i < end; ++i)
+            decodedOk[i] = DecodeTexture(facesPaths[i].c_str(), false, app->s3tcTextures, TextureUsage_Color, faces[i], true);
+    });
+
+    bool loaded = true;
+    bool compressed = true;
+    for (u32 i = 0; i < 6; ++i)
+    {
+        if (!decodedOk[i])
+        {
+            ELOG("Cubemap face %s couldn't be loaded", facesPaths[i].c_str());
+            loaded = false;
+        }
+
+        const CookedTexture& face = faces[i].cooked;
+        compressed = compressed && face.levels && face.size == faces[0].cooked.size && face.internalFormat == faces[0].cooked.internalFormat;
+    }
 
-    int width, height, nrChannels;
-    unsigned char* data;
-    for (unsigned int i = 0; i < 6; i++)
+    GLuint textureID = 0;
+    if (loaded && compressed)
     {
-        data = stbi_load(facesPaths[i].c_str(), &width, &height, &nrChannels, 0);
-        glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
+        CookedTexture cookedFaces[6];
+        for (u32 i = 0; i < 6; ++i)
+        {
+            cookedFaces[i] = std::move(faces[i].cooked);
+            FreeImage(faces[i].image);
+        }
+        textureID = CreateCubemapFromCooked(cookedFaces);
+        for (u32 i = 0; i < 6; ++i)
+            FreeCookedTexture(cookedFaces[i]);
+        return textureID;
     }
 
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    // uncompressed, only the faces read from the texture cache have to be decoded
+    Image images[6];
+    for (u32 i = 0; i < 6; ++i)
+    {
+        FreeCookedTexture(faces[i].cooked);
+        images[i] = faces[i].image;
+    }
 
-    glBindFramebuffer(GL_TEXTURE_CUBE_MAP, 0);
+    if (loaded)
+    {
+        ParallelFor(6, 1, [&](u32 begin, u32 end)
+        {
+            for (u32 i = begin; i < end; ++i)
+                if (!images[i].pixels)
+                    images[i] = LoadImage(facesPaths[i].c_str(), false);
+        });
+    }
+
+    // one sized format for every face, the one of the most channels
+    static const GLenum internalFormats[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+    static const GLenum dataFormats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    i32 channels = 0;
+    for (u32 i = 0; i < 6; ++i)
+    {
+        if (!images[i].pixels || images[i].size != images[0].size || images[i].nchannels < 1 || images[i].nchannels > 4)
+        {
+            if (loaded)
+                ELOG("Cubemap face %s can't be used, faces need the same size and 1 to 4 channels", facesPaths[i].c_str());
+            loaded = false;
+        }
+        else if (images[i].nchannels > channels)
+        {
+            channels = images[i].nchannels;
+        }
+    }
+
+    if (loaded)
+    {
+        glGenTextures(1, &textureID);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+        glTexStorage2D(GL_TEXTURE_CUBE_MAP, 1, internalFormats[channels - 1], images[0].size.x, images[0].size.y);
+
+        // rows of 1 to 3 channel images aren't 4 byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (u32 i = 0; i < 6; i++)
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, images[i].size.x, images[i].size.y, dataFormats[images[i].nchannels - 1], GL_UNSIGNED_BYTE, images[i].pixels);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        if (channels <= 2)
+        {
+            // grey (alpha), like the cooked ones
+            const GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, channels == 2 ? GL_GREEN : GL_ONE };
+            glTexParameteriv(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+        }
+
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    }
+
+    for (u32 i = 0; i < 6; ++i)
+        FreeImage(images[i]);
 
     return textureID;
 }
@@ -837,6 +1066,36 @@ void Gui(App* app)
 
     ImGui::Checkbox("Fake Reflections", &app->doFakeReflections);
 
+    ImGui::Checkbox("Meshlet culling", &app->doMeshletCulling);
+    ImGui::SameLine();
+    ImGui::Text("(%u meshlets)", app->meshletCount);
+
+    ImGui::Checkbox("Vertex pulling", &app->vertexPulling);
+
+    ImGui::Checkbox("Static batching", &app->staticBatching);
+
+    const RenderQueueStats& stats = app->renderQueueStats;
+    ImGui::Text("Draws: %u (%u static chunks culled)", stats.draws, stats.culledChunks);
+    ImGui::Text("State changes: %u program, %u vertex format, %u material, %u entity",
+                stats.programBinds, stats.vertexFormatBinds, stats.materialChanges, stats.entityChanges);
+    ImGui::Text("GL state calls: %u forwarded, %u filtered", app->glStateForwardedCalls, app->glStateFilteredCalls);
+    ImGui::Checkbox("Pipelined update", &app->pipelinedUpdate);
+    ImGui::Text("Pending loads: %u", PendingLoadCount());
+    ImGui::Text("Entities: %u, update %.3f ms on %u threads", app->entities.count, app->frame.entityUpdateMs, JobSystemThreadCount());
+    ImGui::Text("  SoA kernels: bounds %.3f ms, visibility %.3f ms", app->frame.entityBoundsMs, app->frame.entityVisibilityMs);
+
+    // busy time of every job system thread since the previous frame
+    SampleJobSystemUtilisation(app->jobUtilisation);
+    for (u32 i = 0; i < app->jobUtilisation.size(); ++i)
+    {
+        char label[32];
+        if (i == 0)
+            sprintf_s(label, sizeof(label), "main %.0f%%", app->jobUtilisation[i] * 100.f);
+        else
+            sprintf_s(label, sizeof(label), "worker %u %.0f%%", i, app->jobUtilisation[i] * 100.f);
+        ImGui::ProgressBar(app->jobUtilisation[i], ImVec2(-1.f, 0.f), label);
+    }
+
     ImGui::End();
 
     if (app->showGlInfo)
@@ -871,17 +1130,33 @@ void Update(App* app)
             glDeleteProgram(program.handle);
             String programSource = ReadTextFile(program.filepath.c_str());
             const char* programName = program.programName.c_str();
-            program.handle = CreateProgramFromSource(programSource, programName);
+            program.handle = program.compute ? CreateComputeProgramFromSource(programSource, programName)
+                                             : CreateProgramFromSource(programSource, programName, program.defines.c_str());
             program.lastWriteTimestamp = lastTimestamp;
+            FillProgramReflection(program);
+
+            if (!program.compute)
+            {
+                FillDrawUniformLocations(program);
+
+                // vaos built for the old vertex inputs are no longer valid
+                u64 oldInputLayoutHash = program.vertexInputLayoutHash;
+                program.vertexInputLayout.attributes.clear();
+                FillInputVertexShaderLayout(program);
+                if (program.vertexInputLayoutHash != oldInputLayoutHash)
+                    InvalidateCachedVAOs(app, oldInputLayoutHash);
+            }
         }
     }
 
-    // update projection and view mat
+    // resources from the loader thread, their callbacks may create entities
+    FinishSimulation(app);
+    ProcessCompletedLoads(app);
 
-    UpdateCamera(app);
-    UpdateProjectionView(app);
+    // camera/entities, on a worker with pipelinedUpdate. Everything below reads the published frame
+    UpdateSimulation(app);
 
-    // update uniform global/local params buffer block
+    // update uniform global/camera params buffer block
     {
         BindBuffer(app->cbuffer);
         MapBuffer(app->cbuffer, GL_WRITE_ONLY);
@@ -889,14 +1164,14 @@ void Update(App* app)
         {
             app->globalParamsOffset = app->cbuffer.head;
 
-            PushVec3(app->cbuffer, -app->camera.position);
-            PushUInt(app->cbuffer, app->lights.size());
+            PushVec3(app->cbuffer, -app->frame.cameraPosition);
+            PushUInt(app->cbuffer, app->frame.lights.size());
 
-            for (u32 i = 0; i < app->lights.size(); ++i)
+            for (u32 i = 0; i < app->frame.lights.size(); ++i)
             {
                 AlignHead(app->cbuffer, sizeof(vec4));
 
-                Light& l = app->lights[i];
+                Light& l = app->frame.lights[i];
                 PushUInt(app->cbuffer, l.type);
                 PushVec3(app->cbuffer, l.color);
                 PushVec3(app->cbuffer, l.direction);
@@ -906,83 +1181,71 @@ void Update(App* app)
             app->globalParamsSize = app->cbuffer.head - app->globalParamsOffset;
         }
 
-        // update uniform local params buffer block
+        // camera, the world matrices are resident (see UpdateEntityTransforms)
         {
-            std::vector<Entity>& entities = app->entities;
-
-            for (int i = 0; i < entities.size(); ++i)
-            {
-                // update entity transforms ------
-                Entity& e = entities[i];
-                mat4 worldViewProjection = app->projection * app->view * e.worldMatrix;
+            AlignHead(app->cbuffer, app->uniformBlockAlignment);
+            app->cameraParamsOffset = app->cbuffer.head;
 
-                // -------------------------------
-                AlignHead(app->cbuffer, app->uniformBlockAlignment);
-                e.localParamsOffset = app->cbuffer.head;
+            PushMat4(app->cbuffer, app->frame.view);
+            PushMat4(app->cbuffer, app->frame.projection);
+            PushMat4(app->cbuffer, app->frame.projection * app->frame.view);
 
-                PushMat4(app->cbuffer, e.worldMatrix);
-                PushMat4(app->cbuffer, worldViewProjection);
-
-                e.localParamsSize = app->cbuffer.head - e.localParamsOffset;
-            }
+            app->cameraParamsSize = app->cbuffer.head - app->cameraParamsOffset;
         }
 
         UnmapBuffer(app->cbuffer);
     }
+
+    // pack materials/textures loaded since the last frame
+    UpdateMaterialBuffer(app);
+
+    // the world matrices moved by the simulation go to the gpu
+    UpdateEntityTransforms(app);
 }
 
 
 
+// Pipeline state of each pass:
+// depthTest, depthWrite, depthFunc, colorWrite, blend, blendEquation, blendSrc, blendDst, cullFace, cullMode
+static const PipelineState zPrePassPipeline    = { true,  true,  GL_LESS,   false, false, GL_FUNC_ADD, GL_ONE,       GL_ZERO,                false, GL_BACK  };
+static const PipelineState scenePipeline       = { true,  false, GL_EQUAL,  true,  true,  GL_FUNC_ADD, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, false, GL_BACK  };
+static const PipelineState ssaoPipeline        = { false, false, GL_LESS,   true,  true,  GL_FUNC_ADD, GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, false, GL_BACK  };
+static const PipelineState lightQuadPipeline   = { false, false, GL_LESS,   true,  true,  GL_FUNC_ADD, GL_ONE,       GL_ONE,                 false, GL_BACK  };
+static const PipelineState lightVolumePipeline = { false, false, GL_LESS,   true,  true,  GL_FUNC_ADD, GL_ONE,       GL_ONE,                 true,  GL_FRONT };
+static const PipelineState skyboxPipeline      = { true,  false, GL_LEQUAL, true,  false, GL_FUNC_ADD, GL_ONE,       GL_ZERO,                false, GL_BACK  };
+static const PipelineState screenQuadPipeline  = { false, false, GL_LESS,   true,  false, GL_FUNC_ADD, GL_ONE,       GL_ZERO,                false, GL_BACK  };
+
 void Render(App* app)
 {
+    // imgui and everything outside Render touch gl directly
+    InvalidateGlState(app);
+
     switch (app->mode)
     {
         case Mode_TexturedQuad:
             {
-                
-                // Z Pre pass for both rendering pipelines forward/deferred
+                // Sort this frame's submesh draws by state (see render_queue.h)
+                BuildRenderQueue(app);
+
+                // Meshlet culling: fills the indirect draw commands of the scene passes
+                if (app->doMeshletCulling)
                 {
-                    glBindFramebuffer(GL_FRAMEBUFFER, app->zPrePassFbo);
+                    MeshletCullingPass(app);
+                }
 
-                    glDepthMask(GL_TRUE);
-                    //glColorMask(0, 0, 0, 0);
-                    glDepthFunc(GL_LESS);
+                glBindBufferRange(GL_UNIFORM_BUFFER, CAMERA_PARAMS_BINDING, app->cbuffer.handle, app->cameraParamsOffset, app->cameraParamsSize);
 
-                    glEnable(GL_DEPTH_TEST);
-                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-                    //glClearColor(0, 0, 0, 1);
-                    glColorMask(0, 0, 0, 0);
+                // Z Pre pass for both rendering pipelines forward/deferred
+                {
+                    BindFramebuffer(app, GL_FRAMEBUFFER, app->zPrePassFbo);
+                    SetPipelineState(app, zPrePassPipeline);
 
-                    Program& prePassProg = app->programs[app->zPrePassProgramIdx]; //
-                    glUseProgram(prePassProg.handle);
+                    glClear(GL_DEPTH_BUFFER_BIT);
+                    //glClearColor(0, 0, 0, 1);
 
                     // render scene entities -----
-                    for (int idx = 0; idx < app->entities.size(); ++idx)
-                    {
-                        Entity& entity = app->entities[idx];
-                        Model& model = app->models[entity.modelIndex];
-                        Mesh& mesh = app->meshes[model.meshIdx];
-
-                        glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cbuffer.handle, entity.localParamsOffset, entity.localParamsSize);
-
-                        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-                        {
-                            Submesh& submesh = mesh.submeshes[i];
-                            GLuint vao = FindVAO(mesh, i, prePassProg);
-                            glBindVertexArray(vao);
-                          
-                            glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-                        }
-                    }
-
-                    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                    SubmitRenderQueue(app, RenderPass_ZPrePass);
                     // ---------------------------
-
-                    /*glDepthMask(GL_FALSE);
-                    glColorMask(1, 1, 1, 1);
-                    glDepthFunc(GL_EQUAL);*/
-
-                    //glBindVertexArray(0);
                 }
 
                 if (app->deferred)
@@ -990,18 +1253,12 @@ void Render(App* app)
 
                     // Geometry pass -------------------------------------------------------------------
                     {
-                        glEnable(GL_DEPTH_TEST);
-                        glDepthMask(GL_FALSE);
-                        glColorMask(1, 1, 1, 1);
-                        glDepthFunc(GL_EQUAL);
-
-                        glEnable(GL_BLEND);
-                        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                        SetPipelineState(app, scenePipeline);
 
                         // bind default zbuffer for read (from z pre pass depth)
-                        glBindFramebuffer(GL_READ_FRAMEBUFFER, app->zPrePassFbo);
+                        BindFramebuffer(app, GL_READ_FRAMEBUFFER, app->zPrePassFbo);
                         // bind gbuffer to write
-                        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, app->gBuffer);
+                        BindFramebuffer(app, GL_DRAW_FRAMEBUFFER, app->gBuffer);
 
                         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
                         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -1015,103 +1272,51 @@ void Render(App* app)
                         GLuint drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
                         glDrawBuffers(ARRAY_COUNT(drawBuffers), drawBuffers);
 
-                        Program& texturedMeshProgram = app->programs[app->geometryPassProgramIdx/*app->texturedMeshProgramIdx*/];
-                        glUseProgram(texturedMeshProgram.handle);
-
                         glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
 
-                        for (int idx = 0; idx < app->entities.size(); ++idx)
-                        {
-                            Entity& entity = app->entities[idx];
-                            Model& model = app->models[entity.modelIndex];
-                            Mesh& mesh = app->meshes[model.meshIdx];
-
-                            glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cbuffer.handle, entity.localParamsOffset, entity.localParamsSize);
-
-                            for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-                            {
-                                Submesh& submesh = mesh.submeshes[i];
-
-                                GLuint vao = FindVAO(mesh, i, texturedMeshProgram);
-                                glBindVertexArray(vao);
-
-                                u32 submeshMaterilIdx = model.materialIdx[i];
-                                Material& submeshMaterial = app->materials[submeshMaterilIdx];
-
-                                glActiveTexture(GL_TEXTURE0);
-                                glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-                                //glUniform1i(app->texturedMeshProgram_uTexture, 0);
-
-                                //Submesh& submesh = mesh.submeshes[i];
-                                glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-                            }
-                        }
-
-                        glBindVertexArray(0);
-                        glUseProgram(0);
-
-                        //glBindFramebuffer(GL_FRAMEBUFFER, 0);
-                        /*glDepthMask(GL_FALSE);
-                        glDisable(GL_DEPTH_TEST);*/
-                        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                        SubmitRenderQueue(app, RenderPass_Geometry);
                     }
 
                     // SSAO PASS -------------------------------------------------------------
                     if (app->doSSAO)
                     {
                         {
-                            /*glEnable(GL_DEPTH_TEST);
-                             glDepthMask(GL_FALSE);
-                             glColorMask(1, 1, 1, 1);
-                             glDepthFunc(GL_LESS);*/
+                            SetPipelineState(app, ssaoPipeline);
 
-                            glBindFramebuffer(GL_FRAMEBUFFER, app->ssaoFBO);
+                            BindFramebuffer(app, GL_FRAMEBUFFER, app->ssaoFBO);
                             glClear(GL_COLOR_BUFFER_BIT);
 
                             // use ssao program
                             Program& ssaoProg = app->programs[app->ssaoProgramIdx];
-                            glUseProgram(ssaoProg.handle);
+                            BindProgram(app, ssaoProg.handle);
 
                             // bind sampler textures
-                            glActiveTexture(GL_TEXTURE0);
-                            glBindTexture(GL_TEXTURE_2D, app->gPosition);
-
-                            glActiveTexture(GL_TEXTURE1);
-                            glBindTexture(GL_TEXTURE_2D, app->gNormal);
+                            BindTextureUnit(app, 0, GL_TEXTURE_2D, app->gPosition);
+                            BindTextureUnit(app, 1, GL_TEXTURE_2D, app->gNormal);
+                            BindTextureUnit(app, 2, GL_TEXTURE_2D, app->noiseTexture);
 
-                            glActiveTexture(GL_TEXTURE2);
-                            glBindTexture(GL_TEXTURE_2D, app->noiseTexture);
-
-                            // send kernel samples
-                            glUniform3fv(glGetUniformLocation(ssaoProg.handle, "samples"), 64, &app->ssaoKernel[0][0]);
+                            // kernel samples
+                            glBindBufferBase(GL_UNIFORM_BUFFER, BINDING(2), app->ssaoKernelBuffer.handle);
                             // send projection and view matrix
-                            glUniformMatrix4fv(glGetUniformLocation(ssaoProg.handle, "projection"), 1, GL_FALSE, &app->projection[0][0]);
-                            glUniformMatrix4fv(glGetUniformLocation(ssaoProg.handle, "view"), 1, GL_FALSE, &app->view[0][0]);
+                            glUniformMatrix4fv(UniformLocation(ssaoProg, "projection"), 1, GL_FALSE, &app->frame.projection[0][0]);
+                            glUniformMatrix4fv(UniformLocation(ssaoProg, "view"), 1, GL_FALSE, &app->frame.view[0][0]);
 
                             // render screen quad
                             RenderScreenQuad(app->ssaoProgramIdx, app);
-
-                            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-                            glUseProgram(0);
                         }
 
                         // SSAO Blur pass ------
                         if (app->doSSAOBlur)
                         {
-                            glBindFramebuffer(GL_FRAMEBUFFER, app->ssaoBlurFBO);
+                            BindFramebuffer(app, GL_FRAMEBUFFER, app->ssaoBlurFBO);
                             glClear(GL_COLOR_BUFFER_BIT);
 
                             Program& ssaoBlurProg = app->programs[app->ssaoBlurProgramIdx];
-                            glUseProgram(ssaoBlurProg.handle);
+                            BindProgram(app, ssaoBlurProg.handle);
 
-                            glActiveTexture(GL_TEXTURE0);
-                            glBindTexture(GL_TEXTURE_2D, app->ssaoColorBuffer);
+                            BindTextureUnit(app, 0, GL_TEXTURE_2D, app->ssaoColorBuffer);
 
                             RenderScreenQuad(app->ssaoBlurProgramIdx, app);
-
-                            glBindFramebuffer(GL_FRAMEBUFFER, 0);
-                            glUseProgram(0);
-                           
                         }
                     }
 
@@ -1119,33 +1324,19 @@ void Render(App* app)
 
                     // lighting pass ---------------------------------------------------------
                     {
-                        glDepthMask(GL_FALSE);
-                        glDisable(GL_DEPTH_TEST);
+                        SetPipelineState(app, lightQuadPipeline);
 
-                        glBindFramebuffer(GL_FRAMEBUFFER, app->finalPassBuffer);
-
-                        glEnable(GL_BLEND);
-                        glBlendEquation(GL_FUNC_ADD);
-                        glBlendFunc(GL_ONE, GL_ONE);
+                        BindFramebuffer(app, GL_FRAMEBUFFER, app->finalPassBuffer);
 
                         glClear(GL_COLOR_BUFFER_BIT);
 
                         // ----------
 
-                        glActiveTexture(GL_TEXTURE0);
-                        glBindTexture(GL_TEXTURE_2D, app->gPosition);
-
-                        glActiveTexture(GL_TEXTURE1);
-                        glBindTexture(GL_TEXTURE_2D, app->gNormal);
-
-                        glActiveTexture(GL_TEXTURE2);
-                        glBindTexture(GL_TEXTURE_2D, app->gAlbedoSpec);
-
-                        glActiveTexture(GL_TEXTURE3);
-                        glBindTexture(GL_TEXTURE_2D, app->doSSAOBlur ? app->ssaoColorBufferBlur : app->ssaoColorBuffer);
-
-                        glActiveTexture(GL_TEXTURE4);
-                        glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubeMapId);
+                        BindTextureUnit(app, 0, GL_TEXTURE_2D, app->gPosition);
+                        BindTextureUnit(app, 1, GL_TEXTURE_2D, app->gNormal);
+                        BindTextureUnit(app, 2, GL_TEXTURE_2D, app->gAlbedoSpec);
+                        BindTextureUnit(app, 3, GL_TEXTURE_2D, app->doSSAOBlur ? app->ssaoColorBufferBlur : app->ssaoColorBuffer);
+                        BindTextureUnit(app, 4, GL_TEXTURE_CUBE_MAP, app->cubeMapId);
 
                         glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
 
@@ -1153,28 +1344,30 @@ void Render(App* app)
                         //// setting uniforms sampler locations
 
                         Program& prog = app->programs[app->dirLightPassProgramIdx];
-                        glUseProgram(prog.handle);
+                        BindProgram(app, prog.handle);
 
-                        GLuint lightIdxLocation = glGetUniformLocation(prog.handle, "lightIdx");
-                        GLuint worldViewProjectionLocation = glGetUniformLocation(prog.handle, "WVP");
+                        GLint lightIdxLocation = prog.lightIdxLocation;
+                        GLint worldViewProjectionLocation = prog.worldViewProjectionLocation;
 
-                        GLuint viewLocation = glGetUniformLocation(prog.handle, "modView");
-                        glm::mat4 noTransView = mat4(mat3(app->view)); // No translation
+                        GLint viewLocation = prog.modelViewLocation;
+                        glm::mat4 noTransView = mat4(mat3(app->frame.view)); // No translation
                         noTransView = rotate(noTransView, glm::radians(180.f), vec3(1, 0, 0));
                         glUniformMatrix4fv(viewLocation, 1, GL_FALSE, &noTransView[0][0]);
 
-                        glUniform1i(glGetUniformLocation(prog.handle, "doAO"), app->doSSAO);
-                        glUniform1i(glGetUniformLocation(prog.handle, "doFakeReflections"), app->doFakeReflections);
+                        glUniform1i(prog.doAOLocation, app->doSSAO);
+                        glUniform1i(prog.doFakeReflectionsLocation, app->doFakeReflections);
 
-                        for (int i = 0; i < app->lights.size(); ++i)
+                        for (u32 i = 0; i < app->frame.lights.size(); ++i)
                         {
 
-                            Light& l = app->lights[i];
+                            Light& l = app->frame.lights[i];
 
                    
 
                             if (l.type == LightType::LightType_Directional)
                             {
+                                SetPipelineState(app, lightQuadPipeline);
+
                                 mat4 MVP = mat4(1.0);
                                 glUniform1i(lightIdxLocation, i);
                                 glUniformMatrix4fv(worldViewProjectionLocation, 1, GL_FALSE, &MVP[0][0]);
@@ -1190,13 +1383,15 @@ void Render(App* app)
                                 float linear = 0.09;
                                 float quadratic = 0.032;
                                 float lightMax = std::fmaxf(std::fmaxf(l.color.r, l.color.g), l.color.b);
-                                float radius = (-linear + std::sqrtf(linear * linear - 4 * quadratic * (constant - (256.0 / 5.0) * lightMax)))
+                                float radius = (-linear + std::sqrt(linear * linear - 4 * quadratic * (constant - (256.0 / 5.0) * lightMax)))
                                     / (2 * quadratic);
 
-                                glEnable(GL_CULL_FACE); // render light effect only once
-                                glCullFace(GL_FRONT);   // render the light volume if the camera is inside the sphere volume too 
+                                // front face culling: render light effect only once, and
+                                // render the light volume if the camera is inside the sphere volume too
+                                SetPipelineState(app, lightVolumePipeline);
+
                                 mat4 pWorldMatrix = TransformPositionScale(-l.position, vec3(radius));
-                                mat4 MVP = app->projection * app->view * pWorldMatrix;
+                                mat4 MVP = app->frame.projection * app->frame.view * pWorldMatrix;
                                 glUniform1i(lightIdxLocation, i);
                                 glUniformMatrix4fv(worldViewProjectionLocation, 1, GL_FALSE, &MVP[0][0]);
 
@@ -1209,24 +1404,15 @@ void Render(App* app)
 
                                 for (u32 i = 0; i < mesh.submeshes.size(); ++i)
                                 {
-                                    GLuint vao = FindVAO(mesh, i, prog);
-                                    glBindVertexArray(vao);
-
                                     Submesh& submesh = mesh.submeshes[i];
-                                    glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-                                }
-
-                                glDisable(GL_CULL_FACE);
+                                    GLuint vao = FindVAO(app, submesh, prog);
+                                    BindVertexArray(app, vao);
 
+                                    SetSubmeshPositionDequantization(prog, submesh);
+                                    glDrawElementsBaseVertex(GL_TRIANGLES, submesh.indices.size(), submesh.indexType, IndexBufferOffset(submesh), submesh.baseVertex);
+                                }
                             }
                         }
-
-
-                        glBindVertexArray(0);
-                        glUseProgram(0);
-
-                        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
                     }
                 
                 
@@ -1236,16 +1422,10 @@ void Render(App* app)
                 {
                     // FORWARD RENDERING with z pre pass
                     {
-                        glEnable(GL_DEPTH_TEST);
-                        glDepthMask(GL_FALSE);
-                        glColorMask(1, 1, 1, 1);
-                        glDepthFunc(GL_EQUAL);
+                        SetPipelineState(app, scenePipeline);
 
-                        glEnable(GL_BLEND);
-                        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-                        glBindFramebuffer(GL_READ_FRAMEBUFFER, app->zPrePassFbo);
-                        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, app->finalPassBuffer);
+                        BindFramebuffer(app, GL_READ_FRAMEBUFFER, app->zPrePassFbo);
+                        BindFramebuffer(app, GL_DRAW_FRAMEBUFFER, app->finalPassBuffer);
 
                         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
                         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -1256,42 +1436,13 @@ void Render(App* app)
                         h = app->displaySize.y;
                         glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
 
-                        Program& prog = app->programs[app->fordwardProgramIdx];
-                        glUseProgram(prog.handle);
-
-                        glUniform1i(glGetUniformLocation(prog.handle, "doFakeReflections"), app->doFakeReflections); //..........
-                        glActiveTexture(GL_TEXTURE0);
-                        glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubeMapId);
+                        Program& prog = app->programs[app->vertexPulling ? app->forwardPullingProgramIdx : app->fordwardProgramIdx];
+                        glProgramUniform1i(prog.handle, prog.doFakeReflectionsLocation, app->doFakeReflections); //..........
+                        BindTextureUnit(app, 0, GL_TEXTURE_CUBE_MAP, app->cubeMapId);
 
                         glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(0), app->cbuffer.handle, app->globalParamsOffset, app->globalParamsSize);
 
-                        for (int idx = 0; idx < app->entities.size(); ++idx)
-                        {
-                            Entity& entity = app->entities[idx];
-                            Model& model = app->models[entity.modelIndex];
-                            Mesh& mesh = app->meshes[model.meshIdx];
-
-                            glBindBufferRange(GL_UNIFORM_BUFFER, BINDING(1), app->cbuffer.handle, entity.localParamsOffset, entity.localParamsSize);
-
-                            for (u32 i = 0; i < mesh.submeshes.size(); ++i)
-                            {
-                                Submesh& submesh = mesh.submeshes[i];
-
-                                GLuint vao = FindVAO(mesh, i, prog);
-                                glBindVertexArray(vao);
-
-                                u32 submeshMaterilIdx = model.materialIdx[i];
-                                Material& submeshMaterial = app->materials[submeshMaterilIdx];
-
-                                glActiveTexture(GL_TEXTURE1);
-                                glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-   
-                                //Submesh& submesh = mesh.submeshes[i];
-                                glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
-                            }
-                        }
-
-                        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                        SubmitRenderQueue(app, RenderPass_Forward);
                     }
 
                 }
@@ -1299,8 +1450,8 @@ void Render(App* app)
                 // Skybox ----------------------------------------------------------------
                 if (app->viewSkybox)
                 {
-                    glBindFramebuffer(GL_READ_FRAMEBUFFER, app->zPrePassFbo);
-                    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, app->finalPassBuffer);
+                    BindFramebuffer(app, GL_READ_FRAMEBUFFER, app->zPrePassFbo);
+                    BindFramebuffer(app, GL_DRAW_FRAMEBUFFER, app->finalPassBuffer);
 
                     // copy default zbuffer depth to gbuffer fbo depth
                     GLint w, h;
@@ -1309,20 +1460,16 @@ void Render(App* app)
                     glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
 
                     Program& skyboxProgram = app->programs[app->skyboxProgramIdx];
-                    glUseProgram(skyboxProgram.handle);
+                    BindProgram(app, skyboxProgram.handle);
 
-                    glEnable(GL_DEPTH_TEST);
-                    glDepthFunc(GL_LEQUAL);
-                    glDepthMask(GL_FALSE);
-                    glDisable(GL_BLEND);
+                    SetPipelineState(app, skyboxPipeline);
 
-                    GLuint viewLocation = glGetUniformLocation(skyboxProgram.handle, "uView");
-                    GLuint worldViewProjectionLocation = glGetUniformLocation(skyboxProgram.handle, "uProjection");
-                    GLuint skyboxLocation = glGetUniformLocation(skyboxProgram.handle, "uSkybox");
+                    GLint viewLocation = skyboxProgram.viewLocation;
+                    GLint worldViewProjectionLocation = skyboxProgram.projectionLocation;
 
-                    glUniformMatrix4fv(worldViewProjectionLocation, 1, GL_FALSE, &app->projection[0][0]);
+                    glUniformMatrix4fv(worldViewProjectionLocation, 1, GL_FALSE, &app->frame.projection[0][0]);
 
-                    glm::mat4 noTransView = mat4(mat3(app->view)); // No translation
+                    glm::mat4 noTransView = mat4(mat3(app->frame.view)); // No translation
                     noTransView = rotate(noTransView, glm::radians(180.f), vec3(1, 0, 0));
                     glUniformMatrix4fv(viewLocation, 1, GL_FALSE, &noTransView[0][0]);
                     
@@ -1330,42 +1477,31 @@ void Render(App* app)
                     Model& model = app->models[app->defaultModelsId[(int)DefaultModelType::Cube]];
                     Mesh& mesh = app->meshes[model.meshIdx];
                     Submesh& smesh = mesh.submeshes[0];
-                    GLuint vao = FindVAO(mesh, 0, skyboxProgram);
-                    glBindVertexArray(vao);
+                    GLuint vao = FindVAO(app, smesh, skyboxProgram);
+                    BindVertexArray(app, vao);
 
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_CUBE_MAP, app->cubeMapId);
+                    BindTextureUnit(app, 0, GL_TEXTURE_CUBE_MAP, app->cubeMapId);
 
                     //glDrawArrays(GL_TRIANGLES, 0, 36);
-                    glDrawElements(GL_TRIANGLES, smesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)smesh.indexOffset);
-
-                    glBindVertexArray(0);
-                    glDepthMask(GL_TRUE);
-                    glDepthFunc(GL_LESS);
-
-                    glUseProgram(0);
-
-                    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+                    SetSubmeshPositionDequantization(skyboxProgram, smesh);
+                    glDrawElementsBaseVertex(GL_TRIANGLES, smesh.indices.size(), smesh.indexType, IndexBufferOffset(smesh), smesh.baseVertex);
                 }
 
                 // render screen quad with selected texture from combobox
                 {
                   
+                    BindFramebuffer(app, GL_FRAMEBUFFER, 0);
+                    SetPipelineState(app, screenQuadPipeline);
+
                     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-                    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-                    glDisable(GL_DEPTH_TEST);
-                    glDepthMask(GL_FALSE);
-                    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                    glClear(GL_COLOR_BUFFER_BIT);
 
                     Program& texGeoProgram = app->programs[app->texturedGeometryProgramIdx];
-                    glUseProgram(texGeoProgram.handle);
+                    BindProgram(app, texGeoProgram.handle);
 
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, app->selectedAttachment);
+                    BindTextureUnit(app, 0, GL_TEXTURE_2D, app->selectedAttachment);
 
                     RenderScreenQuad(app->texturedGeometryProgramIdx, app);
-
-                    glUseProgram(0);
                 }
 
                 
@@ -1380,73 +1516,264 @@ void Render(App* app)
 void RenderScreenQuad(u32 programIdx, App* app)
 {
     Mesh& mesh = app->meshes[app->texturedQuadMeshIdx];
+    Submesh& submesh = mesh.submeshes[0];
 
     Program& p = app->programs[programIdx];
     //glUseProgram(p.handle);
 
-    GLuint vao = FindVAO(mesh, 0, p);
-    glBindVertexArray(vao);
-
-    /*glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);*/
+    GLuint vao = FindVAO(app, submesh, p);
+    BindVertexArray(app, vao);
 
     //glUniform1i(app->programUniformTexture, 0);
 
+    glDrawElementsBaseVertex(GL_TRIANGLES, 6, submesh.indexType, IndexBufferOffset(submesh), submesh.baseVertex);
+}
+
+void BindSubmeshVertexFormat(App* app, const Program& program, const Submesh& submesh)
+{
+    if (program.baseVertexLocation != -1 && UsesPositionStream(program))
+    {
+        const GeometryArena& arena = app->geometryArenas[submesh.arenaIdx];
+
+        BindVertexArray(app, app->emptyVao);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, arena.positionBufferHandle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, app->geometryIndexBuffer);
+        glUniform1i(program.positionStrideLocation, arena.positionStride / sizeof(u32));
+    }
+    else if (program.baseVertexLocation != -1)
+    {
+        // vertex pulling: no vao, the shader reads the arena buffers by gl_VertexID
+        const GeometryArena& arena = app->geometryArenas[submesh.arenaIdx];
+        const VertexBufferLayout& layout = arena.vertexBufferLayout;
 
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+        ivec4 attributeOffsets = ivec4(-1);
+        for (u32 i = 0; i < layout.attributes.size(); ++i)
+        {
+            const VertexBufferAttribute& attribute = layout.attributes[i];
+            if (attribute.location < 4)
+                attributeOffsets[attribute.location] = attribute.offset / sizeof(float);
+        }
 
-    glBindVertexArray(0);
-   // glUseProgram(0);
+        BindVertexArray(app, app->emptyVao);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, arena.vertexBufferHandle);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, app->geometryIndexBuffer);
+        glUniform1i(program.vertexStrideLocation, layout.stride / sizeof(float));
+        glUniform4iv(program.attributeOffsetsLocation, 1, &attributeOffsets[0]);
+    }
+    else
+    {
+        GLuint vao = FindVAO(app, submesh, program);
+        BindVertexArray(app, vao);
+    }
 }
 
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
+// Expects the vertex format of the submesh to be bound (see BindSubmeshVertexFormat)
+void DrawSubmesh(App* app, const Program& program, u32 entityIdx, const Submesh& submesh)
 {
-    Submesh& submesh = mesh.submeshes[submeshIndex];
+    const bool drawMeshlets = app->doMeshletCulling && !submesh.meshlets.empty();
+    const u32 firstCommand = app->entities.meshletCommandOffsets[entityIdx] + submesh.meshletCommandOffset;
+
+    SetSubmeshPositionDequantization(program, submesh);
 
-    for (u32 i = 0; i < (u32)submesh.vaos.size(); ++i)
+    if (program.baseVertexLocation != -1)
     {
-        if (submesh.vaos[i].programHandle == program.handle)
-            return submesh.vaos[i].handle; // if we found a existing vao return it
+        glUniform1i(program.baseVertexLocation, submesh.baseVertex);
+        glUniform1i(program.shortIndicesLocation, submesh.indexType == GL_UNSIGNED_SHORT);
+
+        if (drawMeshlets)
+        {
+            // same compacted commands as the indexed path, read as arrays commands:
+            // { count, instanceCount, first = firstIndex, baseInstance = baseVertex (ignored) }
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, app->meshletCommandBuffer.handle);
+            glMultiDrawArraysIndirect(GL_TRIANGLES, (void*)(u64)(firstCommand * sizeof(DrawElementsIndirectCommand)), submesh.meshlets.size(), sizeof(DrawElementsIndirectCommand));
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+        else
+        {
+            glDrawArrays(GL_TRIANGLES, submesh.firstIndex, submesh.indices.size());
+        }
+        return;
     }
 
-    GLuint vaoHandle = 0;
-    // if no vao found, create a new and return it
+    if (drawMeshlets)
+    {
+        // draw only the meshlets that survived the culling pass
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, app->meshletCommandBuffer.handle);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, submesh.indexType, (void*)(u64)(firstCommand * sizeof(DrawElementsIndirectCommand)), submesh.meshlets.size(), 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+    else
     {
-        glGenVertexArrays(1, &vaoHandle);
-        glBindVertexArray(vaoHandle);
+        glDrawElementsBaseVertex(GL_TRIANGLES, submesh.indices.size(), submesh.indexType, IndexBufferOffset(submesh), submesh.baseVertex);
+    }
+}
 
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+void SetSubmeshPositionDequantization(const Program& program, const Submesh& submesh)
+{
+    if (program.positionScaleLocation == -1)
+        return;
 
-        // link all vertex inputs attributes to attributes in the vertex buffer
-        for (u32 i = 0; i < program.vertexInputLayout.attributes.size(); ++i)
+    glUniform3fv(program.positionScaleLocation, 1, &submesh.positionScale[0]);
+    glUniform3fv(program.positionBiasLocation, 1, &submesh.positionBias[0]);
+}
+
+static u64 HashBytes(u64 hash, const void* data, u32 size)
+{
+    // FNV-1a
+    const u8* bytes = (const u8*)data;
+    for (u32 i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+u64 HashString(const char* str)
+{
+    return HashBytes(14695981039346656037ull, str, (u32)strlen(str));
+}
+
+u64 HashVertexBufferLayout(const VertexBufferLayout& layout)
+{
+    u64 hash = 14695981039346656037ull;
+    hash = HashBytes(hash, &layout.stride, sizeof(layout.stride));
+    for (u32 i = 0; i < layout.attributes.size(); ++i)
+    {
+        const VertexBufferAttribute& attribute = layout.attributes[i];
+        hash = HashBytes(hash, &attribute.location, sizeof(attribute.location));
+        hash = HashBytes(hash, &attribute.componentCount, sizeof(attribute.componentCount));
+        hash = HashBytes(hash, &attribute.offset, sizeof(attribute.offset));
+        hash = HashBytes(hash, &attribute.type, sizeof(attribute.type));
+        hash = HashBytes(hash, &attribute.normalized, sizeof(attribute.normalized));
+    }
+    return hash;
+}
+
+u64 HashVertexShaderLayout(const VertexShaderLayout& layout)
+{
+    u64 hash = 14695981039346656037ull;
+    for (u32 i = 0; i < layout.attributes.size(); ++i)
+    {
+        const VertexShaderAttribute& attribute = layout.attributes[i];
+        hash = HashBytes(hash, &attribute.location, sizeof(attribute.location));
+        hash = HashBytes(hash, &attribute.componentCount, sizeof(attribute.componentCount));
+    }
+    return hash;
+}
+
+static void BindVAOBuffers(App* app, const Vao& vao)
+{
+    const GeometryArena& arena = app->geometryArenas[vao.arenaIdx];
+
+    BindVertexArray(app, vao.handle);
+    if (vao.positionStream)
+        glBindVertexBuffer(0, arena.positionBufferHandle, 0, arena.positionStride);
+    else
+        glBindVertexBuffer(0, arena.vertexBufferHandle, 0, arena.vertexBufferLayout.stride);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->geometryIndexBuffer);
+}
+
+// Programs that only read positions fetch them from the position stream of the arenas
+bool UsesPositionStream(const Program& program)
+{
+    if (program.positionStrideLocation != -1)
+        return true; // pulled with PullPosition()
+
+    const std::vector<VertexShaderAttribute>& attributes = program.vertexInputLayout.attributes;
+    return attributes.size() == 1 && attributes[0].location == 0;
+}
+
+GLuint FindVAO(App* app, const Submesh& submesh, const Program& program)
+{
+    const GeometryArena& arena = app->geometryArenas[submesh.arenaIdx];
+    const u64 key = HashBytes(arena.layoutHash, &program.vertexInputLayoutHash, sizeof(program.vertexInputLayoutHash));
+
+    const std::vector<VertexShaderAttribute>& inputAttributes = program.vertexInputLayout.attributes;
+    const bool positionStream = UsesPositionStream(program);
+
+    // different layouts may share a hash, a hit must match the full key
+    auto range = app->vaoCache.equal_range(key);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        const Vao& cached = it->second;
+        if (cached.arenaIdx != submesh.arenaIdx || cached.positionStream != positionStream ||
+            cached.inputLocations.size() != inputAttributes.size())
+            continue;
+
+        bool sameLocations = true;
+        for (u32 i = 0; i < inputAttributes.size() && sameLocations; ++i)
+            sameLocations = cached.inputLocations[i] == inputAttributes[i].location;
+
+        if (sameLocations)
+            return cached.handle; // if we found a existing vao return it
+    }
+
+    // if no vao found, create a new one shared by every submesh in this arena
+    Vao vao = {};
+    vao.arenaIdx = submesh.arenaIdx;
+    vao.inputLayoutHash = program.vertexInputLayoutHash;
+    vao.positionStream = positionStream;
+    for (const VertexShaderAttribute& attribute : inputAttributes)
+        vao.inputLocations.push_back(attribute.location);
+    glGenVertexArrays(1, &vao.handle);
+    BindVertexArray(app, vao.handle);
+
+    VertexBufferLayout positionLayout = {};
+    positionLayout.attributes.push_back(arena.positionAttribute);
+    positionLayout.stride = arena.positionStride;
+
+    // link all vertex inputs attributes to attributes in the vertex buffer,
+    // the format is separated from the buffer so arena buffers can be swapped later
+    const VertexBufferLayout& layout = vao.positionStream ? positionLayout : arena.vertexBufferLayout;
+    for (u32 i = 0; i < program.vertexInputLayout.attributes.size(); ++i)
+    {
+        bool attributeWasLinked = false;
+        for (u32 j = 0; j < layout.attributes.size(); ++j)
         {
-            bool attributeWasLinked = false;
-            for (u32 j = 0; j < submesh.vertexBufferLayout.attributes.size(); ++j)
+            if (program.vertexInputLayout.attributes[i].location == layout.attributes[j].location)
             {
-                if (program.vertexInputLayout.attributes[i].location == submesh.vertexBufferLayout.attributes[j].location)
-                {
-                    const u32 index = submesh.vertexBufferLayout.attributes[j].location;
-                    const u32 ncomp = submesh.vertexBufferLayout.attributes[j].componentCount;
-                    const u32 offset = submesh.vertexBufferLayout.attributes[j].offset + submesh.vertexOffset;
-                    const u32 stride = submesh.vertexBufferLayout.stride;
-                    glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)offset);
-                    glEnableVertexAttribArray(index);
-
-                    attributeWasLinked = true;
-                    break;
-                }
+                const VertexBufferAttribute& attribute = layout.attributes[j];
+                glVertexAttribFormat(attribute.location, attribute.componentCount, attribute.type, attribute.normalized, attribute.offset);
+                glVertexAttribBinding(attribute.location, 0);
+                glEnableVertexAttribArray(attribute.location);
+
+                attributeWasLinked = true;
+                break;
             }
-            assert(attributeWasLinked); // submesh must provide an attribute for each vertex input
         }
-        glBindVertexArray(0);
+        assert(attributeWasLinked); // submesh must provide an attribute for each vertex input
     }
 
-    Vao vao = { vaoHandle, program.handle };
-    submesh.vaos.push_back(vao);
+    BindVAOBuffers(app, vao);
+    app->vaoCache.emplace(key, vao);
 
-    return vaoHandle;
+    return vao.handle;
+}
 
+void UpdateCachedVAOBuffers(App* app)
+{
+    // arena buffers were reallocated, point the cached vaos to the new ones
+    for (auto& entry : app->vaoCache)
+        BindVAOBuffers(app, entry.second);
+}
+
+void InvalidateCachedVAOs(App* app, u64 inputLayoutHash)
+{
+    for (auto it = app->vaoCache.begin(); it != app->vaoCache.end();)
+    {
+        if (it->second.inputLayoutHash == inputLayoutHash)
+        {
+            if (app->glState.vertexArray == it->second.handle)
+                app->glState.vertexArray = 0; // deleting a bound vao reverts the binding to 0
+            glDeleteVertexArrays(1, &it->second.handle);
+            it = app->vaoCache.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
 }
 
 void FillInputVertexShaderLayout(Program& program)
@@ -1469,9 +1796,94 @@ void FillInputVertexShaderLayout(Program& program)
                           attributeName);
         
         GLint attributeLocation = glGetAttribLocation(program.handle, attributeName);
+        if (attributeLocation < 0)
+            continue; // built-ins such as gl_VertexID
 
         program.vertexInputLayout.attributes.push_back({(u8)attributeLocation, (u8)attributeSize});
     }
+
+    program.vertexInputLayoutHash = HashVertexShaderLayout(program.vertexInputLayout);
+}
+
+void FillDrawUniformLocations(Program& program)
+{
+    program.baseVertexLocation = UniformLocation(program, "uBaseVertex");
+    program.vertexStrideLocation = UniformLocation(program, "uVertexStride");
+    program.attributeOffsetsLocation = UniformLocation(program, "uAttributeOffsets");
+    program.materialIdxLocation = UniformLocation(program, "uMaterialIdx");
+    program.entityIdxLocation = UniformLocation(program, "uEntityIdx");
+    program.shortIndicesLocation = UniformLocation(program, "uShortIndices");
+    program.positionScaleLocation = UniformLocation(program, "uPositionScale");
+    program.positionBiasLocation = UniformLocation(program, "uPositionBias");
+    program.positionStrideLocation = UniformLocation(program, "uPositionStride");
+
+    program.lightIdxLocation = UniformLocation(program, "lightIdx");
+    program.worldViewProjectionLocation = UniformLocation(program, "WVP");
+    program.modelViewLocation = UniformLocation(program, "modView");
+    program.doAOLocation = UniformLocation(program, "doAO");
+    program.doFakeReflectionsLocation = UniformLocation(program, "doFakeReflections");
+    program.viewLocation = UniformLocation(program, "uView");
+    program.projectionLocation = UniformLocation(program, "uProjection");
+}
+
+void FillProgramReflection(Program& program)
+{
+    program.uniforms.clear();
+    program.uniformBlocks.clear();
+
+    GLint uniformCount;
+    glGetProgramiv(program.handle, GL_ACTIVE_UNIFORMS, &uniformCount);
+
+    for (GLint i = 0; i < uniformCount; ++i)
+    {
+        GLchar uniformName[256];
+        GLsizei uniformNameLength;
+        ProgramUniform uniform = {};
+
+        glGetActiveUniform(program.handle, i, ARRAY_COUNT(uniformName), &uniformNameLength, &uniform.size, &uniform.type, uniformName);
+
+        uniform.location = glGetUniformLocation(program.handle, uniformName);
+        if (uniform.location == -1)
+            continue; // member of a uniform block
+
+        // arrays are reported as "name[0]", look them up by their plain name
+        if (uniformNameLength > 3 && strcmp(uniformName + uniformNameLength - 3, "[0]") == 0)
+            uniformName[uniformNameLength - 3] = '\0';
+
+        switch (uniform.type)
+        {
+            case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE: case GL_SAMPLER_2D_ARRAY:
+            case GL_SAMPLER_2D_SHADOW: case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+                uniform.isSampler = true;
+                break;
+            default:
+                break;
+        }
+
+        program.uniforms[HashString(uniformName)] = uniform;
+    }
+
+    GLint blockCount;
+    glGetProgramiv(program.handle, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+
+    for (GLint i = 0; i < blockCount; ++i)
+    {
+        GLchar blockName[256];
+        ProgramUniformBlock block = {};
+        block.index = i;
+
+        glGetActiveUniformBlockName(program.handle, i, ARRAY_COUNT(blockName), NULL, blockName);
+        glGetActiveUniformBlockiv(program.handle, i, GL_UNIFORM_BLOCK_BINDING, &block.binding);
+        glGetActiveUniformBlockiv(program.handle, i, GL_UNIFORM_BLOCK_DATA_SIZE, &block.dataSize);
+
+        program.uniformBlocks[HashString(blockName)] = block;
+    }
+}
+
+GLint UniformLocation(const Program& program, const char* name)
+{
+    auto it = program.uniforms.find(HashString(name));
+    return it != program.uniforms.end() ? it->second.location : -1;
 }
 
 void FillOpenGLInfo(App* app)
@@ -1539,14 +1951,14 @@ void UpdateCamera(App* app)
 
     // Orientation 
 
-    if (app->input.mouseButtons[0] == BUTTON_PRESSED && app->input.mouseDelta != vec2(0.f))
+    if (app->simulation.input.mouseButtons[0] == BUTTON_PRESSED && app->simulation.input.mouseDelta != vec2(0.f))
     {
-        app->camera.finalYaw += app->input.mouseDelta.x * 0.005f ;
-        app->camera.finalPitch += app->input.mouseDelta.y * 0.005f;
+        app->camera.finalYaw += app->simulation.input.mouseDelta.x * 0.005f ;
+        app->camera.finalPitch += app->simulation.input.mouseDelta.y * 0.005f;
     }
     
-    app->camera.yaw = Lerp(app->camera.yaw, app->camera.finalYaw, clamp(app->deltaTime * 10.f, 0.f, 1.f));
-    app->camera.pitch = Lerp( app->camera.pitch, app->camera.finalPitch, clamp(app->deltaTime * 10.f, 0.f, 1.f));
+    app->camera.yaw = Lerp(app->camera.yaw, app->camera.finalYaw, clamp(app->simulation.deltaTime * 10.f, 0.f, 1.f));
+    app->camera.pitch = Lerp( app->camera.pitch, app->camera.finalPitch, clamp(app->simulation.deltaTime * 10.f, 0.f, 1.f));
 
     quat rotYaw = glm::angleAxis(app->camera.yaw, vec3(0.f, 1.f, 0.f));
     quat rotPitch = glm::angleAxis(app->camera.pitch, vec3(1.f, 0.f, 0.f));
@@ -1558,38 +1970,38 @@ void UpdateCamera(App* app)
 
     // Movement 
 
-    if (app->input.keys[Key::K_D] == BUTTON_PRESSED)
+    if (app->simulation.input.keys[Key::K_D] == BUTTON_PRESSED)
     {
         finalPosition -= right;
     }
-    if (app->input.keys[Key::K_A] == BUTTON_PRESSED)
+    if (app->simulation.input.keys[Key::K_A] == BUTTON_PRESSED)
     {
         finalPosition += right;
     }
-    if (app->input.keys[Key::K_W] == BUTTON_PRESSED)
+    if (app->simulation.input.keys[Key::K_W] == BUTTON_PRESSED)
     {
         finalPosition += forward;
     }
-    if (app->input.keys[Key::K_S] == BUTTON_PRESSED)
+    if (app->simulation.input.keys[Key::K_S] == BUTTON_PRESSED)
     {
         finalPosition -= forward;
     }
-    if (app->input.keys[Key::K_Q] == BUTTON_PRESSED)
+    if (app->simulation.input.keys[Key::K_Q] == BUTTON_PRESSED)
     {
         finalPosition += up;
     }
-    if (app->input.keys[Key::K_E] == BUTTON_PRESSED)
+    if (app->simulation.input.keys[Key::K_E] == BUTTON_PRESSED)
     {
         finalPosition -= up;
     }
-    if (app->input.keys[Key::K_C] == BUTTON_PRESSED)
+    if (app->simulation.input.keys[Key::K_C] == BUTTON_PRESSED)
     {
         doubleSpeed = true;
     }
 
     if (finalPosition != vec3(0.f))
     {
-        app->camera.position += glm::normalize(finalPosition) * cameraSpeed * app->deltaTime * (doubleSpeed ? 2.f : 1.f);
+        app->camera.position += glm::normalize(finalPosition) * cameraSpeed * app->simulation.deltaTime * (doubleSpeed ? 2.f : 1.f);
     }
 
     app->view = glm::translate(app->view, app->camera.position);
@@ -1597,7 +2009,7 @@ void UpdateCamera(App* app)
 
 void UpdateProjectionView(App* app)
 {
-    float aspectRatio = (float)app->displaySize.x / (float)app->displaySize.y;
+    float aspectRatio = (float)app->simulation.displaySize.x / (float)app->simulation.displaySize.y;
     float znear = 0.1f;
     float zfar = 1000.0f;
     app->projection = perspective(radians(60.0f), aspectRatio, znear, zfar);
@@ -1628,6 +2040,32 @@ mat4 TransformWorldMatrix(const vec3& position, const vec3& rotation, const vec3
 
 }
 
+// Same rotation order as TransformWorldMatrix
+Transform MakeTransform(const vec3& position, const vec3& rotation, const vec3& scaleFactors)
+{
+    Transform transform;
+    transform.position = position;
+    transform.rotation = angleAxis(glm::radians(rotation.x), vec3(1, 0, 0)) *
+                         angleAxis(glm::radians(rotation.y), vec3(0, 1, 0)) *
+                         angleAxis(glm::radians(rotation.z), vec3(0, 0, 1));
+    transform.scale = scaleFactors;
+    return transform;
+}
+
 float Lerp(float a, float b, float t) {
     return a + t * (b - a);
 }
+
+// Gribb/Hartmann, normalized planes pointing inside, in the space the matrix transforms from
+void ExtractFrustumPlanes(const mat4& viewProjection, vec4 planes[6])
+{
+    mat4 m = transpose(viewProjection);
+    planes[0] = m[3] + m[0];
+    planes[1] = m[3] - m[0];
+    planes[2] = m[3] + m[1];
+    planes[3] = m[3] - m[1];
+    planes[4] = m[3] + m[2];
+    planes[5] = m[3] - m[2];
+    for (u32 i = 0; i < 6; ++i)
+        planes[i] /= length(vec3(planes[i]));
+}
@@ -7,7 +7,10 @@
 #include "platform.h"
 #include <glad/glad.h>
 #include "buffer_management.h"
+#include "buddy_allocator.h"
+#include "job_system.h"
 #include <random>
+#include <unordered_map>
 
 #define BINDING(b) b
 
@@ -35,12 +38,100 @@ struct Light
     vec3         position;
 };
 
-struct Entity
+enum EntityFlags
 {
-    mat4 worldMatrix;
-    u32 modelIndex;
-    u32 localParamsOffset;
-    u32 localParamsSize;
+    EntityFlag_Static      = 1 << 0, // never moves after Init, its geometry is merged into the static batch
+    EntityFlag_StaticBatch = 1 << 1, // holds the merged static geometry (see BuildStaticBatches)
+};
+
+#define ENTITY_NO_PARENT 0xFFFFFFFFu
+#define ENTITY_NO_MODEL  0xFFFFFFFFu // pure transform node of a hierarchy, never drawn
+
+// Local transform relative to the parent entity, applied scale first
+struct Transform
+{
+    vec3 position = vec3(0.f);
+    quat rotation = quat(1.f, 0.f, 0.f, 0.f);
+    vec3 scale    = vec3(1.f);
+};
+
+// Entities as component arrays, all indexed by entity index (see entities.h).
+// Each system walks only the arrays it needs.
+struct Entities
+{
+    u32 count;
+
+    // hierarchy, parents are always created before their children
+    std::vector<vec3> localPositions;
+    std::vector<quat> localRotations;
+    std::vector<vec3> localScales;
+    std::vector<u32>  parents; // ENTITY_NO_PARENT for roots
+    std::vector<u32>  depths;  // 0 for roots
+    std::vector<u8>   localDirty; // local transform changed since the last hierarchy update
+    bool              anyLocalDirty;
+
+    // entity indices sorted by depth, depth d is [depthStarts[d], depthStarts[d + 1])
+    std::vector<u32> hierarchyOrder;
+    std::vector<u32> depthStarts;
+    bool             hierarchyOrderValid;
+
+    // transform
+    std::vector<mat4> worldMatrices;
+    std::vector<u8>   worldChanged; // scratch of the hierarchy update, read by the children
+    std::vector<u64>  dirtyBits; // world matrix changed since the last Update, one bit per entity
+
+    // model
+    std::vector<u32> modelIndices;
+    std::vector<u8>  flags; // EntityFlags
+
+    // bounds, spheres with the center in xyz (w = 1) and the radius apart.
+    // World centers are split per component for the visibility kernel (SoA)
+    std::vector<vec4> localCenters;
+    std::vector<f32>  localRadii;
+    std::vector<f32>  worldCentersX;
+    std::vector<f32>  worldCentersY;
+    std::vector<f32>  worldCentersZ;
+    std::vector<f32>  worldRadii;
+
+    // per frame visibility
+    std::vector<f32> viewDepths;
+    std::vector<u8>  visible;
+
+    // render offsets
+    std::vector<u32> meshletCommandOffsets; // first indirect draw command, filled by the meshlet culling pass
+};
+
+// What Render reads of the simulation results. PublishFrame copies it
+// between frames, the simulation never touches it (see simulation.h).
+struct FrameSnapshot
+{
+    vec3 cameraPosition;
+    mat4 view;
+    mat4 projection;
+    std::vector<Light> lights;
+
+    // entities, indexed like Entities. Entities created after the publish aren't in it yet
+    u32               entityCount;
+    std::vector<mat4> worldMatrices;
+    std::vector<u64>  dirtyBits; // world matrix changed since the last gpu upload
+    std::vector<u8>   visible;
+    std::vector<f32>  viewDepths;
+    f32               entityUpdateMs; // hierarchy, bounds and visibility
+    f32               entityBoundsMs;
+    f32               entityVisibilityMs;
+};
+
+// State of the simulation, it may run on a worker while the main thread renders
+struct Simulation
+{
+    Input      input;       // rebuilt from the input queue
+    f32        deltaTime;   // copied when the simulation starts
+    ivec2      displaySize;
+    f32        entityUpdateMs;
+    f32        entityBoundsMs;
+    f32        entityVisibilityMs;
+    JobCounter counter;
+    bool       inFlight;    // started in the previous frame, not published yet
 };
 
 struct Camera
@@ -78,9 +169,11 @@ const u32 indices[] = {
 
 struct VertexBufferAttribute
 {
-    u8 location;
-    u8 componentCount;
-    u8 offset;
+    u8     location;
+    u8     componentCount;
+    u8     offset;
+    GLenum type = GL_FLOAT;
+    bool   normalized = false;
 };
 
 struct VertexBufferLayout
@@ -100,10 +193,15 @@ struct VertexShaderLayout
     std::vector<VertexShaderAttribute> attributes;
 };
 
+// Cached vao for a (vertex buffer layout, vertex shader layout) pair, the
+// cache is keyed by a hash of both so the full key is kept to compare hits
 struct Vao
 {
-    GLuint handle;
-    GLuint programHandle;
+    GLuint          handle;
+    u32             arenaIdx;
+    u64             inputLayoutHash;
+    bool            positionStream; // reads the position-only buffer of the arena
+    std::vector<u8> inputLocations; // vertex shader attribute locations
 };
 
 // --------------------------------------------------
@@ -115,22 +213,67 @@ struct Model
     std::vector<u32> materialIdx;
 };
 
+// Cluster of up to MESHLET_MAX_VERTICES vertices / MESHLET_MAX_TRIANGLES triangles
+// of a submesh, with the bounds needed to cull it on the gpu
+struct Meshlet
+{
+    vec3 center;      // bounding sphere, object space
+    f32  radius;
+    vec3 coneAxis;    // average facing direction of the triangles
+    f32  coneCutoff;  // sin of the normal cone half angle, > 1 if it can't be backface culled
+    u32  indexOffset; // relative to the first index of the submesh
+    u32  indexCount;
+};
+
 struct Submesh
 {
     VertexBufferLayout vertexBufferLayout;
-    std::vector<float> vertices;
+    std::vector<u8>    vertices;   // packed as described by vertexBufferLayout
     std::vector<u32>   indices;
-    u32                vertexOffset;
-    u32                indexOffset;
+    vec3               positionScale = vec3(1.f); // dequantized position = position * scale + bias
+    vec3               positionBias = vec3(0.f);
+    GLenum             indexType;  // index format in the gpu buffer, chosen at allocation
+    u32                arenaIdx;   // geometry arena holding the vertices of this submesh format
+    u32                baseVertex; // first vertex in the arena vertex buffer
+    u32                firstIndex; // first index in the shared index buffer, in indexType units
+
+    std::vector<Meshlet> meshlets;
+    u32                  firstMeshlet;         // index in the global meshlet buffer
+    u32                  meshletCommandOffset; // relative to the mesh commands of an entity
+};
 
-    std::vector<Vao> vaos;
+// Layout of CullJob in shaders.glsl (std430), a visible entity submesh to cull
+struct MeshletCullJob
+{
+    u32 entityIdx;
+    u32 firstMeshlet;
+    u32 meshletCount;
+    u32 firstCommand;
+    u32 firstIndex;
+    i32 baseVertex;
+    u32 padding[2];
 };
 
 struct Mesh
 {
     std::vector<Submesh> submeshes;
-    GLuint               vertexBufferHandle;
-    GLuint               indexBufferHandle;
+    u32                  meshletCount;
+};
+
+// Vertex buffer shared by all the submeshes with the same vertex format.
+// Indices of every arena live in
+// the same index buffer (see App::geometryIndexBuffer).
+// Positions are also copied to a tightly packed buffer, indexed by the
+// same vertices, for the passes that read nothing else (depth only).
+struct GeometryArena
+{
+    VertexBufferLayout    vertexBufferLayout;
+    u64                   layoutHash;
+    GLuint                vertexBufferHandle;
+    GLuint                positionBufferHandle;
+    VertexBufferAttribute positionAttribute; // location 0 at offset 0 of the position buffer
+    u8                    positionStride;
+    BuddyAllocator        vertexAllocator; // in vertices
 };
 
 struct Material
@@ -154,10 +297,52 @@ struct Image
     i32   stride;
 };
 
+// What a texture holds, it decides how it is cooked and sampled
+enum TextureUsage
+{
+    TextureUsage_Color,
+    TextureUsage_NormalMap, // tangent space xy, the shaders reconstruct z
+};
+
 struct Texture
 {
-    GLuint      handle;
-    std::string filepath;
+    GLuint       handle;
+    std::string  filepath;
+    ivec2        size;
+    GLenum       internalFormat;
+    TextureUsage usage;
+    u32          arrayIdx;   // texture array holding a copy of this texture (see materials.h)
+    u32          arrayLayer;
+    u64          bindlessHandle; // resident ARB_bindless_texture handle, 0 if not used
+};
+
+// Textures of the same size, format and usage copied into the layers of one GL_TEXTURE_2D_ARRAY
+struct TextureArray
+{
+    GLuint       handle;
+    ivec2        size;
+    GLenum       internalFormat;
+    TextureUsage usage;
+    u32          layerCount;
+    u32          layerCapacity; // allocated layers, grows geometrically
+    bool         resampled;     // holds the textures of any size/format scaled to its own (see materials.cpp)
+};
+
+// Reflection of the active uniforms and uniform blocks of a program,
+// keyed by the hash of their name (see UniformLocation)
+struct ProgramUniform
+{
+    GLint  location;
+    GLenum type;
+    GLint  size;      // array length
+    bool   isSampler; // any sampler type, its unit comes from the shader's layout(binding)
+};
+
+struct ProgramUniformBlock
+{
+    GLuint index;
+    GLint  binding;
+    GLint  dataSize;
 };
 
 struct Program
@@ -165,10 +350,129 @@ struct Program
     GLuint             handle;
     std::string        filepath;
     std::string        programName;
+    std::string        defines;
     u64                lastWriteTimestamp;
     VertexShaderLayout vertexInputLayout;
+    u64                vertexInputLayoutHash;
+    bool               compute;
+
+    std::unordered_map<u64, ProgramUniform>      uniforms;
+    std::unordered_map<u64, ProgramUniformBlock> uniformBlocks;
+
+    // vertex pulling uniforms (-1 for programs that use vaos)
+    GLint              baseVertexLocation;
+    GLint              vertexStrideLocation;
+    GLint              attributeOffsetsLocation;
+    GLint              materialIdxLocation;
+    GLint              entityIdxLocation;
+    GLint              shortIndicesLocation;
+    GLint              positionScaleLocation;
+    GLint              positionBiasLocation;
+    GLint              positionStrideLocation;
+
+    // uniforms of the lighting and skybox passes (-1 for the other programs)
+    GLint              lightIdxLocation;
+    GLint              worldViewProjectionLocation;
+    GLint              modelViewLocation;
+    GLint              doAOLocation;
+    GLint              doFakeReflectionsLocation;
+    GLint              viewLocation;
+    GLint              projectionLocation;
+};
+
+// --------------------------------------------------
+// GL STATE CACHE -----------------------------------
+
+// Complete raster/depth/blend state of a pass, applied with SetPipelineState
+struct PipelineState
+{
+    bool   depthTest;
+    bool   depthWrite;
+    GLenum depthFunc;
+    bool   colorWrite;
+    bool   blend;
+    GLenum blendEquation;
+    GLenum blendSrc;
+    GLenum blendDst;
+    bool   cullFace;
+    GLenum cullMode;
+};
+
+#define GL_STATE_TEXTURE_UNITS 16
+
+// Shadow of the gl state set through gl_state.h, so redundant calls never reach the driver.
+// It is invalidated at the start of every frame since imgui and the setup code bypass it.
+struct GlStateCache
+{
+    GLuint        program;
+    GLuint        vertexArray;
+    GLuint        readFramebuffer;
+    GLuint        drawFramebuffer;
+    u32           activeTextureUnit;
+    GLenum        textureTargets[GL_STATE_TEXTURE_UNITS];
+    GLuint        textures[GL_STATE_TEXTURE_UNITS];
+    PipelineState pipeline;
+    bool          pipelineValid;
+
+    u32 forwardedCalls; // per frame
+    u32 filteredCalls;
+};
+
+// --------------------------------------------------
+// RENDER QUEUE -------------------------------------
+
+enum RenderPass
+{
+    RenderPass_ZPrePass,
+    RenderPass_Geometry,
+    RenderPass_Forward,
+    RenderPass_Count
+};
+
+// One submesh draw of one entity. The key only orders the items, it packs from
+// most to least significant: pass (4 bits) | program (8) | vertex format (8) |
+// material (20) | depth (24). Indices past their field still sort, less grouped,
+// the recorded state comes from the full indices.
+struct DrawItem
+{
+    u64 key;
+    u32 entityIdx;
+    u32 submeshIdx;
+    u32 programIdx;
+    u32 materialIdx; // 0 for the passes without materials
 };
 
+// State changes issued while submitting the render queue, reset every frame
+struct RenderQueueStats
+{
+    u32 draws;
+    u32 programBinds;
+    u32 vertexFormatBinds;
+    u32 materialChanges;
+    u32 entityChanges;
+    u32 culledChunks; // static batch chunks outside the frustum
+};
+
+enum RenderCommandType
+{
+    RenderCommand_BindProgram,      // a = program index
+    RenderCommand_BindVertexFormat, // a = entity index, b = submesh index (its arena)
+    RenderCommand_SetMaterial,      // a = material index
+    RenderCommand_SetEntity,        // a = entity index, its world matrix in the resident transforms
+    RenderCommand_DrawSubmesh,      // a = entity index, b = submesh index
+};
+
+// Backend agnostic command, indices only: any thread can record it, the GL
+// thread replays it (see render_queue.h)
+struct RenderCommand
+{
+    u32 type;
+    u32 a;
+    u32 b;
+};
+
+typedef std::vector<RenderCommand> RenderCommandBuffer;
+
 enum Mode
 {
     Mode_TexturedQuad,
@@ -198,7 +502,8 @@ struct App
     bool isRunning;
 
     // Input
-    Input input;
+    Input      input;
+    InputQueue inputQueue; // same events, for the simulation
 
     // Graphics
     char gpuName[64];
@@ -213,6 +518,14 @@ struct App
     std::vector<Program>  programs;
     std::vector<Light>    lights;
 
+    // Geometry arenas, one per vertex format
+    std::vector<GeometryArena> geometryArenas;
+    GLuint                     geometryIndexBuffer;
+    BuddyAllocator             geometryIndexAllocator; // in 32-bit slots, u16 indices are packed two per slot
+
+    // Vaos keyed by the hash of their vertex buffer and vertex shader layouts
+    std::unordered_multimap<u64, Vao> vaoCache;
+
     // program indices
     u32 texturedGeometryProgramIdx;
     u32 texturedMeshProgramIdx;
@@ -221,6 +534,10 @@ struct App
     //u32 pointLightPassProgramIdx;
     u32 zPrePassProgramIdx;
     u32 fordwardProgramIdx;
+    u32 meshletCullingProgramIdx;
+    u32 zPrePassPullingProgramIdx;
+    u32 geometryPassPullingProgramIdx;
+    u32 forwardPullingProgramIdx;
     
     // texture indices
     u32 diceTexIdx;
@@ -255,6 +572,12 @@ struct App
     u32 defaultModelsId[(int)DefaultModelType::Max];
     u32 defaultMaterialId;
 
+    // animated hierarchy of the default scene: a pivot node carrying a
+    // spinning planet, which carries its moon (see AnimateScene)
+    u32 orbitPivotEntity = ENTITY_NO_PARENT;
+    u32 orbitPlanetEntity = ENTITY_NO_PARENT;
+    f32 sceneTime = 0.f;
+
     // mesh for textured quad
     u32 texturedQuadMeshIdx;
 
@@ -265,6 +588,11 @@ struct App
     Buffer cbuffer;
     u32 globalParamsOffset;
     u32 globalParamsSize;
+    u32 cameraParamsOffset;
+    u32 cameraParamsSize;
+
+    // World matrices of the entities, indexed like app->entities
+    Buffer entityTransformBuffer;
 
     // framebuffer object and attachments
     GLuint gBuffer;
@@ -285,10 +613,19 @@ struct App
 
     //glm::mat4 worldMatrix;
     //glm::mat4 worldViewProjectionMatrix;
+
+    // Simulation: camera, view, projection and entities belong to it, Render
+    // reads the published frame.
+    // Entities are only created while no simulation runs (Init).
+    Simulation    simulation;
+    FrameSnapshot frame;
+    bool          pipelinedUpdate = false; // simulate frame N + 1 while frame N renders
+
     mat4 view;
     mat4 projection;
 
-    std::vector<Entity> entities;
+    Entities entities;
+    std::vector<f32> jobUtilisation; // per job system thread, main thread first
 
     Camera camera;
     uint cubeMapId;
@@ -299,7 +636,7 @@ struct App
     // SSAO
     u32 ssaoProgramIdx;
     u32 ssaoBlurProgramIdx;
-    std::vector<vec3> ssaoKernel;
+    Buffer ssaoKernelBuffer; // static ubo with the hemisphere samples
     GLuint ssaoFBO;
     GLuint ssaoBlurFBO;
     GLuint ssaoColorBuffer;
@@ -311,6 +648,45 @@ struct App
 
     // pipeline selection
     bool deferred = true;
+
+    // Meshlet culling
+    Buffer meshletBuffer;          // all meshlets of all meshes (ssbo)
+    Buffer meshletCommandBuffer;   // compacted draw commands written by the culling pass
+    Buffer meshletDrawCountBuffer; // visible meshlets per entity submesh
+    Buffer meshletCullJobBuffer;   // MeshletCullJob of every visible entity submesh, one workgroup each
+    std::vector<MeshletCullJob> meshletCullJobs;
+    u32 meshletBufferMeshCount = 0;
+    u32 meshletCount = 0;
+    bool doMeshletCulling = true;
+
+    // Vertex pulling
+    GLuint emptyVao; // attribute-less vao for programs that fetch vertices from ssbos
+    bool vertexPulling = false;
+
+    // Static batching
+    bool staticBatching = true;
+
+    // Render queue
+    std::vector<DrawItem> drawItems;        // sorted by key every frame
+    std::vector<DrawItem> drawItemsScratch; // radix sort ping-pong buffer
+    std::vector<std::vector<DrawItem>> drawItemTasks; // items of each entity range, built in parallel
+    std::vector<RenderCommandBuffer> passCommandBuffers[RenderPass_Count]; // recorded in parallel, replayed in order
+    u32 passFirstDrawItem[RenderPass_Count + 1];
+    RenderQueueStats renderQueueStats;
+
+    // Materials and texture arrays
+    Buffer materialBuffer; // ssbo with every material
+    std::vector<TextureArray> textureArrays;
+    u32 materialBufferMaterialCount = 0;
+    u32 textureArraysTextureCount = 0;
+    bool bindlessTextures = false; // materials reference textures by resident handles
+    bool s3tcTextures = false;     // color textures are cooked to BC1/BC3 (see texture_cooker.h)
+    bool materialsChanged = false; // a material changed in place, the buffer is packed again
+
+    // Gl state cache
+    GlStateCache glState;
+    u32 glStateForwardedCalls; // last complete frame
+    u32 glStateFilteredCalls;
 };
 
 
@@ -322,21 +698,40 @@ void Update(App* app);
 
 void Render(App* app);
 void RenderScreenQuad(u32 programIdx, App* app);
+void BindSubmeshVertexFormat(App* app, const Program& program, const Submesh& submesh);
+void DrawSubmesh(App* app, const Program& program, u32 entityIdx, const Submesh& submesh);
+void SetSubmeshPositionDequantization(const Program& program, const Submesh& submesh);
 
 //
-u32 LoadTexture2D(App* app, const char* filepath);
-uint LoadCubemap(std::vector<std::string> facesPaths);
+Image  LoadImage(const char* filename, bool flipVertically = true);
+void   FreeImage(Image image);
+GLuint CreateTexture2DFromImage(Image image);
+u32    FindTexture2D(App* app, const char* filepath, TextureUsage usage); // UINT32_MAX if not loaded
+u32    LoadTexture2D(App* app, const char* filepath, TextureUsage usage = TextureUsage_Color);
+void   LoadTextures2D(App* app, u32 count, const char* const* filepaths, const TextureUsage* usages, u32* texIndices); // decoded in parallel, UINT32_MAX if missing
+uint LoadCubemap(App* app, std::vector<std::string> facesPaths);
 //
 void UpdateCamera(App* app);
 void UpdateProjectionView(App* app);
 mat4 TransformScale(const vec3& scaleFactors);
 mat4 TransformPositionScale(const vec3& pos, const vec3& scaleFactors);
 mat4 TransformWorldMatrix(const vec3& position, const vec3& rotation, const vec3& scaleFactors);
+Transform MakeTransform(const vec3& position, const vec3& rotation, const vec3& scaleFactors);
 float Lerp(float a, float b, float f);
+void ExtractFrustumPlanes(const mat4& viewProjection, vec4 planes[6]);
 //
 void FillOpenGLInfo(App* app);
 void FillInputVertexShaderLayout(Program& program);
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program);
+void FillDrawUniformLocations(Program& program);
+void FillProgramReflection(Program& program);
+GLint UniformLocation(const Program& program, const char* name);
+u64 HashString(const char* str);
+u64 HashVertexBufferLayout(const VertexBufferLayout& layout);
+u64 HashVertexShaderLayout(const VertexShaderLayout& layout);
+bool UsesPositionStream(const Program& program);
+GLuint FindVAO(App* app, const Submesh& submesh, const Program& program);
+void UpdateCachedVAOBuffers(App* app);
+void InvalidateCachedVAOs(App* app, u64 inputLayoutHash);
 
 void OnGlError(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar* msg, const void* userParam);
 
@@ -0,0 +1,223 @@
+#include "entities.h"
+#include "simd_math.h"
+#include "job_system.h"
+
+// Bounding sphere of the aabb of all the submeshes, compressed submeshes keep theirs as the position scale/bias
+static vec4 ModelBoundingSphere(App* app, u32 modelIdx)
+{
+    if (modelIdx == ENTITY_NO_MODEL)
+        return vec4(0.f);
+
+    const Mesh& mesh = app->meshes[app->models[modelIdx].meshIdx];
+    if (mesh.submeshes.empty())
+        return vec4(0.f);
+
+    vec3 aabbMin = mesh.submeshes[0].positionBias - mesh.submeshes[0].positionScale;
+    vec3 aabbMax = mesh.submeshes[0].positionBias + mesh.submeshes[0].positionScale;
+    for (const Submesh& submesh : mesh.submeshes)
+    {
+        aabbMin = min(aabbMin, submesh.positionBias - submesh.positionScale);
+        aabbMax = max(aabbMax, submesh.positionBias + submesh.positionScale);
+    }
+
+    return vec4((aabbMin + aabbMax) * 0.5f, length(aabbMax - aabbMin) * 0.5f);
+}
+
+mat4 TransformMatrix(const vec3& position, const quat& rotation, const vec3& scale)
+{
+    const mat3 r = mat3_cast(rotation);
+    return mat4(vec4(r[0] * scale.x, 0.f), vec4(r[1] * scale.y, 0.f), vec4(r[2] * scale.z, 0.f), vec4(position, 1.f));
+}
+
+u32 CreateEntity(App* app, u32 modelIdx, const Transform& localTransform, u32 parentIdx, u8 flags)
+{
+    Entities& entities = app->entities;
+    assert(parentIdx == ENTITY_NO_PARENT || parentIdx < entities.count);
+    const u32 entityIdx = entities.count++;
+    const vec4 sphere = ModelBoundingSphere(app, modelIdx);
+
+    entities.localPositions.push_back(localTransform.position);
+    entities.localRotations.push_back(localTransform.rotation);
+    entities.localScales.push_back(localTransform.scale);
+    entities.parents.push_back(parentIdx);
+    entities.depths.push_back(parentIdx == ENTITY_NO_PARENT ? 0 : entities.depths[parentIdx] + 1);
+    entities.localDirty.push_back(1);
+    entities.anyLocalDirty = true;
+    entities.hierarchyOrderValid = false;
+
+    entities.worldMatrices.push_back(mat4(1.f));
+    entities.worldChanged.push_back(0);
+    if (entities.dirtyBits.size() * 64 < entities.count)
+        entities.dirtyBits.push_back(0);
+
+    entities.modelIndices.push_back(modelIdx);
+    entities.flags.push_back(flags);
+
+    entities.localCenters.push_back(vec4(vec3(sphere), 1.f));
+    entities.localRadii.push_back(sphere.w);
+    entities.worldCentersX.push_back(0.f);
+    entities.worldCentersY.push_back(0.f);
+    entities.worldCentersZ.push_back(0.f);
+    entities.worldRadii.push_back(0.f);
+
+    entities.viewDepths.push_back(0.f);
+    entities.visible.push_back(0);
+
+    entities.meshletCommandOffsets.push_back(0);
+
+    return entityIdx;
+}
+
+void SetEntityLocalTransform(App* app, u32 entityIdx, const Transform& localTransform)
+{
+    Entities& entities = app->entities;
+    entities.localPositions[entityIdx] = localTransform.position;
+    entities.localRotations[entityIdx] = localTransform.rotation;
+    entities.localScales[entityIdx] = localTransform.scale;
+    entities.localDirty[entityIdx] = 1;
+    entities.anyLocalDirty = true;
+}
+
+// Counting sort of the entities by depth
+static void BuildHierarchyOrder(Entities& entities)
+{
+    u32 maxDepth = 0;
+    for (u32 i = 0; i < entities.count; ++i)
+        maxDepth = std::max(maxDepth, entities.depths[i]);
+
+    entities.depthStarts.assign(maxDepth + 2, 0);
+    for (u32 i = 0; i < entities.count; ++i)
+        entities.depthStarts[entities.depths[i] + 1]++;
+    for (u32 d = 1; d < entities.depthStarts.size(); ++d)
+        entities.depthStarts[d] += entities.depthStarts[d - 1];
+
+    std::vector<u32> heads(entities.depthStarts.begin(), entities.depthStarts.end() - 1);
+    entities.hierarchyOrder.resize(entities.count);
+    for (u32 i = 0; i < entities.count; ++i)
+        entities.hierarchyOrder[heads[entities.depths[i]]++] = i;
+
+    entities.hierarchyOrderValid = true;
+}
+
+void UpdateEntityHierarchy(App* app)
+{
+    Entities& entities = app->entities;
+    if (!entities.anyLocalDirty)
+        return;
+
+    if (!entities.hierarchyOrderValid)
+        BuildHierarchyOrder(entities);
+
+    // within a level every entity only reads its parent, written by the previous level
+    for (u32 depth = 0; depth + 1 < entities.depthStarts.size(); ++depth)
+    {
+        const u32 levelStart = entities.depthStarts[depth];
+        const u32 levelCount = entities.depthStarts[depth + 1] - levelStart;
+        ParallelFor(levelCount, ENTITY_UPDATE_BATCH_SIZE, [&](u32 begin, u32 end)
+        {
+            for (u32 i = levelStart + begin; i < levelStart + end; ++i)
+            {
+                const u32 entityIdx = entities.hierarchyOrder[i];
+                const u32 parentIdx = entities.parents[entityIdx];
+                const bool parentChanged = parentIdx != ENTITY_NO_PARENT && entities.worldChanged[parentIdx];
+                if (!entities.localDirty[entityIdx] && !parentChanged)
+                    continue;
+
+                const mat4 local = TransformMatrix(entities.localPositions[entityIdx], entities.localRotations[entityIdx], entities.localScales[entityIdx]);
+                if (parentIdx == ENTITY_NO_PARENT)
+                    entities.worldMatrices[entityIdx] = local;
+                else
+                    MultiplyMatrices(entities.worldMatrices[parentIdx], local, entities.worldMatrices[entityIdx]);
+
+                entities.localDirty[entityIdx] = 0;
+                entities.worldChanged[entityIdx] = 1;
+            }
+        });
+    }
+
+    // fold the changes into the dirty bitset, each task owns whole words
+    const u32 wordCount = entities.dirtyBits.size();
+    ParallelFor(wordCount, ENTITY_UPDATE_BATCH_SIZE / 64, [&](u32 firstWord, u32 endWord)
+    {
+        for (u32 word = firstWord; word < endWord; ++word)
+        {
+            const u32 end = std::min(word * 64 + 64, entities.count);
+            for (u32 i = word * 64; i < end; ++i)
+            {
+                entities.dirtyBits[word] |= (u64)entities.worldChanged[i] << (i & 63);
+                entities.worldChanged[i] = 0;
+            }
+        }
+    });
+
+    entities.anyLocalDirty = false;
+}
+
+void RefreshModelEntityBounds(App* app, u32 modelIdx)
+{
+    Entities& entities = app->entities;
+    const vec4 sphere = ModelBoundingSphere(app, modelIdx);
+    for (u32 entityIdx = 0; entityIdx < entities.count; ++entityIdx)
+    {
+        if (entities.modelIndices[entityIdx] != modelIdx)
+            continue;
+
+        entities.localCenters[entityIdx] = vec4(vec3(sphere), 1.f);
+        entities.localRadii[entityIdx] = sphere.w;
+        entities.dirtyBits[entityIdx >> 6] |= 1ull << (entityIdx & 63);
+    }
+}
+
+void UpdateEntityBounds(App* app)
+{
+    Entities& entities = app->entities;
+
+    // each task owns whole words of the dirty bitset
+    const u32 wordCount = entities.dirtyBits.size();
+    ParallelFor(wordCount, ENTITY_UPDATE_BATCH_SIZE / 64, [&](u32 firstWord, u32 endWord)
+    {
+        for (u32 word = firstWord; word < endWord; ++word)
+        {
+            u64 bits = entities.dirtyBits[word];
+            while (bits)
+            {
+                // runs of consecutive dirty entities go through the kernel together
+                u32 first = 0;
+                while (!((bits >> first) & 1))
+                    ++first;
+                u32 end = first;
+                while (end < 64 && ((bits >> end) & 1))
+                    ++end;
+                bits &= end < 64 ? ~((1ull << end) - 1) : 0;
+
+                const u32 begin = word * 64 + first;
+                const u32 count = word * 64 + end - begin;
+                TransformPointsArraySoA(&entities.worldMatrices[begin], &entities.localCenters[begin],
+                                        &entities.worldCentersX[begin], &entities.worldCentersY[begin], &entities.worldCentersZ[begin], count);
+
+                for (u32 i = begin; i < begin + count; ++i)
+                {
+                    const mat4& m = entities.worldMatrices[i];
+                    const f32 maxScale = std::fmax(std::fmax(length(vec3(m[0])), length(vec3(m[1]))), length(vec3(m[2])));
+                    entities.worldRadii[i] = entities.localRadii[i] * maxScale;
+                }
+            }
+        }
+    });
+}
+
+void UpdateEntityVisibility(App* app)
+{
+    Entities& entities = app->entities;
+
+    // view space frustum, the bounds centers are moved to view space by the kernel
+    vec4 frustumPlanes[6];
+    ExtractFrustumPlanes(app->projection, frustumPlanes);
+    const mat4 view = app->view;
+
+    ParallelFor(entities.count, ENTITY_UPDATE_BATCH_SIZE, [&](u32 begin, u32 end)
+    {
+        CullSpheresSoA(view, frustumPlanes, &entities.worldCentersX[begin], &entities.worldCentersY[begin], &entities.worldCentersZ[begin],
+                       &entities.worldRadii[begin], &entities.viewDepths[begin], &entities.visible[begin], end - begin);
+    });
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "engine.h"
+
+#define ENTITY_UPDATE_BATCH_SIZE 1024 // entities per job system task
+
+// The parent has to exist already, so parents always come before their children
+u32  CreateEntity(App* app, u32 modelIdx, const Transform& localTransform, u32 parentIdx = ENTITY_NO_PARENT, u8 flags = 0);
+void SetEntityLocalTransform(App* app, u32 entityIdx, const Transform& localTransform);
+
+mat4 TransformMatrix(const vec3& position, const quat& rotation, const vec3& scale);
+
+inline bool IsEntityDirty(const Entities& entities, u32 entityIdx)
+{
+    return (entities.dirtyBits[entityIdx >> 6] >> (entityIdx & 63)) & 1;
+}
+
+inline void MarkEntityDirty(Entities& entities, u32 entityIdx)
+{
+    entities.dirtyBits[entityIdx >> 6] |= 1ull << (entityIdx & 63);
+}
+
+// World matrices of the entities whose local transform or any ancestor
+// changed, one depth level at a time so the parents are always up to date.
+// The recomputed entities are marked dirty.
+void UpdateEntityHierarchy(App* app);
+
+// World bounds of the dirty entities and view depth/frustum visibility of
+// all of them, spread over the job system. Dirty bits are left for
+// PublishFrame, which hands them to the gpu upload.
+void UpdateEntityBounds(App* app);
+
+// Local bounds of the entities of a model whose mesh changed, their world
+// bounds follow in the next UpdateEntityBounds. No simulation may be running.
+void RefreshModelEntityBounds(App* app, u32 modelIdx);
+void UpdateEntityVisibility(App* app);
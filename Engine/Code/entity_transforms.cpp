@@ -0,0 +1,63 @@
+#include "entity_transforms.h"
+#include "entities.h"
+
+static bool IsFrameEntityDirty(const FrameSnapshot& frame, u32 entityIdx)
+{
+    return (frame.dirtyBits[entityIdx >> 6] >> (entityIdx & 63)) & 1;
+}
+
+static void UploadEntityTransforms(App* app, u32 first, u32 count)
+{
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->entityTransformBuffer.handle);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, first * sizeof(mat4), count * sizeof(mat4), &app->frame.worldMatrices[first]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void UpdateEntityTransforms(App* app)
+{
+    // the simulation publishes the moved matrices with their dirty bits
+    FrameSnapshot& frame = app->frame;
+    const u32 entityCount = frame.entityCount;
+    if (entityCount == 0)
+        return;
+
+    if (entityCount * sizeof(mat4) > app->entityTransformBuffer.size)
+    {
+        // grow to the next power of two, everything is uploaded again
+        u32 capacity = 64;
+        while (capacity < entityCount)
+            capacity *= 2;
+
+        if (app->entityTransformBuffer.handle)
+            glDeleteBuffers(1, &app->entityTransformBuffer.handle);
+        app->entityTransformBuffer = CreateBuffer(capacity * sizeof(mat4), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW);
+
+        std::fill(frame.dirtyBits.begin(), frame.dirtyBits.end(), ~0ull);
+    }
+
+    // dirty ones in contiguous runs, clean words of the bitset are skipped whole
+    for (u32 i = 0; i < entityCount;)
+    {
+        if (frame.dirtyBits[i >> 6] == 0)
+        {
+            i = (i | 63) + 1;
+            continue;
+        }
+        if (!IsFrameEntityDirty(frame, i))
+        {
+            ++i;
+            continue;
+        }
+
+        u32 runEnd = i + 1;
+        while (runEnd < entityCount && IsFrameEntityDirty(frame, runEnd))
+            ++runEnd;
+
+        UploadEntityTransforms(app, i, runEnd - i);
+        i = runEnd;
+    }
+
+    std::fill(frame.dirtyBits.begin(), frame.dirtyBits.end(), 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, ENTITY_TRANSFORMS_BINDING, app->entityTransformBuffer.handle);
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include "engine.h"
+
+#define ENTITY_TRANSFORMS_BINDING 6 // ssbo with the world matrix of every entity
+#define CAMERA_PARAMS_BINDING     3 // ubo with view/projection, uploaded per frame
+
+// Uploads the world matrices of the dirty entities of the published frame
+// (created or moved since the last call) and clears their dirty bits, the
+// rest stay on the gpu.
+void UpdateEntityTransforms(App* app);
@@ -0,0 +1,137 @@
+//
+// file_io.cpp: File mapping and writing of the platform layer (see platform.h),
+// apart from platform.cpp so that it builds without a window.
+//
+
+#ifdef _WIN32
+#define VC_EXTRALEAN
+#define WIN32_LEAN_AND_MEAN
+#define _CRT_SECURE_NO_WARNINGS
+#include <Windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "platform.h"
+
+MappedFile MapFile(const char* filepath)
+{
+    MappedFile file = {};
+
+#ifdef _WIN32
+    HANDLE fileHandle = CreateFileA(filepath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fileHandle == INVALID_HANDLE_VALUE)
+        return file;
+
+    LARGE_INTEGER size;
+    HANDLE mappingHandle = NULL;
+    if (GetFileSizeEx(fileHandle, &size) && size.QuadPart > 0)
+        mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!mappingHandle)
+    {
+        CloseHandle(fileHandle);
+        return file;
+    }
+
+    file.data = (const u8*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (!file.data)
+    {
+        CloseHandle(mappingHandle);
+        CloseHandle(fileHandle);
+        return file;
+    }
+    file.size = size.QuadPart;
+    file.fileHandle = fileHandle;
+    file.mappingHandle = mappingHandle;
+#else
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0)
+        return file;
+
+    struct stat attrib;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &attrib) == 0 && attrib.st_size > 0)
+        data = mmap(NULL, attrib.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return file;
+
+    file.data = (const u8*)data;
+    file.size = attrib.st_size;
+#endif
+
+    return file;
+}
+
+void UnmapFile(MappedFile& file)
+{
+    if (!file.data)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(file.data);
+    CloseHandle((HANDLE)file.mappingHandle);
+    CloseHandle((HANDLE)file.fileHandle);
+#else
+    munmap((void*)file.data, file.size);
+#endif
+
+    file = {};
+}
+
+bool WriteFileAtomically(const char* filepath, const FileChunk* chunks, u32 chunkCount)
+{
+    const std::string tempPath = std::string(filepath) + ".tmp";
+    FILE* file = fopen(tempPath.c_str(), "wb");
+    if (!file)
+    {
+        ELOG("fopen() failed writing file %s", tempPath.c_str());
+        return false;
+    }
+
+    bool written = true;
+    for (u32 i = 0; i < chunkCount && written; ++i)
+        written = fwrite(chunks[i].data, 1, chunks[i].size, file) == chunks[i].size;
+    written = fclose(file) == 0 && written;
+
+#ifdef _WIN32
+    const bool replaced = written && MoveFileExA(tempPath.c_str(), filepath, MOVEFILE_REPLACE_EXISTING);
+#else
+    const bool replaced = written && rename(tempPath.c_str(), filepath) == 0;
+#endif
+
+    if (!replaced)
+    {
+        ELOG("Couldn't %s file %s", written ? "replace" : "write", filepath);
+        remove(tempPath.c_str());
+    }
+    return replaced;
+}
+
+u64 GetFileLastWriteTimestamp(const char* filepath)
+{
+#ifdef _WIN32
+    union Filetime2u64 {
+        FILETIME filetime;
+        u64      u64time;
+    } conversor;
+
+    WIN32_FILE_ATTRIBUTE_DATA Data;
+    if(GetFileAttributesExA(filepath, GetFileExInfoStandard, &Data)) {
+        conversor.filetime = Data.ftLastWriteTime;
+        return(conversor.u64time);
+    }
+#else
+    // NOTE: This has not been tested in unix-like systems
+    struct stat attrib;
+    if (stat(filepath, &attrib) == 0) {
+        return attrib.st_mtime;
+    }
+#endif
+
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include "model_loading.h"
 #include "generator_model_loading.h"
+#include "vertex_compression.h"
 
 #define PAR_SHAPES_IMPLEMENTATION
 #include "par_shapes.h"
@@ -74,12 +75,11 @@ u32 LoadDefaultModel(DefaultModelType type, App* app)
 
 	// Add the submesh into the mesh
 	Submesh submesh = {};
-	submesh.vertexBufferLayout = vertexBufferLayout;
-	submesh.vertices.swap(vertices);
+	CompressSubmeshVertices(submesh, vertices, vertexBufferLayout);
 	submesh.indices.swap(indices);
 	mesh.submeshes.push_back(submesh);
 
-	LoadMeshGlBuffers(mesh);
+	LoadMeshGlBuffers(app, mesh);
 	par_shapes_free_mesh(parMesh);
 
 	return modelIdx;
@@ -0,0 +1,246 @@
+#include "geometry_arena.h"
+
+#define ARENA_INITIAL_VERTEX_COUNT  KB(64)
+#define ARENA_INITIAL_INDEX_COUNT   KB(256)
+#define ARENA_MIN_BLOCK_SIZE        32
+
+static bool SameVertexBufferLayout(const VertexBufferLayout& a, const VertexBufferLayout& b)
+{
+    if (a.stride != b.stride || a.attributes.size() != b.attributes.size())
+        return false;
+
+    for (u32 i = 0; i < a.attributes.size(); ++i)
+    {
+        if (a.attributes[i].location != b.attributes[i].location ||
+            a.attributes[i].componentCount != b.attributes[i].componentCount ||
+            a.attributes[i].offset != b.attributes[i].offset ||
+            a.attributes[i].type != b.attributes[i].type ||
+            a.attributes[i].normalized != b.attributes[i].normalized)
+            return false;
+    }
+    return true;
+}
+
+static u32 ComponentSize(GLenum type)
+{
+    switch (type)
+    {
+        case GL_BYTE: case GL_UNSIGNED_BYTE: return 1;
+        case GL_SHORT: case GL_UNSIGNED_SHORT: case GL_HALF_FLOAT: return 2;
+        default: return 4;
+    }
+}
+
+static VertexBufferAttribute PositionAttribute(const VertexBufferLayout& layout)
+{
+    for (u32 i = 0; i < layout.attributes.size(); ++i)
+    {
+        if (layout.attributes[i].location == 0)
+            return layout.attributes[i];
+    }
+    assert(0 && "vertex format without position");
+    return {};
+}
+
+static u8 PositionStreamStride(const VertexBufferAttribute& positionAttribute)
+{
+    return (positionAttribute.componentCount * ComponentSize(positionAttribute.type) + 3) & ~3;
+}
+
+static GLuint CreateArenaBuffer(u32 size)
+{
+    GLuint handle;
+    glGenBuffers(1, &handle);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, handle);
+    glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return handle;
+}
+
+// Doubles the size of a buffer keeping its contents, returns the new handle
+static GLuint GrowArenaBuffer(GLuint handle, u32 oldSize)
+{
+    GLuint newHandle = CreateArenaBuffer(oldSize * 2);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, handle);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newHandle);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldSize);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glDeleteBuffers(1, &handle);
+    return newHandle;
+}
+
+void InitGeometryArenas(App* app)
+{
+    app->geometryIndexBuffer = CreateArenaBuffer(ARENA_INITIAL_INDEX_COUNT * sizeof(u32));
+    app->geometryIndexAllocator = CreateBuddyAllocator(ARENA_INITIAL_INDEX_COUNT, ARENA_MIN_BLOCK_SIZE);
+}
+
+u32 FindOrCreateGeometryArena(App* app, const VertexBufferLayout& layout)
+{
+    for (u32 i = 0; i < app->geometryArenas.size(); ++i)
+    {
+        if (SameVertexBufferLayout(app->geometryArenas[i].vertexBufferLayout, layout))
+            return i;
+    }
+
+    GeometryArena arena = {};
+    arena.vertexBufferLayout = layout;
+    arena.layoutHash = HashVertexBufferLayout(layout);
+    arena.vertexBufferHandle = CreateArenaBuffer(ARENA_INITIAL_VERTEX_COUNT * layout.stride);
+    arena.vertexAllocator = CreateBuddyAllocator(ARENA_INITIAL_VERTEX_COUNT, ARENA_MIN_BLOCK_SIZE);
+
+    // position stream: same format as the position attribute, 4 byte aligned
+    arena.positionAttribute = PositionAttribute(layout);
+    arena.positionAttribute.offset = 0;
+    arena.positionStride = PositionStreamStride(arena.positionAttribute);
+    arena.positionBufferHandle = CreateArenaBuffer(ARENA_INITIAL_VERTEX_COUNT * arena.positionStride);
+
+    app->geometryArenas.push_back(arena);
+    return app->geometryArenas.size() - 1;
+}
+
+void PrepareSubmeshGeometry(Submesh& submesh, SubmeshGeometryData& data)
+{
+    const VertexBufferLayout& layout = submesh.vertexBufferLayout;
+    const u32 stride = layout.stride;
+    const u32 vertexCount = submesh.vertices.size() / stride;
+
+    const VertexBufferAttribute positionAttribute = PositionAttribute(layout);
+    const u32 positionStride = PositionStreamStride(positionAttribute);
+    const u32 positionSize = positionAttribute.componentCount * ComponentSize(positionAttribute.type);
+
+    // 16-bit indices whenever the submesh vertices fit, packed two per slot
+    submesh.indexType = vertexCount <= 0xFFFF ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    data.indicesSize = submesh.indices.size() * IndexSize(submesh.indexType);
+    data.positionsSize = vertexCount * positionStride;
+    data.storage.assign(data.indicesSize + data.positionsSize, 0);
+
+    u8* indices = data.storage.data();
+    if (submesh.indexType == GL_UNSIGNED_SHORT)
+    {
+        for (u32 i = 0; i < submesh.indices.size(); ++i)
+        {
+            const u16 index = (u16)submesh.indices[i];
+            memcpy(&indices[i * sizeof(u16)], &index, sizeof(u16));
+        }
+    }
+    else
+    {
+        memcpy(indices, submesh.indices.data(), data.indicesSize);
+    }
+
+    // position stream
+    u8* positions = indices + data.indicesSize;
+    for (u32 i = 0; i < vertexCount; ++i)
+        memcpy(&positions[i * positionStride], &submesh.vertices[i * stride + positionAttribute.offset], positionSize);
+
+    data.indices = indices;
+    data.positions = positions;
+}
+
+// Vertex and index ranges of a prepared submesh, growing the arena buffers as needed
+static void AllocateSubmeshRanges(App* app, Submesh& submesh)
+{
+    const u32 arenaIdx = FindOrCreateGeometryArena(app, submesh.vertexBufferLayout);
+    GeometryArena& arena = app->geometryArenas[arenaIdx];
+
+    const u32 stride = arena.vertexBufferLayout.stride;
+    const u32 vertexCount = submesh.vertices.size() / stride;
+    const u32 indexSlotCount = IndexSlotCount(submesh);
+
+    // vertices
+    u32 baseVertex = BuddyAllocate(arena.vertexAllocator, vertexCount);
+    while (baseVertex == BUDDY_ALLOCATION_FAILED)
+    {
+        arena.vertexBufferHandle = GrowArenaBuffer(arena.vertexBufferHandle, BuddyCapacity(arena.vertexAllocator) * stride);
+        arena.positionBufferHandle = GrowArenaBuffer(arena.positionBufferHandle, BuddyCapacity(arena.vertexAllocator) * arena.positionStride);
+        BuddyGrow(arena.vertexAllocator);
+        UpdateCachedVAOBuffers(app);
+        baseVertex = BuddyAllocate(arena.vertexAllocator, vertexCount);
+    }
+
+    // indices
+    u32 firstSlot = BuddyAllocate(app->geometryIndexAllocator, indexSlotCount);
+    while (firstSlot == BUDDY_ALLOCATION_FAILED)
+    {
+        app->geometryIndexBuffer = GrowArenaBuffer(app->geometryIndexBuffer, BuddyCapacity(app->geometryIndexAllocator) * sizeof(u32));
+        BuddyGrow(app->geometryIndexAllocator);
+        UpdateCachedVAOBuffers(app);
+        firstSlot = BuddyAllocate(app->geometryIndexAllocator, indexSlotCount);
+    }
+
+    submesh.arenaIdx = arenaIdx;
+    submesh.baseVertex = baseVertex;
+    submesh.firstIndex = firstSlot * sizeof(u32) / IndexSize(submesh.indexType);
+}
+
+void AllocateSubmeshGeometry(App* app, Submesh& submesh)
+{
+    SubmeshGeometryData data;
+    PrepareSubmeshGeometry(submesh, data);
+    AllocatePreparedSubmeshGeometry(app, submesh, data);
+}
+
+void AllocatePreparedSubmeshGeometry(App* app, Submesh& submesh, const SubmeshGeometryData& data)
+{
+    AllocateSubmeshRanges(app, submesh);
+
+    const GeometryArena& arena = app->geometryArenas[submesh.arenaIdx];
+    const u32 stride = arena.vertexBufferLayout.stride;
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena.vertexBufferHandle);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, submesh.baseVertex * stride, submesh.vertices.size(), submesh.vertices.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena.positionBufferHandle);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, submesh.baseVertex * arena.positionStride, data.positionsSize, data.positions);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, app->geometryIndexBuffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, (u64)IndexBufferOffset(submesh), data.indicesSize, data.indices);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void AllocateSubmeshGeometryFromBuffer(App* app, Submesh& submesh, GLuint sourceBuffer, u32 verticesOffset, u32 positionsOffset, u32 indicesOffset)
+{
+    AllocateSubmeshRanges(app, submesh);
+
+    const GeometryArena& arena = app->geometryArenas[submesh.arenaIdx];
+    const u32 stride = arena.vertexBufferLayout.stride;
+    const u32 vertexCount = submesh.vertices.size() / stride;
+
+    glBindBuffer(GL_COPY_READ_BUFFER, sourceBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena.vertexBufferHandle);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, verticesOffset, submesh.baseVertex * stride, submesh.vertices.size());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, arena.positionBufferHandle);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, positionsOffset, submesh.baseVertex * arena.positionStride, vertexCount * arena.positionStride);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, app->geometryIndexBuffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, indicesOffset, (u64)IndexBufferOffset(submesh), submesh.indices.size() * IndexSize(submesh.indexType));
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void FreeSubmeshGeometry(App* app, Submesh& submesh)
+{
+    GeometryArena& arena = app->geometryArenas[submesh.arenaIdx];
+    const u32 vertexCount = submesh.vertices.size() / arena.vertexBufferLayout.stride;
+    const u32 firstSlot = submesh.firstIndex * IndexSize(submesh.indexType) / sizeof(u32);
+
+    BuddyFree(arena.vertexAllocator, submesh.baseVertex, vertexCount);
+    BuddyFree(app->geometryIndexAllocator, firstSlot, IndexSlotCount(submesh));
+}
+
+u32 IndexSize(GLenum indexType)
+{
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(u16) : sizeof(u32);
+}
+
+u32 IndexSlotCount(const Submesh& submesh)
+{
+    const u32 indexSize = IndexSize(submesh.indexType);
+    return (submesh.indices.size() * indexSize + sizeof(u32) - 1) / sizeof(u32);
+}
+
+const void* IndexBufferOffset(const Submesh& submesh)
+{
+    return (const void*)(u64)(submesh.firstIndex * IndexSize(submesh.indexType));
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "engine.h"
+
+void InitGeometryArenas(App* app);
+u32  FindOrCreateGeometryArena(App* app, const VertexBufferLayout& layout);
+void AllocateSubmeshGeometry(App* app, Submesh& submesh);
+
+// Gpu data of a submesh as AllocateSubmeshGeometry uploads it, any thread can
+// build it. The streams point into storage, or into a mapped mesh cache that
+// outlives them (see ImportedModel).
+struct SubmeshGeometryData
+{
+    const u8*       positions;     // position stream
+    u32             positionsSize;
+    const u8*       indices;       // 16-bit when the vertices fit
+    u32             indicesSize;
+    std::vector<u8> storage;
+};
+void PrepareSubmeshGeometry(Submesh& submesh, SubmeshGeometryData& data); // sets the submesh index type
+void AllocatePreparedSubmeshGeometry(App* app, Submesh& submesh, const SubmeshGeometryData& data);
+
+// Same as AllocateSubmeshGeometry for a prepared submesh whose vertices,
+// positions and indices are already in a gpu buffer, copied on the gpu
+void AllocateSubmeshGeometryFromBuffer(App* app, Submesh& submesh, GLuint sourceBuffer, u32 verticesOffset, u32 positionsOffset, u32 indicesOffset);
+void FreeSubmeshGeometry(App* app, Submesh& submesh);
+
+u32 IndexSize(GLenum indexType);
+u32 IndexSlotCount(const Submesh& submesh);          // 32-bit slots used in the shared index buffer
+const void* IndexBufferOffset(const Submesh& submesh); // byte offset of the first index, for draw calls
@@ -0,0 +1,29 @@
+#include "gl_extensions.h"
+
+PFNGLGETTEXTUREHANDLEARBPROC            glGetTextureHandleARB = NULL;
+PFNGLMAKETEXTUREHANDLERESIDENTARBPROC    glMakeTextureHandleResidentARB = NULL;
+PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC glMakeTextureHandleNonResidentARB = NULL;
+
+bool HasGLExtension(const char* name)
+{
+    GLint extensionCount;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+    for (GLint i = 0; i < extensionCount; ++i)
+    {
+        if (strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool LoadBindlessTextureExtension()
+{
+    if (!HasGLExtension("GL_ARB_bindless_texture"))
+        return false;
+
+    glGetTextureHandleARB = (PFNGLGETTEXTUREHANDLEARBPROC)GetGLProcAddress("glGetTextureHandleARB");
+    glMakeTextureHandleResidentARB = (PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)GetGLProcAddress("glMakeTextureHandleResidentARB");
+    glMakeTextureHandleNonResidentARB = (PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)GetGLProcAddress("glMakeTextureHandleNonResidentARB");
+
+    return glGetTextureHandleARB && glMakeTextureHandleResidentARB && glMakeTextureHandleNonResidentARB;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "engine.h"
+
+// Extensions used by the engine that are not part of the glad loader (GL 4.3 core).
+// Their entry points are loaded by hand through the platform layer.
+
+// GL_ARB_bindless_texture
+typedef GLuint64 (APIENTRYP PFNGLGETTEXTUREHANDLEARBPROC)(GLuint texture);
+typedef void (APIENTRYP PFNGLMAKETEXTUREHANDLERESIDENTARBPROC)(GLuint64 handle);
+typedef void (APIENTRYP PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC)(GLuint64 handle);
+
+extern PFNGLGETTEXTUREHANDLEARBPROC            glGetTextureHandleARB;
+extern PFNGLMAKETEXTUREHANDLERESIDENTARBPROC    glMakeTextureHandleResidentARB;
+extern PFNGLMAKETEXTUREHANDLENONRESIDENTARBPROC glMakeTextureHandleNonResidentARB;
+
+// GL_EXT_texture_compression_s3tc, BC1/BC3 (RGTC BC4/BC5 are core)
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT  0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// Prepended to the programs that sample bindless handles
+#define BINDLESS_TEXTURES_DEFINES "#extension GL_ARB_bindless_texture : require\n#define BINDLESS_TEXTURES\n"
+
+bool HasGLExtension(const char* name);
+bool LoadBindlessTextureExtension();
@@ -0,0 +1,180 @@
+#include "gl_state.h"
+
+#define GL_STATE_UNKNOWN 0xFFFFFFFFu
+
+static bool Filter(GlStateCache& state, bool changed)
+{
+    if (changed) state.forwardedCalls++;
+    else         state.filteredCalls++;
+    return changed;
+}
+
+static void SetCapability(GlStateCache& state, GLenum capability, bool& current, bool value)
+{
+    if (Filter(state, !state.pipelineValid || current != value))
+    {
+        if (value) glEnable(capability);
+        else       glDisable(capability);
+        current = value;
+    }
+}
+
+void InvalidateGlState(App* app)
+{
+    GlStateCache& state = app->glState;
+
+    // keep last frame's counters around for the gui
+    app->glStateForwardedCalls = state.forwardedCalls;
+    app->glStateFilteredCalls = state.filteredCalls;
+
+    state.program = GL_STATE_UNKNOWN;
+    state.vertexArray = GL_STATE_UNKNOWN;
+    state.readFramebuffer = GL_STATE_UNKNOWN;
+    state.drawFramebuffer = GL_STATE_UNKNOWN;
+    state.activeTextureUnit = GL_STATE_UNKNOWN;
+    for (u32 unit = 0; unit < GL_STATE_TEXTURE_UNITS; ++unit)
+    {
+        state.textureTargets[unit] = GL_STATE_UNKNOWN;
+        state.textures[unit] = GL_STATE_UNKNOWN;
+    }
+    state.pipelineValid = false;
+
+    state.forwardedCalls = 0;
+    state.filteredCalls = 0;
+}
+
+void BindProgram(App* app, GLuint program)
+{
+    GlStateCache& state = app->glState;
+    if (Filter(state, state.program != program))
+    {
+        glUseProgram(program);
+        state.program = program;
+    }
+}
+
+void BindVertexArray(App* app, GLuint vertexArray)
+{
+    GlStateCache& state = app->glState;
+    if (Filter(state, state.vertexArray != vertexArray))
+    {
+        glBindVertexArray(vertexArray);
+        state.vertexArray = vertexArray;
+    }
+}
+
+void BindFramebuffer(App* app, GLenum target, GLuint framebuffer)
+{
+    GlStateCache& state = app->glState;
+    bool read = target == GL_FRAMEBUFFER || target == GL_READ_FRAMEBUFFER;
+    bool draw = target == GL_FRAMEBUFFER || target == GL_DRAW_FRAMEBUFFER;
+
+    bool changed = (read && state.readFramebuffer != framebuffer) ||
+                   (draw && state.drawFramebuffer != framebuffer);
+    if (Filter(state, changed))
+    {
+        glBindFramebuffer(target, framebuffer);
+        if (read) state.readFramebuffer = framebuffer;
+        if (draw) state.drawFramebuffer = framebuffer;
+    }
+}
+
+void BindTextureUnit(App* app, u32 unit, GLenum target, GLuint texture)
+{
+    GlStateCache& state = app->glState;
+    ASSERT(unit < GL_STATE_TEXTURE_UNITS, "Texture unit out of range of the state cache");
+
+    // a unit holds one binding per target; only the last one is tracked,
+    // so switching targets on a unit is always forwarded
+    if (state.textureTargets[unit] == target && state.textures[unit] == texture)
+    {
+        state.filteredCalls++;
+        return;
+    }
+
+    if (Filter(state, state.activeTextureUnit != unit))
+    {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        state.activeTextureUnit = unit;
+    }
+
+    state.forwardedCalls++;
+    glBindTexture(target, texture);
+    state.textureTargets[unit] = target;
+    state.textures[unit] = texture;
+}
+
+void DeleteTexture(App* app, GLuint texture)
+{
+    GlStateCache& state = app->glState;
+
+    // deleting a bound texture reverts its units to 0
+    for (u32 unit = 0; unit < GL_STATE_TEXTURE_UNITS; ++unit)
+    {
+        if (state.textures[unit] == texture)
+            state.textures[unit] = 0;
+    }
+
+    glDeleteTextures(1, &texture);
+}
+
+void SetPipelineState(App* app, const PipelineState& pipeline)
+{
+    GlStateCache& state = app->glState;
+    PipelineState& current = state.pipeline;
+    const bool valid = state.pipelineValid;
+
+    SetCapability(state, GL_DEPTH_TEST, current.depthTest, pipeline.depthTest);
+    if (Filter(state, !valid || current.depthWrite != pipeline.depthWrite))
+    {
+        glDepthMask(pipeline.depthWrite ? GL_TRUE : GL_FALSE);
+        current.depthWrite = pipeline.depthWrite;
+    }
+    if (Filter(state, !valid || current.depthFunc != pipeline.depthFunc))
+    {
+        glDepthFunc(pipeline.depthFunc);
+        current.depthFunc = pipeline.depthFunc;
+    }
+
+    if (Filter(state, !valid || current.colorWrite != pipeline.colorWrite))
+    {
+        GLboolean mask = pipeline.colorWrite ? GL_TRUE : GL_FALSE;
+        glColorMask(mask, mask, mask, mask);
+        current.colorWrite = pipeline.colorWrite;
+    }
+
+    SetCapability(state, GL_BLEND, current.blend, pipeline.blend);
+    if (pipeline.blend)
+    {
+        if (Filter(state, !valid || current.blendEquation != pipeline.blendEquation))
+        {
+            glBlendEquation(pipeline.blendEquation);
+            current.blendEquation = pipeline.blendEquation;
+        }
+        if (Filter(state, !valid || current.blendSrc != pipeline.blendSrc || current.blendDst != pipeline.blendDst))
+        {
+            glBlendFunc(pipeline.blendSrc, pipeline.blendDst);
+            current.blendSrc = pipeline.blendSrc;
+            current.blendDst = pipeline.blendDst;
+        }
+    }
+
+    SetCapability(state, GL_CULL_FACE, current.cullFace, pipeline.cullFace);
+    if (pipeline.cullFace)
+    {
+        if (Filter(state, !valid || current.cullMode != pipeline.cullMode))
+        {
+            glCullFace(pipeline.cullMode);
+            current.cullMode = pipeline.cullMode;
+        }
+    }
+
+    // blend/cull parameters of a disabled stage are left as they are, and are
+    // only known once a pipeline that enables the stage has been applied
+    if (!valid)
+    {
+        if (!pipeline.blend)    { current.blendEquation = GL_STATE_UNKNOWN; current.blendSrc = GL_STATE_UNKNOWN; }
+        if (!pipeline.cullFace) { current.cullMode = GL_STATE_UNKNOWN; }
+        state.pipelineValid = true;
+    }
+}
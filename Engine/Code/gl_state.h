@@ -0,0 +1,11 @@
+#pragma once
+
+#include "engine.h"
+
+void InvalidateGlState(App* app);
+void BindProgram(App* app, GLuint program);
+void BindVertexArray(App* app, GLuint vertexArray);
+void BindFramebuffer(App* app, GLenum target, GLuint framebuffer);
+void BindTextureUnit(App* app, u32 unit, GLenum target, GLuint texture);
+void DeleteTexture(App* app, GLuint texture);
+void SetPipelineState(App* app, const PipelineState& pipeline);
@@ -0,0 +1,114 @@
+//
+// input_queue.cpp: The input event queue declared in platform.h, filled by the
+// GLFW callbacks and drained by the simulation. It needs no window, the
+// Tests project builds it on its own.
+//
+
+#include "platform.h"
+
+static bool TryPushInputEvent(InputQueue& queue, const InputEvent& event)
+{
+    const u32 tail = queue.tail.load(std::memory_order_relaxed);
+    if (tail - queue.head.load(std::memory_order_acquire) == INPUT_QUEUE_SIZE)
+        return false;
+
+    queue.events[tail & (INPUT_QUEUE_SIZE - 1)] = event;
+    queue.tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+// Keeps the order: once an event waits in overflow, the later ones queue behind it
+static void EnqueueInputEvent(InputQueue& queue, const InputEvent& event)
+{
+    if (!queue.overflow.empty() || !TryPushInputEvent(queue, event))
+        queue.overflow.push_back(event);
+}
+
+void FlushInputEvents(InputQueue& queue)
+{
+    if (queue.hasPendingMove)
+    {
+        EnqueueInputEvent(queue, queue.pendingMove);
+        queue.hasPendingMove = false;
+    }
+
+    if (queue.hasPendingScroll)
+    {
+        EnqueueInputEvent(queue, queue.pendingScroll);
+        queue.hasPendingScroll = false;
+    }
+
+    u32 flushed = 0;
+    while (flushed < queue.overflow.size() && TryPushInputEvent(queue, queue.overflow[flushed]))
+        flushed++;
+    queue.overflow.erase(queue.overflow.begin(), queue.overflow.begin() + flushed);
+}
+
+void PushInputEvent(InputQueue& queue, const InputEvent& event)
+{
+    switch (event.type) {
+        case INPUT_EVENT_MOUSE_MOVE:
+            // only the last position matters, the deltas add up on the consumer side
+            queue.pendingMove = event;
+            queue.hasPendingMove = true;
+            break;
+        case INPUT_EVENT_MOUSE_SCROLL:
+            if (queue.hasPendingScroll)
+            {
+                queue.pendingScroll.scroll += event.scroll;
+                queue.pendingScroll.mousePos = event.mousePos;
+            }
+            else
+            {
+                queue.pendingScroll = event;
+                queue.hasPendingScroll = true;
+            }
+            break;
+        default:
+            // the moves before a transition go first, a click lands where the cursor was
+            FlushInputEvents(queue);
+            EnqueueInputEvent(queue, event);
+            break;
+    }
+}
+
+bool PopInputEvent(InputQueue& queue, InputEvent& event)
+{
+    const u32 head = queue.head.load(std::memory_order_relaxed);
+    if (head == queue.tail.load(std::memory_order_acquire))
+        return false;
+
+    event = queue.events[head & (INPUT_QUEUE_SIZE - 1)];
+    queue.head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+void ConsumeInputEvents(InputQueue& queue, Input& input)
+{
+    for (u32 i = 0; i < KEY_COUNT; ++i)
+        if      (input.keys[i] == BUTTON_PRESS)   input.keys[i] = BUTTON_PRESSED;
+        else if (input.keys[i] == BUTTON_RELEASE) input.keys[i] = BUTTON_IDLE;
+
+    for (u32 i = 0; i < MOUSE_BUTTON_COUNT; ++i)
+        if      (input.mouseButtons[i] == BUTTON_PRESS)   input.mouseButtons[i] = BUTTON_PRESSED;
+        else if (input.mouseButtons[i] == BUTTON_RELEASE) input.mouseButtons[i] = BUTTON_IDLE;
+
+    input.mouseDelta = glm::vec2(0.0f, 0.0f);
+    input.mouseScroll = glm::vec2(0.0f, 0.0f);
+
+    InputEvent event;
+    while (PopInputEvent(queue, event))
+    {
+        switch (event.type) {
+            case INPUT_EVENT_KEY:          input.keys[event.code] = event.state; break;
+            case INPUT_EVENT_MOUSE_BUTTON: input.mouseButtons[event.code] = event.state; break;
+            case INPUT_EVENT_MOUSE_MOVE:
+                input.mouseDelta += event.mousePos - input.mousePos;
+                input.mousePos = event.mousePos;
+                break;
+            case INPUT_EVENT_MOUSE_SCROLL:
+                input.mouseScroll += event.scroll;
+                break;
+        }
+    }
+}
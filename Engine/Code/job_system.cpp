@@ -0,0 +1,321 @@
+#include "job_system.h"
+
+#include <chrono>
+#include <deque>
+#include <thread>
+
+#define MAIN_THREAD_INDEX 0
+#define EXTERNAL_THREAD   0xFFFFFFFFu // any thread not created by the job system
+
+struct JobQueue
+{
+    std::mutex      mutex;
+    std::deque<Job> jobs; // the owner works at the back, thieves at the front
+};
+
+struct JobThreadStats
+{
+    std::atomic<u64> busyMicroseconds{ 0 };
+    u64              sampledBusyMicroseconds = 0;
+};
+
+struct JobSystem
+{
+    std::vector<std::thread> threads;
+    JobQueue*                queues = nullptr; // one per thread, main thread first
+    JobThreadStats*          stats = nullptr;
+    u32                      threadCount = 0;
+
+    // sleeping workers
+    std::mutex              sleepMutex;
+    std::condition_variable wakeUp;
+    std::atomic<u32>        queuedJobs{ 0 };
+    bool                    quit = false;
+
+    std::atomic<u32> nextExternalQueue{ 0 };
+    f64              lastSampleTime = 0.0;
+};
+
+static JobSystem jobSystem;
+static thread_local u32 threadIndex = EXTERNAL_THREAD;
+static thread_local u64 waitMicroseconds = 0; // spent in WaitForCounter, nested waits included once
+
+static u64 NowMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void PushJob(Job&& job)
+{
+    u32 queueIdx = threadIndex;
+    if (queueIdx == EXTERNAL_THREAD)
+        queueIdx = 1 + jobSystem.nextExternalQueue++ % (jobSystem.threadCount - 1);
+
+    {
+        JobQueue& queue = jobSystem.queues[queueIdx];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.jobs.push_back(std::move(job));
+    }
+
+    {
+        // under the lock, a worker can't miss it between its check and its wait
+        std::lock_guard<std::mutex> lock(jobSystem.sleepMutex);
+        jobSystem.queuedJobs++;
+    }
+    jobSystem.wakeUp.notify_one();
+}
+
+// A waiting thread (waitCounter set) takes frame jobs and the jobs of the
+// counter it waits on only, an idle worker takes anything
+static bool CanRunJob(const Job& job, const JobCounter* waitCounter)
+{
+    return !waitCounter || job.kind == JobKind_Frame || job.counter == waitCounter;
+}
+
+static bool PopJob(u32 queueIdx, bool steal, const JobCounter* waitCounter, Job& job)
+{
+    JobQueue& queue = jobSystem.queues[queueIdx];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    const u32 jobCount = (u32)queue.jobs.size();
+    for (u32 i = 0; i < jobCount; ++i)
+    {
+        const u32 jobIdx = steal ? i : jobCount - 1 - i;
+        if (!CanRunJob(queue.jobs[jobIdx], waitCounter))
+            continue;
+
+        job = std::move(queue.jobs[jobIdx]);
+        queue.jobs.erase(queue.jobs.begin() + jobIdx);
+        jobSystem.queuedJobs--;
+        return true;
+    }
+    return false;
+}
+
+// Own queue first, then the others (workers only)
+static bool FindJob(const JobCounter* waitCounter, Job& job)
+{
+    if (threadIndex == EXTERNAL_THREAD)
+        return false;
+
+    if (PopJob(threadIndex, false, waitCounter, job))
+        return true;
+
+    if (threadIndex == MAIN_THREAD_INDEX)
+        return false;
+
+    for (u32 i = 1; i < jobSystem.threadCount; ++i)
+    {
+        const u32 victim = (threadIndex + i) % jobSystem.threadCount;
+        if (PopJob(victim, true, waitCounter, job))
+            return true;
+    }
+    return false;
+}
+
+static void FinishJob(JobCounter* counter)
+{
+    std::vector<Job> continuations;
+    {
+        std::lock_guard<std::mutex> lock(counter->mutex);
+        if (--counter->pending == 0)
+        {
+            continuations.swap(counter->continuations);
+            // notified under the lock, the waiter may destroy the counter right after
+            counter->done.notify_all();
+        }
+    }
+
+    for (Job& continuation : continuations)
+        PushJob(std::move(continuation));
+}
+
+static void ExecuteJob(Job& job)
+{
+    // the jobs run while this one waits count for themselves
+    const u64 waitedBefore = waitMicroseconds;
+    const u64 start = NowMicroseconds();
+    job.function();
+    const u64 elapsed = NowMicroseconds() - start;
+    jobSystem.stats[threadIndex].busyMicroseconds += elapsed - (waitMicroseconds - waitedBefore);
+
+    if (job.counter)
+        FinishJob(job.counter);
+}
+
+static void WorkerMain(u32 index)
+{
+    threadIndex = index;
+    for (;;)
+    {
+        Job job;
+        if (FindJob(nullptr, job))
+        {
+            ExecuteJob(job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(jobSystem.sleepMutex);
+        jobSystem.wakeUp.wait(lock, [] { return jobSystem.quit || jobSystem.queuedJobs > 0; });
+        if (jobSystem.quit)
+            return;
+    }
+}
+
+void InitJobSystem(u32 workerCount)
+{
+    if (jobSystem.threadCount)
+        return;
+
+    if (workerCount == 0)
+    {
+        const u32 hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 2 ? hardwareThreads - 1 : 1;
+    }
+
+    jobSystem.threadCount = workerCount + 1;
+    jobSystem.queues = new JobQueue[jobSystem.threadCount];
+    jobSystem.stats = new JobThreadStats[jobSystem.threadCount];
+    jobSystem.lastSampleTime = GetTimeSeconds();
+    threadIndex = MAIN_THREAD_INDEX;
+
+    for (u32 i = 1; i < jobSystem.threadCount; ++i)
+        jobSystem.threads.emplace_back(WorkerMain, i);
+}
+
+void ShutdownJobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(jobSystem.sleepMutex);
+        jobSystem.quit = true;
+    }
+    jobSystem.wakeUp.notify_all();
+    for (std::thread& thread : jobSystem.threads)
+        thread.join();
+
+    jobSystem.threads.clear();
+    delete[] jobSystem.queues;
+    delete[] jobSystem.stats;
+    jobSystem.queues = nullptr;
+    jobSystem.stats = nullptr;
+    jobSystem.threadCount = 0;
+    jobSystem.quit = false; // can be initialized again
+}
+
+u32 JobSystemThreadCount()
+{
+    return jobSystem.threadCount;
+}
+
+void RunJob(const JobFunction& function, JobCounter* counter, JobKind kind)
+{
+    if (counter)
+        counter->pending++;
+    PushJob(Job{ function, counter, kind });
+}
+
+void RunJobAfter(JobCounter* dependency, const JobFunction& function, JobCounter* counter, JobKind kind)
+{
+    if (counter)
+        counter->pending++;
+
+    {
+        std::lock_guard<std::mutex> lock(dependency->mutex);
+        if (dependency->pending > 0)
+        {
+            dependency->continuations.push_back(Job{ function, counter, kind });
+            return;
+        }
+    }
+    PushJob(Job{ function, counter, kind });
+}
+
+bool IsJobCounterDone(const JobCounter* counter)
+{
+    return counter->pending == 0;
+}
+
+void WaitForCounter(JobCounter* counter)
+{
+    const u64 waitedBefore = waitMicroseconds;
+    const u64 start = NowMicroseconds();
+
+    while (counter->pending > 0)
+    {
+        Job job;
+        if (FindJob(counter, job))
+        {
+            ExecuteJob(job);
+        }
+        else if (threadIndex == MAIN_THREAD_INDEX || threadIndex == EXTERNAL_THREAD)
+        {
+            // nothing this thread may run, the rest is on the workers
+            std::unique_lock<std::mutex> lock(counter->mutex);
+            counter->done.wait(lock, [&] { return counter->pending == 0; });
+        }
+        else
+        {
+            // the rest runs on the other threads, wake up now and then for
+            // frame jobs pushed meanwhile (continuations, nested ParallelFor)
+            std::unique_lock<std::mutex> lock(counter->mutex);
+            counter->done.wait_for(lock, std::chrono::milliseconds(1), [&] { return counter->pending == 0; });
+        }
+    }
+
+    // the last FinishJob may still hold the lock
+    std::lock_guard<std::mutex> lock(counter->mutex);
+
+    // replaces the nested waits, they are part of this one
+    waitMicroseconds = waitedBefore + (NowMicroseconds() - start);
+}
+
+void ParallelFor(u32 count, u32 batchSize, const std::function<void(u32, u32)>& function)
+{
+    if (count == 0)
+        return;
+
+    if (batchSize == 0)
+        batchSize = 1;
+
+    const u32 batchCount = (count + batchSize - 1) / batchSize;
+    if (batchCount == 1 || jobSystem.threadCount == 0)
+    {
+        // ranges still honour batchSize, callers may size scratch memory by it
+        for (u32 begin = 0; begin < count; begin += batchSize)
+            function(begin, begin + batchSize < count ? begin + batchSize : count);
+        return;
+    }
+
+    // one job per thread, all of them grab batches until there are none left
+    std::atomic<u32> nextBatch{ 0 };
+    auto runBatches = [&]()
+    {
+        for (u32 batch = nextBatch++; batch < batchCount; batch = nextBatch++)
+        {
+            const u32 begin = batch * batchSize;
+            function(begin, begin + batchSize < count ? begin + batchSize : count);
+        }
+    };
+
+    JobCounter counter;
+    const u32 jobCount = batchCount < jobSystem.threadCount ? batchCount : jobSystem.threadCount;
+    for (u32 i = 0; i < jobCount; ++i)
+        RunJob(runBatches, &counter);
+
+    WaitForCounter(&counter);
+}
+
+void SampleJobSystemUtilisation(std::vector<f32>& utilisation)
+{
+    const f64 now = GetTimeSeconds();
+    const f64 elapsedMicroseconds = (now - jobSystem.lastSampleTime) * 1000000.0;
+    jobSystem.lastSampleTime = now;
+
+    utilisation.resize(jobSystem.threadCount);
+    for (u32 i = 0; i < jobSystem.threadCount; ++i)
+    {
+        JobThreadStats& stats = jobSystem.stats[i];
+        const u64 busy = stats.busyMicroseconds;
+        utilisation[i] = elapsedMicroseconds > 0.0 ? (f32)((busy - stats.sampledBusyMicroseconds) / elapsedMicroseconds) : 0.f;
+        stats.sampledBusyMicroseconds = busy;
+    }
+}
@@ -0,0 +1,65 @@
+//
+// job_system.h: Work stealing job system of the platform layer, created in main().
+// Every worker has its own deque: it pops its newest job and steals the
+// oldest ones of the others when it runs out. The main thread owns the GL
+// context, it never steals, it only runs the jobs it pushed itself while
+// it waits for them.
+// Background jobs (asset decoding) only run on idle workers: a thread that
+// waits runs frame jobs and the jobs of the counter it waits on, a long
+// decode never lands in the middle of a frame.
+//
+
+#pragma once
+
+#include "platform.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+typedef std::function<void()> JobFunction;
+
+enum JobKind
+{
+    JobKind_Frame,
+    JobKind_Background,
+};
+
+struct Job
+{
+    JobFunction        function;
+    struct JobCounter* counter;
+    JobKind            kind;
+};
+
+// Fence of a group of jobs, done when pending reaches 0. Jobs pushed with
+// RunJobAfter wait on it without taking a thread.
+struct JobCounter
+{
+    std::atomic<u32>        pending{ 0 };
+    std::mutex              mutex;
+    std::condition_variable done;
+    std::vector<Job>        continuations;
+};
+
+void InitJobSystem(u32 workerCount); // hardware threads - 1 if 0, at least 1
+void ShutdownJobSystem();
+u32  JobSystemThreadCount();         // workers + the main thread
+
+// The counter (optional) is incremented now and decremented when the job is done
+void RunJob(const JobFunction& function, JobCounter* counter = nullptr, JobKind kind = JobKind_Frame);
+void RunJobAfter(JobCounter* dependency, const JobFunction& function, JobCounter* counter = nullptr, JobKind kind = JobKind_Frame);
+
+bool IsJobCounterDone(const JobCounter* counter);
+
+// Runs jobs while waiting, see the header comment for which ones. Blocks
+// on the counter when there is none.
+void WaitForCounter(JobCounter* counter);
+
+// Calls function(begin, end) over [0, count) in ranges of at most batchSize
+// items spread over the threads, returns when every range is done.
+void ParallelFor(u32 count, u32 batchSize, const std::function<void(u32, u32)>& function);
+
+// Fraction of the time every thread (main thread first) spent running jobs
+// since the previous call, the time a job spends waiting is not counted
+void SampleJobSystemUtilisation(std::vector<f32>& utilisation);
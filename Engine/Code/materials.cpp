@@ -0,0 +1,304 @@
+#include "materials.h"
+#include "gl_state.h"
+#include "gl_extensions.h"
+#include "texture_cooker.h"
+
+// Layout of MaterialData in shaders.glsl (std430)
+struct MaterialGpuData
+{
+    vec4 albedoSmoothness;
+    vec4 emissive;
+    u32  textures[4]; // albedo, emissive, specular, normals
+    u32  moreTextures[4]; // bump
+    u64  textureHandles[6]; // bindless handles in the same order, last one unused
+};
+
+static u32 MipLevelCount(ivec2 size)
+{
+    u32 levels = 1;
+    for (i32 maxSize = size.x > size.y ? size.x : size.y; maxSize > 1; maxSize >>= 1)
+        ++levels;
+    return levels;
+}
+
+// A resident handle must not outlive its texture
+static void ReleaseTexture(App* app, Texture& tex)
+{
+    if (tex.bindlessHandle != 0)
+    {
+        glMakeTextureHandleNonResidentARB(tex.bindlessHandle);
+        tex.bindlessHandle = 0;
+    }
+
+    if (tex.handle != 0)
+    {
+        DeleteTexture(app, tex.handle);
+        tex.handle = 0;
+    }
+}
+
+static GLuint CreateTextureArrayStorage(App* app, const TextureArray& array)
+{
+    GLuint handle;
+    glGenTextures(1, &handle);
+    BindTextureUnit(app, 0, GL_TEXTURE_2D_ARRAY, handle);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, MipLevelCount(array.size), array.internalFormat, array.size.x, array.size.y, array.layerCapacity);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    SetCookedTextureSwizzle(GL_TEXTURE_2D_ARRAY, array.internalFormat, array.usage);
+    return handle;
+}
+
+// every mip of layers [firstLayer, firstLayer + layerCount) from src to dst
+static void CopyTextureLayers(GLuint src, GLenum srcTarget, u32 srcLayer, GLuint dst, u32 dstLayer, u32 layerCount, ivec2 size)
+{
+    const u32 levels = MipLevelCount(size);
+    for (u32 level = 0; level < levels; ++level)
+    {
+        i32 w = size.x >> level; if (w < 1) w = 1;
+        i32 h = size.y >> level; if (h < 1) h = 1;
+        glCopyImageSubData(src, srcTarget, level, 0, 0, srcLayer,
+                           dst, GL_TEXTURE_2D_ARRAY, level, 0, 0, dstLayer,
+                           w, h, layerCount);
+    }
+}
+
+static u32 AddTextureArray(App* app, ivec2 size, GLenum internalFormat, TextureUsage usage, bool resampled)
+{
+    TextureArray array = {};
+    array.size = size;
+    array.internalFormat = internalFormat;
+    array.usage = usage;
+    array.layerCapacity = MATERIAL_TEXTURE_ARRAY_MIN_LAYERS;
+    array.resampled = resampled;
+    array.handle = CreateTextureArrayStorage(app, array);
+
+    app->textureArrays.push_back(array);
+    return app->textureArrays.size() - 1;
+}
+
+static void GrowTextureArray(App* app, TextureArray& array)
+{
+    // the existing layers move to a twice as large storage on the gpu
+    GLuint oldHandle = array.handle;
+    array.layerCapacity *= 2;
+    array.handle = CreateTextureArrayStorage(app, array);
+    CopyTextureLayers(oldHandle, GL_TEXTURE_2D_ARRAY, 0, array.handle, 0, array.layerCount, array.size);
+    DeleteTexture(app, oldHandle);
+}
+
+// Array of a texture: the one of its size, format and usage (they may not
+// sample with the same swizzle), a new one while there are free samplers
+// (the last one is kept for the resampled array) and the resampled array
+// otherwise
+static u32 FindTextureArray(App* app, const Texture& tex)
+{
+    u32 resampledArrayIdx = UINT32_MAX;
+    for (u32 arrayIdx = 0; arrayIdx < app->textureArrays.size(); ++arrayIdx)
+    {
+        const TextureArray& array = app->textureArrays[arrayIdx];
+        if (array.resampled)
+            resampledArrayIdx = arrayIdx;
+        else if (array.size == tex.size && array.internalFormat == tex.internalFormat && array.usage == tex.usage)
+            return arrayIdx;
+    }
+
+    const u32 reservedArrays = resampledArrayIdx == UINT32_MAX ? 1 : 0;
+    if (app->textureArrays.size() + reservedArrays < MAX_MATERIAL_TEXTURE_ARRAYS)
+        return AddTextureArray(app, tex.size, tex.internalFormat, tex.usage, false);
+
+    if (resampledArrayIdx == UINT32_MAX)
+    {
+        ILOG("Material texture arrays are full, textures of other sizes/formats are scaled to %dx%d RGBA8", MATERIAL_RESAMPLED_ARRAY_SIZE, MATERIAL_RESAMPLED_ARRAY_SIZE);
+        resampledArrayIdx = AddTextureArray(app, ivec2(MATERIAL_RESAMPLED_ARRAY_SIZE), GL_RGBA8, TextureUsage_Color, true);
+    }
+    return resampledArrayIdx;
+}
+
+// Draws a texture of any size/format into the first level of an array layer
+static void ResampleTextureLayer(App* app, const Texture& tex, const TextureArray& array)
+{
+    static const PipelineState resamplePipeline = { false, false, GL_LESS, true, false, GL_FUNC_ADD, GL_ONE, GL_ZERO, false, GL_BACK };
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    GLuint framebuffer;
+    glGenFramebuffers(1, &framebuffer);
+    BindFramebuffer(app, GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, array.handle, 0, tex.arrayLayer);
+    glViewport(0, 0, array.size.x, array.size.y);
+
+    SetPipelineState(app, resamplePipeline);
+    BindProgram(app, app->programs[app->texturedGeometryProgramIdx].handle);
+    BindTextureUnit(app, 0, GL_TEXTURE_2D, tex.handle);
+    RenderScreenQuad(app->texturedGeometryProgramIdx, app);
+
+    BindFramebuffer(app, GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+// Copies the textures loaded since the last update into their array layers,
+// the 2d textures are released once copied
+static void UpdateTextureArrays(App* app)
+{
+    bool resampledLayers = false;
+
+    for (u32 texIdx = app->textureArraysTextureCount; texIdx < app->textures.size(); ++texIdx)
+    {
+        Texture& tex = app->textures[texIdx];
+
+        const u32 arrayIdx = FindTextureArray(app, tex);
+        TextureArray& array = app->textureArrays[arrayIdx];
+        if (array.layerCount == array.layerCapacity)
+            GrowTextureArray(app, array);
+
+        tex.arrayIdx = arrayIdx;
+        tex.arrayLayer = array.layerCount++;
+
+        if (array.resampled)
+        {
+            ResampleTextureLayer(app, tex, array);
+            resampledLayers = true;
+        }
+        else
+        {
+            CopyTextureLayers(tex.handle, GL_TEXTURE_2D, 0, array.handle, tex.arrayLayer, 1, array.size);
+        }
+
+        ReleaseTexture(app, tex);
+    }
+
+    if (resampledLayers)
+    {
+        // only the first level was drawn
+        for (u32 arrayIdx = 0; arrayIdx < app->textureArrays.size(); ++arrayIdx)
+        {
+            if (!app->textureArrays[arrayIdx].resampled)
+                continue;
+
+            BindTextureUnit(app, 0, GL_TEXTURE_2D_ARRAY, app->textureArrays[arrayIdx].handle);
+            glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        }
+    }
+
+    app->textureArraysTextureCount = app->textures.size();
+}
+
+static void MakeTexturesResident(App* app)
+{
+    for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
+    {
+        Texture& tex = app->textures[texIdx];
+        if (tex.bindlessHandle == 0)
+        {
+            // the texture becomes immutable from here on
+            tex.bindlessHandle = glGetTextureHandleARB(tex.handle);
+            glMakeTextureHandleResidentARB(tex.bindlessHandle);
+        }
+    }
+
+    app->textureArraysTextureCount = app->textures.size();
+}
+
+static const Texture& MaterialTexture(App* app, u32 texIdx)
+{
+    if (texIdx >= app->textures.size())
+        texIdx = app->whiteTexIdx; // missing texture
+    return app->textures[texIdx];
+}
+
+static u32 PackMaterialTexture(App* app, u32 texIdx)
+{
+    const Texture& tex = MaterialTexture(app, texIdx);
+    return (tex.arrayIdx << 16) | tex.arrayLayer;
+}
+
+// Normal maps are optional, a missing one is flagged instead of sampled
+static u32 PackMaterialNormalMap(App* app, u32 texIdx)
+{
+    if (texIdx >= app->textures.size())
+        return UINT32_MAX;
+    return PackMaterialTexture(app, texIdx);
+}
+
+void UpdateMaterialBuffer(App* app)
+{
+    const bool texturesChanged = app->textureArraysTextureCount != app->textures.size();
+    if (!texturesChanged && !app->materialsChanged && app->materialBufferMaterialCount == app->materials.size())
+        return;
+
+    if (texturesChanged)
+    {
+        if (app->bindlessTextures) MakeTexturesResident(app);
+        else                       UpdateTextureArrays(app);
+    }
+
+    if (app->materialBuffer.handle)
+    {
+        glDeleteBuffers(1, &app->materialBuffer.handle);
+    }
+
+    const u32 materialCount = app->materials.size();
+    app->materialBuffer = CreateBuffer((materialCount ? materialCount : 1) * sizeof(MaterialGpuData), GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW);
+
+    MapBuffer(app->materialBuffer, GL_WRITE_ONLY);
+    for (u32 i = 0; i < materialCount; ++i)
+    {
+        const Material& material = app->materials[i];
+
+        MaterialGpuData data = {};
+        data.albedoSmoothness = vec4(material.albedo, material.smoothness);
+        data.emissive = vec4(material.emissive, 0.0f);
+        data.textures[0] = PackMaterialTexture(app, material.albedoTextureIdx);
+        data.textures[1] = PackMaterialTexture(app, material.emissiveTextureIdx);
+        data.textures[2] = PackMaterialTexture(app, material.specularTextureIdx);
+        data.textures[3] = PackMaterialNormalMap(app, material.normalsTextureIdx);
+        data.moreTextures[0] = PackMaterialTexture(app, material.bumpTextureIdx);
+        if (app->bindlessTextures)
+        {
+            data.textureHandles[0] = MaterialTexture(app, material.albedoTextureIdx).bindlessHandle;
+            data.textureHandles[1] = MaterialTexture(app, material.emissiveTextureIdx).bindlessHandle;
+            data.textureHandles[2] = MaterialTexture(app, material.specularTextureIdx).bindlessHandle;
+            data.textureHandles[3] = MaterialTexture(app, material.normalsTextureIdx).bindlessHandle;
+            data.textureHandles[4] = MaterialTexture(app, material.bumpTextureIdx).bindlessHandle;
+        }
+
+        PushData(app->materialBuffer, &data, sizeof(data));
+    }
+    UnmapBuffer(app->materialBuffer);
+
+    app->materialBufferMaterialCount = materialCount;
+    app->materialsChanged = false;
+}
+
+void BindMaterialResources(App* app)
+{
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, app->materialBuffer.handle);
+
+    if (app->bindlessTextures)
+        return; // textures are referenced by resident handles, nothing to bind
+
+    for (u32 arrayIdx = 0; arrayIdx < app->textureArrays.size(); ++arrayIdx)
+    {
+        BindTextureUnit(app, MATERIAL_TEXTURE_ARRAY_UNIT + arrayIdx, GL_TEXTURE_2D_ARRAY, app->textureArrays[arrayIdx].handle);
+    }
+}
+
+void ShutdownMaterials(App* app)
+{
+    for (Texture& tex : app->textures)
+        ReleaseTexture(app, tex);
+
+    for (TextureArray& array : app->textureArrays)
+        DeleteTexture(app, array.handle);
+    app->textureArrays.clear();
+    app->textureArraysTextureCount = 0;
+
+    if (app->materialBuffer.handle)
+        glDeleteBuffers(1, &app->materialBuffer.handle);
+    app->materialBuffer = {};
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "engine.h"
+
+#define MAX_MATERIAL_TEXTURE_ARRAYS 8
+#define MATERIAL_TEXTURE_ARRAY_UNIT 8 // first texture unit of uTextureArrays
+#define MATERIAL_TEXTURE_ARRAY_MIN_LAYERS 4
+#define MATERIAL_RESAMPLED_ARRAY_SIZE 1024 // textures beyond the array limit are scaled to it
+
+void UpdateMaterialBuffer(App* app);
+void BindMaterialResources(App* app);
+
+// Bindless handles made non-resident and material textures deleted, while the context is current
+void ShutdownMaterials(App* app);
@@ -0,0 +1,307 @@
+#include "mesh_cache.h"
+
+#include <stdio.h>
+
+#define MESH_CACHE_MAGIC 0x4853454Du // "MESH"
+
+struct MeshCacheHeader
+{
+    u32 magic;
+    u32 version;
+    u64 sourceTimestamp;
+    u32 importFlags;
+    u32 sourcePathSize; // the path follows the header
+    u32 materialCount;
+    u32 submeshCount;
+    u32 nodeCount;
+    u64 fileSize;       // a file cut short by a crashed write never matches
+};
+
+// one file per import flags, a file imported both baked and instanced keeps both
+static std::string MeshCachePath(const char* filename, u32 importFlags)
+{
+    char flags[16];
+    snprintf(flags, sizeof(flags), ".%08x", importFlags);
+    return std::string(filename) + flags + ".meshcache";
+}
+
+// Writing
+
+static void WriteBytes(std::vector<u8>& out, const void* data, u64 size)
+{
+    out.insert(out.end(), (const u8*)data, (const u8*)data + size);
+}
+
+template <typename T>
+static void WriteValue(std::vector<u8>& out, const T& value)
+{
+    WriteBytes(out, &value, sizeof(T));
+}
+
+static void WriteString(std::vector<u8>& out, const std::string& str)
+{
+    WriteValue(out, (u32)str.size());
+    WriteBytes(out, str.data(), str.size());
+}
+
+template <typename T>
+static void WriteArray(std::vector<u8>& out, const std::vector<T>& values)
+{
+    WriteValue(out, (u32)values.size());
+    WriteBytes(out, values.data(), values.size() * sizeof(T));
+}
+
+void WriteMeshCache(const char* filename, u32 importFlags, const ImportedModel& imported)
+{
+    const Mesh& mesh = imported.mesh;
+
+    MeshCacheHeader header = {};
+    header.magic = MESH_CACHE_MAGIC;
+    header.version = MESH_CACHE_VERSION;
+    header.sourceTimestamp = GetFileLastWriteTimestamp(filename);
+    header.importFlags = importFlags;
+    header.sourcePathSize = strlen(filename);
+    header.materialCount = imported.materials.size();
+    header.submeshCount = mesh.submeshes.size();
+    header.nodeCount = imported.nodes.size();
+
+    std::vector<u8> out;
+    WriteValue(out, header);
+    WriteBytes(out, filename, header.sourcePathSize);
+
+    for (u32 i = 0; i < imported.materials.size(); ++i)
+    {
+        const Material& material = imported.materials[i];
+        WriteString(out, material.name);
+        WriteValue(out, material.albedo);
+        WriteValue(out, material.emissive);
+        WriteValue(out, material.smoothness);
+        for (u32 slot = 0; slot < MATERIAL_TEXTURE_COUNT; ++slot)
+            WriteString(out, imported.texturePaths[i * MATERIAL_TEXTURE_COUNT + slot]);
+    }
+
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        const Submesh& submesh = mesh.submeshes[i];
+        WriteValue(out, imported.submeshMaterials[i]);
+
+        const VertexBufferLayout& layout = submesh.vertexBufferLayout;
+        WriteValue(out, layout.stride);
+        WriteValue(out, (u32)layout.attributes.size());
+        for (const VertexBufferAttribute& attribute : layout.attributes)
+        {
+            WriteValue(out, attribute.location);
+            WriteValue(out, attribute.componentCount);
+            WriteValue(out, attribute.offset);
+            WriteValue(out, (u32)attribute.type);
+            WriteValue(out, (u8)attribute.normalized);
+        }
+
+        WriteValue(out, submesh.positionScale);
+        WriteValue(out, submesh.positionBias);
+        WriteArray(out, submesh.vertices);
+        WriteArray(out, submesh.indices);
+        WriteArray(out, submesh.meshlets);
+
+        const SubmeshGeometryData& geometry = imported.geometry[i];
+        WriteValue(out, (u32)submesh.indexType);
+        WriteValue(out, geometry.positionsSize);
+        WriteBytes(out, geometry.positions, geometry.positionsSize);
+        WriteValue(out, geometry.indicesSize);
+        WriteBytes(out, geometry.indices, geometry.indicesSize);
+    }
+
+    for (const ImportedNode& node : imported.nodes)
+    {
+        WriteValue(out, node.transform.position);
+        WriteValue(out, node.transform.rotation);
+        WriteValue(out, node.transform.scale);
+        WriteValue(out, node.parentIdx);
+        WriteValue(out, node.firstMesh);
+        WriteValue(out, node.meshCount);
+    }
+    WriteArray(out, imported.nodeMeshes);
+
+    ((MeshCacheHeader*)out.data())->fileSize = out.size();
+
+    // a failed write leaves the previous cache, the next import tries again
+    const FileChunk chunk = { out.data(), out.size() };
+    WriteFileAtomically(MeshCachePath(filename, importFlags).c_str(), &chunk, 1);
+}
+
+// Reading, every read is bounds checked against the mapped file
+
+struct MeshCacheReader
+{
+    const u8* cursor;
+    const u8* end;
+    bool      valid;
+};
+
+static const u8* ReadBytes(MeshCacheReader& reader, u64 size)
+{
+    if (!reader.valid || (u64)(reader.end - reader.cursor) < size)
+    {
+        reader.valid = false;
+        return nullptr;
+    }
+    const u8* bytes = reader.cursor;
+    reader.cursor += size;
+    return bytes;
+}
+
+template <typename T>
+static T ReadValue(MeshCacheReader& reader)
+{
+    T value = {};
+    if (const u8* bytes = ReadBytes(reader, sizeof(T)))
+        memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+static void ReadString(MeshCacheReader& reader, std::string& str)
+{
+    const u32 size = ReadValue<u32>(reader);
+    if (const u8* bytes = ReadBytes(reader, size))
+        str.assign((const char*)bytes, size);
+}
+
+template <typename T>
+static void ReadArray(MeshCacheReader& reader, std::vector<T>& values)
+{
+    const u32 count = ReadValue<u32>(reader);
+    if (const u8* bytes = ReadBytes(reader, (u64)count * sizeof(T)))
+    {
+        values.resize(count);
+        if (count)
+            memcpy(values.data(), bytes, (u64)count * sizeof(T));
+    }
+}
+
+static bool ReadMeshCacheContents(const MappedFile& file, const char* filename, u32 importFlags, ImportedModel& imported)
+{
+    MeshCacheReader reader = { file.data, file.data + file.size, true };
+
+    const MeshCacheHeader header = ReadValue<MeshCacheHeader>(reader);
+    if (!reader.valid ||
+        header.magic != MESH_CACHE_MAGIC ||
+        header.version != MESH_CACHE_VERSION ||
+        header.fileSize != file.size ||
+        header.importFlags != importFlags ||
+        header.sourceTimestamp != GetFileLastWriteTimestamp(filename) ||
+        header.sourcePathSize != strlen(filename))
+        return false;
+
+    const u8* sourcePath = ReadBytes(reader, header.sourcePathSize);
+    if (!sourcePath || memcmp(sourcePath, filename, header.sourcePathSize) != 0)
+        return false;
+
+    // every material, submesh and node takes more than a byte, a corrupted count must not size the arrays
+    const u64 remainingSize = reader.end - reader.cursor;
+    if (header.materialCount > remainingSize || header.submeshCount > remainingSize || header.nodeCount > remainingSize)
+        return false;
+
+    imported.materials.resize(header.materialCount);
+    imported.texturePaths.resize(header.materialCount * MATERIAL_TEXTURE_COUNT);
+    for (u32 i = 0; i < header.materialCount; ++i)
+    {
+        Material& material = imported.materials[i];
+        material = Material{};
+        ReadString(reader, material.name);
+        material.albedo = ReadValue<vec3>(reader);
+        material.emissive = ReadValue<vec3>(reader);
+        material.smoothness = ReadValue<f32>(reader);
+        for (u32 slot = 0; slot < MATERIAL_TEXTURE_COUNT; ++slot)
+        {
+            MaterialTextureIdx(material, slot) = UINT32_MAX;
+            ReadString(reader, imported.texturePaths[i * MATERIAL_TEXTURE_COUNT + slot]);
+        }
+    }
+
+    Mesh& mesh = imported.mesh;
+    mesh.submeshes.resize(header.submeshCount);
+    imported.submeshMaterials.resize(header.submeshCount);
+    imported.geometry.resize(header.submeshCount);
+    for (u32 i = 0; i < header.submeshCount; ++i)
+    {
+        Submesh& submesh = mesh.submeshes[i];
+        imported.submeshMaterials[i] = ReadValue<u32>(reader);
+
+        VertexBufferLayout& layout = submesh.vertexBufferLayout;
+        layout.stride = ReadValue<u8>(reader);
+        const u32 attributeCount = ReadValue<u32>(reader);
+        for (u32 a = 0; a < attributeCount && reader.valid; ++a)
+        {
+            VertexBufferAttribute attribute;
+            attribute.location = ReadValue<u8>(reader);
+            attribute.componentCount = ReadValue<u8>(reader);
+            attribute.offset = ReadValue<u8>(reader);
+            attribute.type = ReadValue<u32>(reader);
+            attribute.normalized = ReadValue<u8>(reader) != 0;
+            layout.attributes.push_back(attribute);
+        }
+
+        submesh.positionScale = ReadValue<vec3>(reader);
+        submesh.positionBias = ReadValue<vec3>(reader);
+        ReadArray(reader, submesh.vertices);
+        ReadArray(reader, submesh.indices);
+        ReadArray(reader, submesh.meshlets);
+
+        // uploaded straight from the mapping
+        SubmeshGeometryData& geometry = imported.geometry[i];
+        submesh.indexType = ReadValue<u32>(reader);
+        geometry.positionsSize = ReadValue<u32>(reader);
+        geometry.positions = ReadBytes(reader, geometry.positionsSize);
+        geometry.indicesSize = ReadValue<u32>(reader);
+        geometry.indices = ReadBytes(reader, geometry.indicesSize);
+    }
+
+    imported.nodes.resize(header.nodeCount);
+    for (u32 i = 0; i < header.nodeCount; ++i)
+    {
+        ImportedNode& node = imported.nodes[i];
+        node.transform.position = ReadValue<vec3>(reader);
+        node.transform.rotation = ReadValue<quat>(reader);
+        node.transform.scale = ReadValue<vec3>(reader);
+        node.parentIdx = ReadValue<u32>(reader);
+        node.firstMesh = ReadValue<u32>(reader);
+        node.meshCount = ReadValue<u32>(reader);
+    }
+    ReadArray(reader, imported.nodeMeshes);
+
+    // the loader indexes with them unchecked
+    for (u32 i = 0; i < header.nodeCount; ++i)
+    {
+        const ImportedNode& node = imported.nodes[i];
+        if ((node.parentIdx >= i && node.parentIdx != UINT32_MAX) ||
+            (u64)node.firstMesh + node.meshCount > imported.nodeMeshes.size())
+            return false;
+    }
+    for (u32 submeshIdx : imported.nodeMeshes)
+    {
+        if (submeshIdx >= header.submeshCount)
+            return false;
+    }
+
+    return reader.valid && reader.cursor == reader.end;
+}
+
+bool ReadMeshCache(const char* filename, u32 importFlags, ImportedModel& imported)
+{
+    const std::string cachePath = MeshCachePath(filename, importFlags);
+    MappedFile file = MapFile(cachePath.c_str());
+    if (!file.data)
+        return false;
+
+    const bool valid = ReadMeshCacheContents(file, filename, importFlags, imported);
+    if (!valid)
+    {
+        ILOG("Mesh cache %s is stale, importing %s again", cachePath.c_str(), filename);
+        UnmapFile(file);
+        imported = ImportedModel{};
+        return false;
+    }
+
+    imported.cacheFile = file;
+    return true;
+}
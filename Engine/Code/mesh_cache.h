@@ -0,0 +1,17 @@
+#pragma once
+
+#include "assimp_model_loading.h"
+
+// Bump whenever the importer output changes: vertex compression, the
+// optimizer, meshlets or any of the serialized structs
+#define MESH_CACHE_VERSION 4
+
+// Prepared imports (see ImportPreparedModel) are saved next to the source
+// file as <source>.<import flags>.meshcache: a header keyed on the source
+// path, its last write time and the import flags, then the materials and,
+// per submesh, its vertex layout, bounds and raw vertex/index/meshlet blobs
+// followed by the gpu streams (see SubmeshGeometryData), then the node table
+// of instanced imports. A read keeps the file mapped, the
+// streams of the import point into it. Any thread can read and write them.
+bool ReadMeshCache(const char* filename, u32 importFlags, ImportedModel& imported);
+void WriteMeshCache(const char* filename, u32 importFlags, const ImportedModel& imported);
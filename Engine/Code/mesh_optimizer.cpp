@@ -0,0 +1,296 @@
+#include "mesh_optimizer.h"
+#include "vertex_compression.h"
+
+#include <algorithm>
+
+// Forsyth scoring, values from "Linear-Speed Vertex Cache Optimisation"
+#define FORSYTH_CACHE_SIZE      32
+#define FORSYTH_CACHE_DECAY     1.5f
+#define FORSYTH_LAST_TRI_SCORE  0.75f
+#define FORSYTH_VALENCE_SCALE   2.f
+#define FORSYTH_VALENCE_POWER   0.5f
+
+static float ForsythVertexScore(i32 cachePosition, u32 remainingTriangles)
+{
+    if (remainingTriangles == 0)
+        return -1.f; // not needed anymore
+
+    float score = 0.f;
+    if (cachePosition >= 0)
+    {
+        if (cachePosition < 3)
+        {
+            // used by the last triangle, fixed score so it is not favoured too much
+            score = FORSYTH_LAST_TRI_SCORE;
+        }
+        else
+        {
+            const float scaler = 1.f / (FORSYTH_CACHE_SIZE - 3);
+            score = std::pow(1.f - (cachePosition - 3) * scaler, FORSYTH_CACHE_DECAY);
+        }
+    }
+
+    // favour vertices with few triangles left so they leave the mesh early
+    score += FORSYTH_VALENCE_SCALE * std::pow((float)remainingTriangles, -FORSYTH_VALENCE_POWER);
+    return score;
+}
+
+static void OptimizeVertexCache(std::vector<u32>& indices, u32 vertexCount)
+{
+    const u32 triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    // vertex -> triangles adjacency
+    std::vector<u32> vertexTriangleOffset(vertexCount + 1, 0);
+    for (u32 i = 0; i < triangleCount * 3; ++i)
+        vertexTriangleOffset[indices[i] + 1]++;
+    for (u32 v = 0; v < vertexCount; ++v)
+        vertexTriangleOffset[v + 1] += vertexTriangleOffset[v];
+
+    std::vector<u32> vertexTriangles(triangleCount * 3);
+    std::vector<u32> vertexRemaining(vertexCount, 0);
+    for (u32 i = 0; i < triangleCount * 3; ++i)
+    {
+        const u32 v = indices[i];
+        vertexTriangles[vertexTriangleOffset[v] + vertexRemaining[v]++] = i / 3;
+    }
+
+    std::vector<i32>   vertexCachePosition(vertexCount, -1);
+    std::vector<float> vertexScore(vertexCount);
+    for (u32 v = 0; v < vertexCount; ++v)
+        vertexScore[v] = ForsythVertexScore(-1, vertexRemaining[v]);
+
+    std::vector<float> triangleScore(triangleCount);
+    std::vector<bool>  triangleEmitted(triangleCount, false);
+    for (u32 t = 0; t < triangleCount; ++t)
+        triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+    std::vector<u32> output;
+    output.reserve(indices.size());
+
+    u32 cache[FORSYTH_CACHE_SIZE + 3];
+    u32 cacheCount = 0;
+    u32 nextCandidate = 0; // for when the cache does not reach any pending triangle
+
+    i32 bestTriangle = -1;
+    for (u32 emitted = 0; emitted < triangleCount; ++emitted)
+    {
+        if (bestTriangle < 0)
+        {
+            while (triangleEmitted[nextCandidate])
+                ++nextCandidate;
+            bestTriangle = nextCandidate;
+        }
+
+        // emit the triangle, its vertices go to the front of the lru cache
+        const u32* triangle = &indices[bestTriangle * 3];
+        triangleEmitted[bestTriangle] = true;
+
+        u32 newCache[FORSYTH_CACHE_SIZE + 3];
+        u32 newCacheCount = 0;
+        for (u32 k = 0; k < 3; ++k)
+        {
+            const u32 v = triangle[k];
+            output.push_back(v);
+            newCache[newCacheCount++] = v;
+
+            // remove the triangle from the vertex adjacency
+            u32* begin = &vertexTriangles[vertexTriangleOffset[v]];
+            u32* end = begin + vertexRemaining[v];
+            *std::find(begin, end, (u32)bestTriangle) = *(end - 1);
+            vertexRemaining[v]--;
+        }
+        for (u32 i = 0; i < cacheCount; ++i)
+        {
+            const u32 v = cache[i];
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                newCache[newCacheCount++] = v;
+        }
+
+        // update the scores of the vertices that moved in the cache or fell out of it
+        for (u32 i = 0; i < newCacheCount; ++i)
+        {
+            const u32 v = newCache[i];
+            vertexCachePosition[v] = i < FORSYTH_CACHE_SIZE ? (i32)i : -1;
+            vertexScore[v] = ForsythVertexScore(vertexCachePosition[v], vertexRemaining[v]);
+        }
+
+        // pick the best pending triangle touching the cache
+        bestTriangle = -1;
+        float bestScore = -1.f;
+        for (u32 i = 0; i < newCacheCount; ++i)
+        {
+            const u32 v = newCache[i];
+            for (u32 j = 0; j < vertexRemaining[v]; ++j)
+            {
+                const u32 t = vertexTriangles[vertexTriangleOffset[v] + j];
+                const u32* tri = &indices[t * 3];
+                triangleScore[t] = vertexScore[tri[0]] + vertexScore[tri[1]] + vertexScore[tri[2]];
+                if (triangleScore[t] > bestScore)
+                {
+                    bestScore = triangleScore[t];
+                    bestTriangle = t;
+                }
+            }
+        }
+
+        cacheCount = newCacheCount < FORSYTH_CACHE_SIZE ? newCacheCount : FORSYTH_CACHE_SIZE;
+        memcpy(cache, newCache, cacheCount * sizeof(u32));
+    }
+
+    indices.swap(output);
+}
+
+// Splits the cache optimized triangles in clusters where the fifo cache
+// restarts (triangles with 3 misses) and sorts the clusters so the ones
+// facing away from the mesh center are drawn first, they are the most
+// likely to occlude the rest. The order inside clusters is untouched.
+static void OptimizeOverdraw(const Submesh& submesh, std::vector<u32>& indices, u32 vertexCount)
+{
+    const u32 triangleCount = indices.size() / 3;
+    if (triangleCount == 0)
+        return;
+
+    std::vector<u32> clusterFirstTriangle;
+    std::vector<u32> cacheTimestamp(vertexCount, 0);
+    u32 timestamp = VERTEX_CACHE_SIZE + 1;
+
+    for (u32 t = 0; t < triangleCount; ++t)
+    {
+        u32 misses = 0;
+        for (u32 k = 0; k < 3; ++k)
+        {
+            const u32 v = indices[t * 3 + k];
+            if (timestamp - cacheTimestamp[v] > VERTEX_CACHE_SIZE)
+            {
+                cacheTimestamp[v] = timestamp++;
+                misses++;
+            }
+        }
+        if (t == 0 || misses == 3)
+            clusterFirstTriangle.push_back(t);
+    }
+    clusterFirstTriangle.push_back(triangleCount);
+
+    const u32 clusterCount = clusterFirstTriangle.size() - 1;
+    if (clusterCount < 2)
+        return;
+
+    // mesh centroid, area weighted
+    std::vector<vec3> triangleCentroid(triangleCount);
+    std::vector<vec3> triangleNormal(triangleCount); // not normalized, length is twice the area
+    vec3 meshCentroid(0.f);
+    float meshArea = 0.f;
+    for (u32 t = 0; t < triangleCount; ++t)
+    {
+        const vec3 a = ReadVertexPosition(submesh, indices[t * 3]);
+        const vec3 b = ReadVertexPosition(submesh, indices[t * 3 + 1]);
+        const vec3 c = ReadVertexPosition(submesh, indices[t * 3 + 2]);
+        triangleCentroid[t] = (a + b + c) / 3.f;
+        triangleNormal[t] = cross(b - a, c - a);
+
+        const float area = length(triangleNormal[t]);
+        meshCentroid += triangleCentroid[t] * area;
+        meshArea += area;
+    }
+    meshCentroid /= meshArea > 0.f ? meshArea : 1.f;
+
+    std::vector<float> clusterSortKey(clusterCount);
+    for (u32 c = 0; c < clusterCount; ++c)
+    {
+        vec3 centroid(0.f), normal(0.f);
+        float area = 0.f;
+        for (u32 t = clusterFirstTriangle[c]; t < clusterFirstTriangle[c + 1]; ++t)
+        {
+            const float triangleArea = length(triangleNormal[t]);
+            centroid += triangleCentroid[t] * triangleArea;
+            normal += triangleNormal[t];
+            area += triangleArea;
+        }
+        centroid /= area > 0.f ? area : 1.f;
+
+        const float normalLength = length(normal);
+        clusterSortKey[c] = normalLength > 0.f ? dot(centroid - meshCentroid, normal / normalLength) : 0.f;
+    }
+
+    std::vector<u32> clusterOrder(clusterCount);
+    for (u32 c = 0; c < clusterCount; ++c)
+        clusterOrder[c] = c;
+    std::stable_sort(clusterOrder.begin(), clusterOrder.end(), [&](u32 a, u32 b) { return clusterSortKey[a] > clusterSortKey[b]; });
+
+    std::vector<u32> output;
+    output.reserve(indices.size());
+    for (u32 c : clusterOrder)
+        output.insert(output.end(), indices.begin() + clusterFirstTriangle[c] * 3, indices.begin() + clusterFirstTriangle[c + 1] * 3);
+
+    indices.swap(output);
+}
+
+// Renumbers the vertices in the order the indices first reference them
+static void OptimizeVertexFetch(Submesh& submesh, std::vector<u32>& indices, u32 vertexCount)
+{
+    const u32 stride = submesh.vertexBufferLayout.stride;
+
+    std::vector<u32> remap(vertexCount, UINT32_MAX);
+    std::vector<u8> vertices;
+    vertices.reserve(submesh.vertices.size());
+
+    u32 newVertexCount = 0;
+    for (u32 i = 0; i < indices.size(); ++i)
+    {
+        const u32 v = indices[i];
+        if (remap[v] == UINT32_MAX)
+        {
+            remap[v] = newVertexCount++;
+            vertices.insert(vertices.end(), submesh.vertices.begin() + v * stride, submesh.vertices.begin() + (v + 1) * stride);
+        }
+        indices[i] = remap[v];
+    }
+
+    // unreferenced vertices are dropped
+    submesh.vertices.swap(vertices);
+}
+
+VertexCacheStats AnalyzeVertexCache(const std::vector<u32>& indices, u32 vertexCount)
+{
+    VertexCacheStats stats = {};
+    if (indices.empty() || vertexCount == 0)
+        return stats;
+
+    std::vector<u32> cacheTimestamp(vertexCount, 0);
+    u32 timestamp = VERTEX_CACHE_SIZE + 1;
+    u32 misses = 0;
+
+    for (u32 i = 0; i < indices.size(); ++i)
+    {
+        const u32 v = indices[i];
+        if (timestamp - cacheTimestamp[v] > VERTEX_CACHE_SIZE)
+        {
+            cacheTimestamp[v] = timestamp++;
+            misses++;
+        }
+    }
+
+    stats.acmr = (f32)misses / (indices.size() / 3);
+    stats.atvr = (f32)misses / vertexCount;
+    return stats;
+}
+
+void OptimizeSubmeshGeometry(Submesh& submesh)
+{
+    const u32 vertexCount = SubmeshVertexCount(submesh);
+    std::vector<u32>& indices = submesh.indices;
+    if (indices.size() < 3)
+        return;
+
+    const VertexCacheStats before = AnalyzeVertexCache(indices, vertexCount);
+
+    OptimizeVertexCache(indices, vertexCount);
+    OptimizeOverdraw(submesh, indices, vertexCount);
+    OptimizeVertexFetch(submesh, indices, vertexCount);
+
+    const VertexCacheStats after = AnalyzeVertexCache(indices, SubmeshVertexCount(submesh));
+    ILOG("Mesh optimization (%u vertices, %u triangles): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f",
+         vertexCount, (u32)indices.size() / 3, before.acmr, after.acmr, before.atvr, after.atvr);
+}
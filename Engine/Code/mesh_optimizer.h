@@ -0,0 +1,19 @@
+#pragma once
+
+#include "engine.h"
+
+#define VERTEX_CACHE_SIZE 32 // fifo entries used for the metrics and the overdraw clusters
+
+// Post-transform cache statistics of an index buffer with a fifo cache of VERTEX_CACHE_SIZE
+struct VertexCacheStats
+{
+    f32 acmr; // average cache miss ratio: transformed vertices per triangle (0.5 best, 3 worst)
+    f32 atvr; // average transformed vertex ratio: transformed vertices per vertex (1 best)
+};
+
+VertexCacheStats AnalyzeVertexCache(const std::vector<u32>& indices, u32 vertexCount);
+
+// Reorders the triangles of a submesh for the post-transform vertex cache
+// (Forsyth), then reorders clusters of those triangles to reduce overdraw
+// and finally renumbers the vertices in first-use order for fetch locality.
+void OptimizeSubmeshGeometry(Submesh& submesh);
@@ -0,0 +1,280 @@
+#include "meshlets.h"
+#include "gl_state.h"
+#include "vertex_compression.h"
+#include "static_batching.h"
+
+static void FinishMeshlet(Submesh& submesh, const std::vector<u32>& meshletVertices, u32 indexOffset, u32 indexCount)
+{
+    Meshlet meshlet = {};
+    meshlet.indexOffset = indexOffset;
+    meshlet.indexCount = indexCount;
+
+    // bounding sphere centered on the aabb
+    vec3 aabbMin = ReadVertexPosition(submesh, meshletVertices[0]);
+    vec3 aabbMax = aabbMin;
+    for (u32 i = 1; i < meshletVertices.size(); ++i)
+    {
+        vec3 p = ReadVertexPosition(submesh, meshletVertices[i]);
+        aabbMin = min(aabbMin, p);
+        aabbMax = max(aabbMax, p);
+    }
+
+    meshlet.center = (aabbMin + aabbMax) * 0.5f;
+    for (u32 i = 0; i < meshletVertices.size(); ++i)
+    {
+        meshlet.radius = std::fmaxf(meshlet.radius, length(ReadVertexPosition(submesh, meshletVertices[i]) - meshlet.center));
+    }
+
+    // normal cone: axis is the average triangle normal, the half angle
+    // is given by the triangle normal that deviates the most from it
+    std::vector<vec3> normals;
+    normals.reserve(indexCount / 3);
+    vec3 normalSum(0.f);
+
+    for (u32 i = indexOffset; i < indexOffset + indexCount; i += 3)
+    {
+        vec3 a = ReadVertexPosition(submesh, submesh.indices[i]);
+        vec3 b = ReadVertexPosition(submesh, submesh.indices[i + 1]);
+        vec3 c = ReadVertexPosition(submesh, submesh.indices[i + 2]);
+        vec3 n = cross(b - a, c - a);
+
+        float area = length(n);
+        if (area < 1e-12f)
+            continue; // degenerate triangle, no facing
+
+        n /= area;
+        normals.push_back(n);
+        normalSum += n;
+    }
+
+    meshlet.coneCutoff = 2.f; // disabled until proven otherwise
+
+    float axisLength = length(normalSum);
+    if (!normals.empty() && axisLength > 1e-6f)
+    {
+        meshlet.coneAxis = normalSum / axisLength;
+
+        float minDot = 1.f;
+        for (u32 i = 0; i < normals.size(); ++i)
+            minDot = std::fminf(minDot, dot(meshlet.coneAxis, normals[i]));
+
+        // a cone wider than a hemisphere always has a triangle facing the camera
+        if (minDot > 0.f)
+            meshlet.coneCutoff = std::sqrt(1.f - minDot * minDot);
+    }
+
+    submesh.meshlets.push_back(meshlet);
+}
+
+void BuildSubmeshMeshlets(Submesh& submesh)
+{
+    submesh.meshlets.clear();
+
+    const u32 vertexCount = SubmeshVertexCount(submesh);
+
+    if (vertexCount == 0 || submesh.indices.size() < 3)
+        return;
+
+    // stamp of the meshlet that last referenced each vertex
+    std::vector<u32> vertexStamp(vertexCount, UINT32_MAX);
+    std::vector<u32> meshletVertices;
+    meshletVertices.reserve(MESHLET_MAX_VERTICES);
+
+    u32 meshletIndexOffset = 0;
+    u32 meshletTriangleCount = 0;
+
+    // triangles are grouped in index order, which keeps the
+    // cache locality already given to the index list by the importers
+    for (u32 i = 0; i + 2 < submesh.indices.size(); i += 3)
+    {
+        const u32* triangle = &submesh.indices[i];
+        const u32 stamp = (u32)submesh.meshlets.size();
+
+        u32 newVertexCount = 0;
+        for (u32 k = 0; k < 3; ++k)
+        {
+            bool repeated = (k > 0 && triangle[k] == triangle[0]) || (k > 1 && triangle[k] == triangle[1]);
+            if (vertexStamp[triangle[k]] != stamp && !repeated)
+                newVertexCount++;
+        }
+
+        if (meshletVertices.size() + newVertexCount > MESHLET_MAX_VERTICES || meshletTriangleCount == MESHLET_MAX_TRIANGLES)
+        {
+            FinishMeshlet(submesh, meshletVertices, meshletIndexOffset, i - meshletIndexOffset);
+
+            meshletVertices.clear();
+            meshletIndexOffset = i;
+            meshletTriangleCount = 0;
+        }
+
+        const u32 currentStamp = (u32)submesh.meshlets.size();
+        for (u32 k = 0; k < 3; ++k)
+        {
+            if (vertexStamp[triangle[k]] != currentStamp)
+            {
+                vertexStamp[triangle[k]] = currentStamp;
+                meshletVertices.push_back(triangle[k]);
+            }
+        }
+        meshletTriangleCount++;
+    }
+
+    if (meshletTriangleCount > 0)
+    {
+        FinishMeshlet(submesh, meshletVertices, meshletIndexOffset, meshletTriangleCount * 3);
+    }
+}
+
+static void UploadMeshletBuffer(App* app)
+{
+    // gather the meshlets of every mesh loaded so far in one storage buffer
+    u32 meshletCount = 0;
+    for (u32 meshIdx = 0; meshIdx < app->meshes.size(); ++meshIdx)
+    {
+        Mesh& mesh = app->meshes[meshIdx];
+        mesh.meshletCount = 0;
+
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            Submesh& submesh = mesh.submeshes[i];
+            submesh.firstMeshlet = meshletCount;
+            submesh.meshletCommandOffset = mesh.meshletCount;
+            mesh.meshletCount += submesh.meshlets.size();
+            meshletCount += submesh.meshlets.size();
+        }
+    }
+
+    // std430 Meshlet { vec4 sphere; vec4 cone; uvec4 range; }
+    const u32 meshletGpuSize = 3 * sizeof(vec4);
+
+    if (app->meshletBuffer.handle)
+        glDeleteBuffers(1, &app->meshletBuffer.handle);
+    app->meshletBuffer = CreateBuffer((meshletCount ? meshletCount : 1) * meshletGpuSize, GL_SHADER_STORAGE_BUFFER, GL_STATIC_DRAW);
+
+    MapBuffer(app->meshletBuffer, GL_WRITE_ONLY);
+    for (u32 meshIdx = 0; meshIdx < app->meshes.size(); ++meshIdx)
+    {
+        for (const Submesh& submesh : app->meshes[meshIdx].submeshes)
+        {
+            for (const Meshlet& m : submesh.meshlets)
+            {
+                vec4 sphere(m.center, m.radius);
+                vec4 cone(m.coneAxis, m.coneCutoff);
+                uvec4 range(m.indexOffset, m.indexCount, 0, 0);
+                PushVec4(app->meshletBuffer, sphere);
+                PushVec4(app->meshletBuffer, cone);
+                PushAlignedData(app->meshletBuffer, value_ptr(range), sizeof(range), sizeof(vec4));
+            }
+        }
+    }
+    UnmapBuffer(app->meshletBuffer);
+
+    app->meshletCount = meshletCount;
+    app->meshletBufferMeshCount = app->meshes.size();
+}
+
+void InvalidateMeshletBuffer(App* app)
+{
+    app->meshletBufferMeshCount = 0;
+}
+
+void MeshletCullingPass(App* app)
+{
+    if (app->meshletBufferMeshCount != app->meshes.size())
+        UploadMeshletBuffer(app);
+
+    // every entity gets a command range with room for all its meshlets
+    u32 commandCount = 0;
+    Entities& entities = app->entities;
+    for (u32 idx = 0; idx < entities.count; ++idx)
+    {
+        entities.meshletCommandOffsets[idx] = commandCount;
+        if (entities.modelIndices[idx] != ENTITY_NO_MODEL)
+            commandCount += app->meshes[app->models[entities.modelIndices[idx]].meshIdx].meshletCount;
+    }
+
+    if (commandCount == 0)
+        return;
+
+    const u32 commandBufferSize = commandCount * sizeof(DrawElementsIndirectCommand);
+    if (commandBufferSize > app->meshletCommandBuffer.size)
+    {
+        if (app->meshletCommandBuffer.handle)
+        {
+            glDeleteBuffers(1, &app->meshletCommandBuffer.handle);
+            glDeleteBuffers(1, &app->meshletDrawCountBuffer.handle);
+        }
+        app->meshletCommandBuffer = CreateBuffer(commandBufferSize * 2, GL_DRAW_INDIRECT_BUFFER, GL_DYNAMIC_DRAW);
+        app->meshletDrawCountBuffer = CreateBuffer(commandCount * 2 * sizeof(u32), GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW);
+    }
+
+    // commands past the visible ones must draw nothing
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->meshletCommandBuffer.handle);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->meshletDrawCountBuffer.handle);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    Program& cullProgram = app->programs[app->meshletCullingProgramIdx];
+    BindProgram(app, cullProgram.handle);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(0), app->meshletBuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(1), app->meshletCommandBuffer.handle);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BINDING(2), app->meshletDrawCountBuffer.handle);
+
+    // world space frustum planes
+    vec4 frustumPlanes[6];
+    ExtractFrustumPlanes(app->frame.projection * app->frame.view, frustumPlanes);
+
+    vec3 cameraPosition = vec3(inverse(app->frame.view)[3]);
+
+    glUniform4fv(UniformLocation(cullProgram, "uFrustumPlanes"), 6, &frustumPlanes[0][0]);
+    glUniform3fv(UniformLocation(cullProgram, "uCameraPosition"), 1, &cameraPosition[0]);
+
+    // every visible entity submesh in one dispatch, a workgroup each
+    std::vector<MeshletCullJob>& jobs = app->meshletCullJobs;
+    jobs.clear();
+    for (u32 idx = 0; idx < app->frame.entityCount; ++idx)
+    {
+        if (!app->frame.visible[idx] || !ShouldDrawEntity(app, idx))
+            continue;
+
+        const Mesh& mesh = app->meshes[app->models[entities.modelIndices[idx]].meshIdx];
+        for (const Submesh& submesh : mesh.submeshes)
+        {
+            if (submesh.meshlets.empty())
+                continue;
+
+            MeshletCullJob job = {};
+            job.entityIdx = idx;
+            job.firstMeshlet = submesh.firstMeshlet;
+            job.meshletCount = submesh.meshlets.size();
+            job.firstCommand = entities.meshletCommandOffsets[idx] + submesh.meshletCommandOffset;
+            job.firstIndex = submesh.firstIndex;
+            job.baseVertex = submesh.baseVertex;
+            jobs.push_back(job);
+        }
+    }
+
+    if (!jobs.empty())
+    {
+        const u32 jobBufferSize = jobs.size() * sizeof(MeshletCullJob);
+        if (jobBufferSize > app->meshletCullJobBuffer.size)
+        {
+            if (app->meshletCullJobBuffer.handle)
+                glDeleteBuffers(1, &app->meshletCullJobBuffer.handle);
+            app->meshletCullJobBuffer = CreateBuffer(jobBufferSize * 2, GL_SHADER_STORAGE_BUFFER, GL_DYNAMIC_DRAW);
+        }
+
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, app->meshletCullJobBuffer.handle);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, jobBufferSize, jobs.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        // world matrices come from the entity transforms ssbo, already bound
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESHLET_CULL_JOBS_BINDING, app->meshletCullJobBuffer.handle);
+        glDispatchCompute(jobs.size(), 1, 1);
+    }
+
+    // draw commands are read by the following passes
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
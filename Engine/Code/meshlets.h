@@ -0,0 +1,24 @@
+#pragma once
+
+#include "engine.h"
+
+#define MESHLET_MAX_VERTICES  64
+#define MESHLET_MAX_TRIANGLES 124
+#define MESHLET_CULL_JOBS_BINDING 7 // ssbo of MeshletCullJob
+
+// Layout of the commands consumed by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand
+{
+    u32 count;
+    u32 instanceCount;
+    u32 firstIndex;
+    i32 baseVertex;
+    u32 baseInstance;
+};
+
+void BuildSubmeshMeshlets(Submesh& submesh);
+void MeshletCullingPass(App* app);
+
+// The meshlet buffer is gathered again before the next culling pass, for
+// meshes filled in place (it follows new meshes by itself)
+void InvalidateMeshletBuffer(App* app);
@@ -1,42 +1,25 @@
 #include "model_loading.h"
+#include "geometry_arena.h"
+#include "meshlets.h"
+#include "mesh_optimizer.h"
 
-void LoadMeshGlBuffers(Mesh& mesh)
+void PrepareMeshGeometry(Mesh& mesh)
 {
-    u32 vertexBufferSize = 0;
-    u32 indexBufferSize = 0;
-
     for (u32 i = 0; i < mesh.submeshes.size(); ++i)
     {
-        vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-        indexBufferSize += mesh.submeshes[i].indices.size() * sizeof(u32);
-    }
+        Submesh& submesh = mesh.submeshes[i];
 
-    glGenBuffers(1, &mesh.vertexBufferHandle);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-    glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
-
-    glGenBuffers(1, &mesh.indexBufferHandle);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
+        OptimizeSubmeshGeometry(submesh);
+        BuildSubmeshMeshlets(submesh);
+    }
+}
 
-    u32 indicesOffset = 0;
-    u32 verticesOffset = 0;
+void LoadMeshGlBuffers(App* app, Mesh& mesh)
+{
+    PrepareMeshGeometry(mesh);
 
     for (u32 i = 0; i < mesh.submeshes.size(); ++i)
     {
-        const void* verticesData = mesh.submeshes[i].vertices.data();
-        const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-        glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-        mesh.submeshes[i].vertexOffset = verticesOffset;
-        verticesOffset += verticesSize;
-
-        const void* indicesData = mesh.submeshes[i].indices.data();
-        const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-        mesh.submeshes[i].indexOffset = indicesOffset;
-        indicesOffset += indicesSize;
+        AllocateSubmeshGeometry(app, mesh.submeshes[i]);
     }
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-}
\ No newline at end of file
+}
@@ -2,4 +2,7 @@
 
 #include "engine.h"
 
-void LoadMeshGlBuffers(Mesh& mesh);
+// Cpu side of LoadMeshGlBuffers (vertex cache optimization, meshlets), any thread can run it
+void PrepareMeshGeometry(Mesh& mesh);
+
+void LoadMeshGlBuffers(App* app, Mesh& mesh);
\ No newline at end of file
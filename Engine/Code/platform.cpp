@@ -16,6 +16,9 @@
 #endif
 
 #include "engine.h"
+#include "job_system.h"
+#include "resource_loader.h"
+#include "materials.h"
 
 #include <GLFW/glfw3.h>
 #include <stdio.h>
@@ -31,6 +34,9 @@
 u8* GlobalFrameArenaMemory = NULL;
 u32 GlobalFrameArenaHead = 0;
 
+// Hidden window whose context shares objects with the main one, owned by the loader thread
+GLFWwindow* LoaderWindow = NULL;
+
 void OnGlfwError(int errorCode, const char *errorMessage)
 {
 	fprintf(stderr, "glfw failed with error %d: %s\n", errorCode, errorMessage);
@@ -43,6 +49,8 @@ void OnGlfwMouseMoveEvent(GLFWwindow* window, double xpos, double ypos)
     app->input.mouseDelta.y = ypos - app->input.mousePos.y;
     app->input.mousePos.x = xpos;
     app->input.mousePos.y = ypos;
+
+    PushInputEvent(app->inputQueue, InputEvent{ INPUT_EVENT_MOUSE_MOVE, 0, BUTTON_IDLE, app->input.mousePos, glm::vec2(0.0f) });
 }
 
 void OnGlfwMouseEvent(GLFWwindow* window, int button, int event, int modifiers)
@@ -61,11 +69,25 @@ void OnGlfwMouseEvent(GLFWwindow* window, int button, int event, int modifiers)
                 case GLFW_MOUSE_BUTTON_LEFT:  app->input.mouseButtons[LEFT]  = BUTTON_RELEASE; break;
             } break;
     }
+
+    // presses over ImGui windows don't reach the simulation, releases always do
+    const bool captured = event == GLFW_PRESS && ImGui::GetIO().WantCaptureMouse;
+    if (!captured && (button == GLFW_MOUSE_BUTTON_LEFT || button == GLFW_MOUSE_BUTTON_RIGHT) && event != GLFW_REPEAT)
+    {
+        const u32 code = button == GLFW_MOUSE_BUTTON_LEFT ? LEFT : RIGHT;
+        PushInputEvent(app->inputQueue, InputEvent{ INPUT_EVENT_MOUSE_BUTTON, code, event == GLFW_PRESS ? BUTTON_PRESS : BUTTON_RELEASE, app->input.mousePos, glm::vec2(0.0f) });
+    }
 }
 
 void OnGlfwScrollEvent(GLFWwindow* window, double xoffset, double yoffset)
 {
-    // Nothing do yet... maybe zoom in/out in the future?
+    App* app = (App*)glfwGetWindowUserPointer(window);
+    app->input.mouseScroll.x += xoffset;
+    app->input.mouseScroll.y += yoffset;
+
+    // Nothing uses it yet... maybe zoom in/out in the future?
+    if (!ImGui::GetIO().WantCaptureMouse)
+        PushInputEvent(app->inputQueue, InputEvent{ INPUT_EVENT_MOUSE_SCROLL, 0, BUTTON_IDLE, app->input.mousePos, glm::vec2(xoffset, yoffset) });
 }
 
 void OnGlfwKeyboardEvent(GLFWwindow* window, int key, int scancode, int action, int mods)
@@ -95,6 +117,10 @@ void OnGlfwKeyboardEvent(GLFWwindow* window, int key, int scancode, int action,
         case GLFW_PRESS:   app->input.keys[key] = BUTTON_PRESS; break;
         case GLFW_RELEASE: app->input.keys[key] = BUTTON_RELEASE; break;
     }
+
+    const bool captured = action == GLFW_PRESS && ImGui::GetIO().WantCaptureKeyboard;
+    if (!captured && key >= 0 && key < KEY_COUNT && action != GLFW_REPEAT)
+        PushInputEvent(app->inputQueue, InputEvent{ INPUT_EVENT_KEY, (u32)key, action == GLFW_PRESS ? BUTTON_PRESS : BUTTON_RELEASE, app->input.mousePos, glm::vec2(0.0f) });
 }
 
 void OnGlfwCharEvent(GLFWwindow* window, unsigned int character)
@@ -141,6 +167,16 @@ int main()
         return -1;
     }
 
+    // second context for the resource loader thread, sharing objects with the main one
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    LoaderWindow = glfwCreateWindow(1, 1, WINDOW_TITLE, NULL, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (!LoaderWindow)
+    {
+        ELOG("glfwCreateWindow() failed for the loader context\n");
+        return -1;
+    }
+
     glfwSetWindowUserPointer(window, &app);
 
     glfwSetMouseButtonCallback(window, OnGlfwMouseEvent);
@@ -199,12 +235,17 @@ int main()
 
     GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
 
+    // before Init, it already spreads work over the workers
+    InitJobSystem(0);
+    InitResourceLoader();
+
     Init(&app);
 
     while (app.isRunning)
     {
         // Tell GLFW to call platform callbacks
         glfwPollEvents();
+        FlushInputEvents(app.inputQueue);
 
         // ImGui
         ImGui_ImplOpenGL3_NewFrame();
@@ -237,6 +278,7 @@ int main()
                 else if (app.input.mouseButtons[i] == BUTTON_RELEASE) app.input.mouseButtons[i] = BUTTON_IDLE;
 
         app.input.mouseDelta = glm::vec2(0.0f, 0.0f);
+        app.input.mouseScroll = glm::vec2(0.0f, 0.0f);
 
         // Render
         Render(&app);
@@ -262,11 +304,16 @@ int main()
         GlobalFrameArenaHead = 0;
     }
 
+    ShutdownResourceLoader();
+    ShutdownJobSystem();
+    ShutdownMaterials(&app);
+
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
 
+    glfwDestroyWindow(LoaderWindow);
     glfwDestroyWindow(window);
 
     glfwTerminate();
@@ -375,28 +422,19 @@ String ReadTextFile(const char* filepath)
     return fileText;
 }
 
-u64 GetFileLastWriteTimestamp(const char* filepath)
+void* GetGLProcAddress(const char* name)
 {
-#ifdef _WIN32
-    union Filetime2u64 {
-        FILETIME filetime;
-        u64      u64time;
-    } conversor;
-
-    WIN32_FILE_ATTRIBUTE_DATA Data;
-    if(GetFileAttributesExA(filepath, GetFileExInfoStandard, &Data)) {
-        conversor.filetime = Data.ftLastWriteTime;
-        return(conversor.u64time);
-    }
-#else
-    // NOTE: This has not been tested in unix-like systems
-    struct stat attrib;
-    if (stat(filepath, &attrib) == 0) {
-        return attrib.st_mtime;
-    }
-#endif
+    return (void*)glfwGetProcAddress(name);
+}
 
-    return 0;
+void MakeLoaderContextCurrent(bool current)
+{
+    glfwMakeContextCurrent(current ? LoaderWindow : NULL);
+}
+
+f64 GetTimeSeconds()
+{
+    return glfwGetTime();
 }
 
 void LogString(const char* str)
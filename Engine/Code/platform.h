@@ -12,8 +12,10 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/quaternion.hpp>
 #include <vector>
 #include <string>
+#include <atomic>
 
 #pragma warning(disable : 4267) // conversion from X to Y, possible loss of data
 
@@ -53,10 +55,65 @@ enum ButtonState {
 struct Input {
     glm::vec2   mousePos;
     glm::vec2   mouseDelta;
+    glm::vec2   mouseScroll; // wheel offsets of this frame
     ButtonState mouseButtons[MOUSE_BUTTON_COUNT];
     ButtonState keys[KEY_COUNT];
 };
 
+enum InputEventType {
+    INPUT_EVENT_KEY,
+    INPUT_EVENT_MOUSE_BUTTON,
+    INPUT_EVENT_MOUSE_MOVE,
+    INPUT_EVENT_MOUSE_SCROLL
+};
+
+struct InputEvent {
+    InputEventType type;
+    u32            code;  // Key or MouseButton
+    ButtonState    state; // BUTTON_PRESS or BUTTON_RELEASE
+    glm::vec2      mousePos;
+    glm::vec2      scroll;
+};
+
+#define INPUT_QUEUE_SIZE 256 // power of two
+
+// Lock free ring of input events, a single producer (the GLFW callbacks on
+// the main thread) and a single consumer (the simulation). The rest belongs
+// to the producer: mouse moves and scrolls are merged into one pending event
+// each, and the events that don't fit wait in overflow for the next flush.
+struct InputQueue {
+    InputEvent       events[INPUT_QUEUE_SIZE];
+    std::atomic<u32> head; // next event to read
+    std::atomic<u32> tail; // next event to write
+
+    InputEvent              pendingMove;
+    InputEvent              pendingScroll;
+    bool                    hasPendingMove;
+    bool                    hasPendingScroll;
+    std::vector<InputEvent> overflow;
+};
+
+/**
+ * Queue operations. Nothing is dropped: moves and scrolls are coalesced
+ * until the next key or button event or FlushInputEvents, and what doesn't
+ * fit in the ring is kept until there is room. PopInputEvent returns false
+ * when the ring is empty.
+ */
+void PushInputEvent(InputQueue& queue, const InputEvent& event);
+bool PopInputEvent(InputQueue& queue, InputEvent& event);
+
+/**
+ * Publishes the coalesced and overflowed events, once per frame after
+ * polling the window events.
+ */
+void FlushInputEvents(InputQueue& queue);
+
+/**
+ * Replays the queued events on the input state, after moving the states of
+ * the previous frame along (PRESS -> PRESSED, RELEASE -> IDLE).
+ */
+void ConsumeInputEvents(InputQueue& queue, Input& input);
+
 struct String
 {
     char* str;
@@ -75,12 +132,58 @@ String GetDirectoryPart(String path);
  */
 String ReadTextFile(const char *filepath);
 
+/**
+ * Read only view of a whole file mapped in memory, data is NULL if the file
+ * could not be opened. Any thread can map and unmap files.
+ */
+struct MappedFile
+{
+    const u8* data;
+    u64       size;
+    void*     fileHandle;
+    void*     mappingHandle;
+};
+
+MappedFile MapFile(const char *filepath);
+
+void UnmapFile(MappedFile& file);
+
+/**
+ * Writes the chunks back to back to <filepath>.tmp and moves it over the file,
+ * readers never see a partial write. Returns false (and leaves the file alone)
+ * if any write fails or the file can't be replaced, e.g. while it is mapped.
+ */
+struct FileChunk
+{
+    const void* data;
+    u64         size;
+};
+
+bool WriteFileAtomically(const char *filepath, const FileChunk* chunks, u32 chunkCount);
+
 /**
  * It retrieves a timestamp indicating the last time the file was modified.
  * Can be useful in order to check for file modifications to implement hot reloads.
  */
 u64 GetFileLastWriteTimestamp(const char *filepath);
 
+/**
+ * Returns the address of an OpenGL function of the current context. Useful to load
+ * the entry points of extensions that the glad loader was not generated with.
+ */
+void* GetGLProcAddress(const char* name);
+
+/**
+ * Makes the context shared with the main one current on the calling thread
+ * (or releases it). Only the resource loader thread uses it.
+ */
+void MakeLoaderContextCurrent(bool current);
+
+/**
+ * Returns the time in seconds since the platform layer started, for profiling.
+ */
+f64 GetTimeSeconds();
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
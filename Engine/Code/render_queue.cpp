@@ -0,0 +1,343 @@
+#include "render_queue.h"
+#include "gl_state.h"
+#include "materials.h"
+#include "static_batching.h"
+#include "job_system.h"
+
+#define DRAW_KEY_PASS_SHIFT     60
+#define DRAW_KEY_PROGRAM_SHIFT  52
+#define DRAW_KEY_FORMAT_SHIFT   44
+#define DRAW_KEY_MATERIAL_SHIFT 24
+
+#define DRAW_KEY_PROGRAM_MASK   0xFFull
+#define DRAW_KEY_FORMAT_MASK    0xFFull
+#define DRAW_KEY_MATERIAL_MASK  0xFFFFFull
+#define DRAW_KEY_DEPTH_MASK     0xFFFFFFull
+
+static const float DRAW_KEY_MAX_DEPTH = 1000.0f; // camera far plane
+
+static u32 PassProgramIdx(const App* app, RenderPass pass)
+{
+    switch (pass)
+    {
+        case RenderPass_ZPrePass: return app->vertexPulling ? app->zPrePassPullingProgramIdx : app->zPrePassProgramIdx;
+        case RenderPass_Geometry: return app->vertexPulling ? app->geometryPassPullingProgramIdx : app->geometryPassProgramIdx;
+        case RenderPass_Forward:  return app->vertexPulling ? app->forwardPullingProgramIdx : app->fordwardProgramIdx;
+        default: ASSERT(false, "Invalid render pass"); return 0;
+    }
+}
+
+static bool PassUsesMaterials(RenderPass pass)
+{
+    return pass == RenderPass_Geometry || pass == RenderPass_Forward;
+}
+
+static u64 MakeDrawKey(RenderPass pass, u32 programIdx, u32 arenaIdx, u32 materialIdx, f32 viewDepth)
+{
+    // front to back inside each state bucket so early z rejects as much as possible
+    f32 depth01 = clamp(viewDepth / DRAW_KEY_MAX_DEPTH, 0.0f, 1.0f);
+    u64 depth = (u64)(depth01 * (f32)DRAW_KEY_DEPTH_MASK);
+
+    return ((u64)pass << DRAW_KEY_PASS_SHIFT) |
+           (((u64)programIdx & DRAW_KEY_PROGRAM_MASK) << DRAW_KEY_PROGRAM_SHIFT) |
+           (((u64)arenaIdx & DRAW_KEY_FORMAT_MASK) << DRAW_KEY_FORMAT_SHIFT) |
+           (((u64)materialIdx & DRAW_KEY_MATERIAL_MASK) << DRAW_KEY_MATERIAL_SHIFT) |
+           depth;
+}
+
+// Compressed submeshes keep their bounds as the position scale/bias
+static bool SubmeshInFrustum(const Submesh& submesh, const vec4 frustumPlanes[6])
+{
+    for (u32 i = 0; i < 6; ++i)
+    {
+        const vec3 normal = vec3(frustumPlanes[i]);
+        const float radius = dot(submesh.positionScale, abs(normal));
+        if (dot(normal, submesh.positionBias) + frustumPlanes[i].w < -radius)
+            return false;
+    }
+    return true;
+}
+
+static void PushPassDrawItems(const App* app, RenderPass pass, const vec4 frustumPlanes[6], u32 firstEntity, u32 endEntity,
+                              std::vector<DrawItem>& items, u32& culledChunks)
+{
+    const u32 programIdx = PassProgramIdx(app, pass);
+    const bool usesMaterials = PassUsesMaterials(pass);
+
+    const Entities& entities = app->entities;
+    const FrameSnapshot& frame = app->frame;
+    for (u32 entityIdx = firstEntity; entityIdx < endEntity; ++entityIdx)
+    {
+        // visibility and depth come from UpdateEntityVisibility, through the published frame
+        if (!frame.visible[entityIdx] || !ShouldDrawEntity(app, entityIdx))
+            continue;
+
+        const Model& model = app->models[entities.modelIndices[entityIdx]];
+        const Mesh& mesh = app->meshes[model.meshIdx];
+        const bool isStaticBatch = entities.flags[entityIdx] & EntityFlag_StaticBatch;
+        const f32 viewDepth = frame.viewDepths[entityIdx];
+
+        for (u32 submeshIdx = 0; submeshIdx < mesh.submeshes.size(); ++submeshIdx)
+        {
+            const Submesh& submesh = mesh.submeshes[submeshIdx];
+            u32 materialIdx = usesMaterials ? model.materialIdx[submeshIdx] : 0;
+
+            // static chunks are already in world space, their bounds can be tested directly
+            if (isStaticBatch && !SubmeshInFrustum(submesh, frustumPlanes))
+            {
+                if (pass == RenderPass_ZPrePass)
+                    culledChunks++;
+                continue;
+            }
+
+            // chunks sort by their own center rather than the batch origin
+            f32 itemDepth = isStaticBatch ? -(frame.view * vec4(submesh.positionBias, 1.f)).z : viewDepth;
+
+            DrawItem item = {};
+            item.key = MakeDrawKey(pass, programIdx, submesh.arenaIdx, materialIdx, itemDepth);
+            item.entityIdx = entityIdx;
+            item.submeshIdx = submeshIdx;
+            item.programIdx = programIdx;
+            item.materialIdx = materialIdx;
+            items.push_back(item);
+        }
+    }
+}
+
+void RadixSortDrawItems(std::vector<DrawItem>& items, std::vector<DrawItem>& scratch)
+{
+    // LSD radix sort, 8 bits per pass. All histograms are built in a single read
+    // and the passes where every key has the same digit are skipped, which is the
+    // common case for the pass/program/format bytes.
+    const u32 count = (u32)items.size();
+    if (count < 2) return;
+
+    u32 histograms[8][256] = {};
+    for (u32 i = 0; i < count; ++i)
+    {
+        u64 key = items[i].key;
+        for (u32 digit = 0; digit < 8; ++digit)
+            histograms[digit][(key >> (digit * 8)) & 0xFF]++;
+    }
+
+    scratch.resize(count);
+    DrawItem* src = items.data();
+    DrawItem* dst = scratch.data();
+
+    for (u32 digit = 0; digit < 8; ++digit)
+    {
+        u32* histogram = histograms[digit];
+        const u32 shift = digit * 8;
+
+        if (histogram[(src[0].key >> shift) & 0xFF] == count)
+            continue;
+
+        u32 offset = 0;
+        for (u32 bucket = 0; bucket < 256; ++bucket)
+        {
+            u32 bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+
+        for (u32 i = 0; i < count; ++i)
+        {
+            dst[histogram[(src[i].key >> shift) & 0xFF]++] = src[i];
+        }
+
+        DrawItem* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != items.data())
+    {
+        items.swap(scratch);
+    }
+}
+
+// Same filtering as the replay, but only within the range, every buffer
+// starts from an unknown state
+static void RecordRenderCommands(const App* app, RenderPass pass, u32 firstItem, u32 endItem, RenderCommandBuffer& commands)
+{
+    const bool usesMaterials = PassUsesMaterials(pass);
+
+    u32 boundProgramIdx = UINT32_MAX;
+    u32 boundArenaIdx = UINT32_MAX;
+    u32 boundMaterialIdx = UINT32_MAX;
+    u32 boundEntityIdx = UINT32_MAX;
+
+    commands.clear();
+    for (u32 itemIdx = firstItem; itemIdx < endItem; ++itemIdx)
+    {
+        const DrawItem& item = app->drawItems[itemIdx];
+        const Model& model = app->models[app->entities.modelIndices[item.entityIdx]];
+        const Submesh& submesh = app->meshes[model.meshIdx].submeshes[item.submeshIdx];
+
+        if (item.programIdx != boundProgramIdx)
+        {
+            commands.push_back(RenderCommand{ RenderCommand_BindProgram, item.programIdx, 0 });
+            boundProgramIdx = item.programIdx;
+            boundArenaIdx = UINT32_MAX; // pulling, material and entity uniforms belong to the program
+            boundMaterialIdx = UINT32_MAX;
+            boundEntityIdx = UINT32_MAX;
+        }
+
+        if (submesh.arenaIdx != boundArenaIdx)
+        {
+            commands.push_back(RenderCommand{ RenderCommand_BindVertexFormat, item.entityIdx, item.submeshIdx });
+            boundArenaIdx = submesh.arenaIdx;
+        }
+
+        if (usesMaterials && item.materialIdx != boundMaterialIdx)
+        {
+            commands.push_back(RenderCommand{ RenderCommand_SetMaterial, item.materialIdx, 0 });
+            boundMaterialIdx = item.materialIdx;
+        }
+
+        if (item.entityIdx != boundEntityIdx)
+        {
+            commands.push_back(RenderCommand{ RenderCommand_SetEntity, item.entityIdx, 0 });
+            boundEntityIdx = item.entityIdx;
+        }
+
+        commands.push_back(RenderCommand{ RenderCommand_DrawSubmesh, item.entityIdx, item.submeshIdx });
+    }
+}
+
+void BuildRenderQueue(App* app)
+{
+    app->drawItems.clear();
+    app->renderQueueStats = {};
+
+    vec4 frustumPlanes[6];
+    ExtractFrustumPlanes(app->frame.projection * app->frame.view, frustumPlanes);
+
+    // draw items of disjoint entity ranges, concatenated in entity order
+    const u32 entityCount = app->frame.entityCount;
+    const u32 taskCount = (entityCount + RENDER_QUEUE_ENTITIES_PER_TASK - 1) / RENDER_QUEUE_ENTITIES_PER_TASK;
+    const RenderPass scenePass = app->deferred ? RenderPass_Geometry : RenderPass_Forward;
+    std::vector<u32> taskCulledChunks(taskCount, 0);
+    if (app->drawItemTasks.size() < taskCount)
+        app->drawItemTasks.resize(taskCount);
+
+    ParallelFor(entityCount, RENDER_QUEUE_ENTITIES_PER_TASK, [&](u32 begin, u32 end)
+    {
+        const u32 taskIdx = begin / RENDER_QUEUE_ENTITIES_PER_TASK;
+        std::vector<DrawItem>& items = app->drawItemTasks[taskIdx];
+        items.clear();
+        PushPassDrawItems(app, RenderPass_ZPrePass, frustumPlanes, begin, end, items, taskCulledChunks[taskIdx]);
+        PushPassDrawItems(app, scenePass, frustumPlanes, begin, end, items, taskCulledChunks[taskIdx]);
+    });
+
+    for (u32 taskIdx = 0; taskIdx < taskCount; ++taskIdx)
+    {
+        const std::vector<DrawItem>& items = app->drawItemTasks[taskIdx];
+        app->drawItems.insert(app->drawItems.end(), items.begin(), items.end());
+        app->renderQueueStats.culledChunks += taskCulledChunks[taskIdx];
+    }
+
+    RadixSortDrawItems(app->drawItems, app->drawItemsScratch);
+
+    // the pass is in the top bits of the key, so each pass is a contiguous range
+    u32 itemIdx = 0;
+    for (u32 pass = 0; pass < RenderPass_Count; ++pass)
+    {
+        app->passFirstDrawItem[pass] = itemIdx;
+        while (itemIdx < app->drawItems.size() && (app->drawItems[itemIdx].key >> DRAW_KEY_PASS_SHIFT) == pass)
+            ++itemIdx;
+    }
+    app->passFirstDrawItem[RenderPass_Count] = itemIdx;
+
+    // commands of every pass, one buffer per range of sorted items
+    for (u32 pass = 0; pass < RenderPass_Count; ++pass)
+    {
+        const u32 firstItem = app->passFirstDrawItem[pass];
+        const u32 itemCount = app->passFirstDrawItem[pass + 1] - firstItem;
+        std::vector<RenderCommandBuffer>& buffers = app->passCommandBuffers[pass];
+        buffers.resize((itemCount + RENDER_QUEUE_ITEMS_PER_BUFFER - 1) / RENDER_QUEUE_ITEMS_PER_BUFFER);
+
+        ParallelFor(itemCount, RENDER_QUEUE_ITEMS_PER_BUFFER, [&](u32 begin, u32 end)
+        {
+            RecordRenderCommands(app, (RenderPass)pass, firstItem + begin, firstItem + end, buffers[begin / RENDER_QUEUE_ITEMS_PER_BUFFER]);
+        });
+    }
+}
+
+void SubmitRenderQueue(App* app, RenderPass pass)
+{
+    RenderQueueStats& stats = app->renderQueueStats;
+
+    u32 boundProgramIdx = UINT32_MAX;
+    u32 boundArenaIdx = UINT32_MAX;
+    u32 boundMaterialIdx = UINT32_MAX;
+    u32 boundEntityIdx = UINT32_MAX;
+    const Program* program = nullptr;
+
+    if (PassUsesMaterials(pass))
+    {
+        // materials are indexed per draw, their textures never change during the pass
+        BindMaterialResources(app);
+    }
+
+    for (const RenderCommandBuffer& commands : app->passCommandBuffers[pass])
+    {
+        for (const RenderCommand& command : commands)
+        {
+            switch (command.type)
+            {
+                case RenderCommand_BindProgram:
+                    if (command.a != boundProgramIdx)
+                    {
+                        program = &app->programs[command.a];
+                        BindProgram(app, program->handle);
+                        boundProgramIdx = command.a;
+                        boundArenaIdx = UINT32_MAX;
+                        boundMaterialIdx = UINT32_MAX;
+                        boundEntityIdx = UINT32_MAX;
+                        stats.programBinds++;
+                    }
+                    break;
+
+                case RenderCommand_BindVertexFormat:
+                {
+                    const Model& model = app->models[app->entities.modelIndices[command.a]];
+                    const Submesh& submesh = app->meshes[model.meshIdx].submeshes[command.b];
+                    if (submesh.arenaIdx != boundArenaIdx)
+                    {
+                        BindSubmeshVertexFormat(app, *program, submesh);
+                        boundArenaIdx = submesh.arenaIdx;
+                        stats.vertexFormatBinds++;
+                    }
+                } break;
+
+                case RenderCommand_SetMaterial:
+                    if (command.a != boundMaterialIdx)
+                    {
+                        glUniform1ui(program->materialIdxLocation, command.a);
+                        boundMaterialIdx = command.a;
+                        stats.materialChanges++;
+                    }
+                    break;
+
+                case RenderCommand_SetEntity:
+                    if (command.a != boundEntityIdx)
+                    {
+                        // index of the world matrix in the resident entity transforms
+                        glUniform1ui(program->entityIdxLocation, command.a);
+                        boundEntityIdx = command.a;
+                        stats.entityChanges++;
+                    }
+                    break;
+
+                case RenderCommand_DrawSubmesh:
+                {
+                    const Model& model = app->models[app->entities.modelIndices[command.a]];
+                    const Submesh& submesh = app->meshes[model.meshIdx].submeshes[command.b];
+                    DrawSubmesh(app, *program, command.a, submesh);
+                    stats.draws++;
+                } break;
+            }
+        }
+    }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "engine.h"
+
+#define RENDER_QUEUE_ENTITIES_PER_TASK 256 // entities whose draw items one task builds
+#define RENDER_QUEUE_ITEMS_PER_BUFFER  512 // sorted draw items recorded into one command buffer
+
+// Builds the draw items over entity ranges, sorts them and records each pass
+// into command buffers, all on the job system. No GL calls.
+void BuildRenderQueue(App* app);
+
+// Replays the command buffers of the pass in order, filtering the state
+// changes that repeat across buffers.
+void SubmitRenderQueue(App* app, RenderPass pass);
+void RadixSortDrawItems(std::vector<DrawItem>& items, std::vector<DrawItem>& scratch);
@@ -0,0 +1,410 @@
+#include "resource_loader.h"
+#include "assimp_model_loading.h"
+#include "model_loading.h"
+#include "geometry_arena.h"
+#include "meshlets.h"
+#include "entities.h"
+#include "job_system.h"
+#include "texture_cooker.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <map>
+
+enum LoadRequestType
+{
+    LoadRequest_Texture2D,
+    LoadRequest_Model,
+};
+
+struct LoadRequest
+{
+    LoadRequestType type;
+    std::string     filepath;
+    LoadCallback    onLoaded;
+    u32             modelIdx; // placeholder filled by a model load, UINT32_MAX for a new model
+    bool            s3tcTextures;
+    TextureUsage    usage;    // LoadRequest_Texture2D
+};
+
+// Offsets of the prepared geometry of a submesh in the staging buffer
+struct StagedSubmesh
+{
+    u32 verticesOffset;
+    u32 positionsOffset;
+    u32 indicesOffset;
+};
+
+struct Load
+{
+    LoadRequest request;
+    bool        decoded; // on a worker, false if the file couldn't be read
+    GLsync      fence;   // 0 if the load failed
+
+    // LoadRequest_Texture2D
+    DecodedTexture decodedTexture;
+    Texture        texture;
+
+    // LoadRequest_Model
+    ImportedModel              model;
+    GLuint                     stagingBuffer;
+    std::vector<StagedSubmesh> stagedSubmeshes;
+};
+
+struct ResourceLoader
+{
+    std::thread             thread;
+    std::mutex              mutex;
+    std::condition_variable wakeUp;
+    std::deque<LoadRequest> requests;
+    std::deque<Load*>       decoded;   // waiting for the loader's context
+    std::vector<Load*>      completed; // fenced, waiting for the render thread
+    bool                    quit;
+
+    JobCounter              decodeCounter;
+    std::vector<Load*>      waiting; // render thread only, fence not signaled yet
+    std::atomic<u32>        pendingCount;
+
+    // render thread only, the callbacks of every texture in flight by file and usage
+    std::map<std::pair<std::string, TextureUsage>, std::vector<LoadCallback>> pendingTextures;
+};
+
+static ResourceLoader loader;
+
+// Worker side, no gl
+
+static void DecodeTexture2D(Load& load)
+{
+    load.decoded = DecodeTexture(load.request.filepath.c_str(), true, load.request.s3tcTextures, load.request.usage, load.decodedTexture);
+}
+
+static void DecodeModel(Load& load)
+{
+    load.decoded = ImportPreparedModel(load.request.filepath.c_str(), load.model);
+}
+
+// Loader side, on its shared context
+
+static void UploadTexture2D(Load& load)
+{
+    CreateTextureFromDecoded(load.request.filepath.c_str(), load.decodedTexture, load.texture);
+
+    load.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+static void UploadModel(Load& load)
+{
+    // every submesh gpu data back to back in one staging buffer, the streams
+    // of a cached import straight from the mapped cache
+    Mesh& mesh = load.model.mesh;
+    const std::vector<SubmeshGeometryData>& geometry = load.model.geometry;
+    load.stagedSubmeshes.resize(mesh.submeshes.size());
+    u32 stagingSize = 0;
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        StagedSubmesh& staged = load.stagedSubmeshes[i];
+        staged.verticesOffset = stagingSize;
+        staged.positionsOffset = staged.verticesOffset + mesh.submeshes[i].vertices.size();
+        staged.indicesOffset = staged.positionsOffset + geometry[i].positionsSize;
+        stagingSize = staged.indicesOffset + geometry[i].indicesSize;
+    }
+
+    glGenBuffers(1, &load.stagingBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, load.stagingBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, stagingSize ? stagingSize : 1, NULL, GL_STREAM_COPY);
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        const StagedSubmesh& staged = load.stagedSubmeshes[i];
+        glBufferSubData(GL_COPY_WRITE_BUFFER, staged.verticesOffset, mesh.submeshes[i].vertices.size(), mesh.submeshes[i].vertices.data());
+        glBufferSubData(GL_COPY_WRITE_BUFFER, staged.positionsOffset, geometry[i].positionsSize, geometry[i].positions);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, staged.indicesOffset, geometry[i].indicesSize, geometry[i].indices);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    ReleaseImportedGeometry(load.model);
+
+    load.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+static void LoaderMain()
+{
+    MakeLoaderContextCurrent(true);
+
+    for (;;)
+    {
+        std::deque<LoadRequest> requests;
+        std::deque<Load*> decoded;
+        {
+            std::unique_lock<std::mutex> lock(loader.mutex);
+            loader.wakeUp.wait(lock, [] { return loader.quit || !loader.requests.empty() || !loader.decoded.empty(); });
+            if (loader.quit)
+                break;
+            requests.swap(loader.requests);
+            decoded.swap(loader.decoded);
+        }
+
+        // reading and decoding goes to the workers, pushed from here they
+        // never land in the main thread queue, as background jobs they don't
+        // run inside the waits of a frame either
+        for (LoadRequest& request : requests)
+        {
+            Load* load = new Load{};
+            load->request = std::move(request);
+            RunJob([load]()
+            {
+                switch (load->request.type)
+                {
+                    case LoadRequest_Texture2D: DecodeTexture2D(*load); break;
+                    case LoadRequest_Model:     DecodeModel(*load); break;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(loader.mutex);
+                    loader.decoded.push_back(load);
+                }
+                loader.wakeUp.notify_one();
+            }, &loader.decodeCounter, JobKind_Background);
+        }
+
+        for (Load* load : decoded)
+        {
+            if (load->decoded)
+            {
+                switch (load->request.type)
+                {
+                    case LoadRequest_Texture2D: UploadTexture2D(*load); break;
+                    case LoadRequest_Model:     UploadModel(*load); break;
+                }
+            }
+        }
+
+        if (decoded.empty())
+            continue;
+
+        // the fences have to reach the gpu before the render thread waits on them
+        glFlush();
+
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        loader.completed.insert(loader.completed.end(), decoded.begin(), decoded.end());
+    }
+
+    MakeLoaderContextCurrent(false);
+}
+
+void InitResourceLoader()
+{
+    loader.quit = false;
+    loader.thread = std::thread(LoaderMain);
+}
+
+void ShutdownResourceLoader()
+{
+    WaitForCounter(&loader.decodeCounter);
+
+    {
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        loader.quit = true;
+    }
+    loader.wakeUp.notify_one();
+    loader.thread.join();
+
+    // the gl objects go with the contexts
+    for (Load* load : loader.decoded)
+    {
+        if (load->request.type == LoadRequest_Texture2D && load->decoded)
+        {
+            FreeCookedTexture(load->decodedTexture.cooked);
+            FreeImage(load->decodedTexture.image);
+        }
+        if (load->request.type == LoadRequest_Model)
+            ReleaseImportedGeometry(load->model);
+        delete load;
+    }
+    for (Load* load : loader.completed) delete load;
+    for (Load* load : loader.waiting)   delete load;
+    loader.decoded.clear();
+    loader.completed.clear();
+    loader.waiting.clear();
+    loader.pendingTextures.clear();
+}
+
+static void PushLoadRequest(App* app, LoadRequestType type, const char* filepath, const LoadCallback& onLoaded, u32 modelIdx, TextureUsage usage)
+{
+    loader.pendingCount++;
+    {
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        loader.requests.push_back(LoadRequest{ type, filepath, onLoaded, modelIdx, app->s3tcTextures, usage });
+    }
+    loader.wakeUp.notify_one();
+}
+
+void LoadTexture2DAsync(App* app, const char* filepath, TextureUsage usage, const LoadCallback& onLoaded)
+{
+    const u32 texIdx = FindTexture2D(app, filepath, usage);
+    if (texIdx != UINT32_MAX)
+    {
+        if (onLoaded) onLoaded(app, texIdx);
+        return;
+    }
+
+    // one request per file, the later callers wait for the same one
+    auto pending = loader.pendingTextures.find(std::make_pair(std::string(filepath), usage));
+    if (pending != loader.pendingTextures.end())
+    {
+        if (onLoaded) pending->second.push_back(onLoaded);
+        return;
+    }
+
+    std::vector<LoadCallback>& callbacks = loader.pendingTextures[std::make_pair(std::string(filepath), usage)];
+    if (onLoaded) callbacks.push_back(onLoaded);
+    PushLoadRequest(app, LoadRequest_Texture2D, filepath, nullptr, UINT32_MAX, usage);
+}
+
+void LoadModelAsync(App* app, const char* filename, const LoadCallback& onLoaded)
+{
+    PushLoadRequest(app, LoadRequest_Model, filename, onLoaded, UINT32_MAX, TextureUsage_Color);
+}
+
+u32 StreamModel(App* app, const char* filename, const LoadCallback& onLoaded)
+{
+    const u32 modelIdx = AddEmptyModel(app);
+    PushLoadRequest(app, LoadRequest_Model, filename, onLoaded, modelIdx, TextureUsage_Color);
+    return modelIdx;
+}
+
+static u32 FinishTexture2D(App* app, Load& load)
+{
+    // the same file may have been loaded synchronously meanwhile
+    const u32 texIdx = FindTexture2D(app, load.texture.filepath.c_str(), load.texture.usage);
+    if (texIdx != UINT32_MAX)
+    {
+        glDeleteTextures(1, &load.texture.handle);
+        return texIdx;
+    }
+
+    app->textures.push_back(load.texture);
+    return app->textures.size() - 1;
+}
+
+static u32 FinishModel(App* app, Load& load)
+{
+    ImportedModel& imported = load.model;
+
+    // materials first, their textures follow the model
+    const u32 baseMaterialIdx = app->materials.size();
+    for (u32 i = 0; i < imported.materials.size(); ++i)
+    {
+        const u32 materialIdx = app->materials.size();
+        app->materials.push_back(imported.materials[i]);
+
+        for (u32 slot = 0; slot < MATERIAL_TEXTURE_COUNT; ++slot)
+        {
+            const std::string& texturePath = imported.texturePaths[i * MATERIAL_TEXTURE_COUNT + slot];
+            if (texturePath.empty())
+                continue;
+
+            LoadTexture2DAsync(app, texturePath.c_str(), MaterialTextureUsage(slot), [materialIdx, slot](App* app, u32 texIdx)
+            {
+                MaterialTextureIdx(app->materials[materialIdx], slot) = texIdx;
+                app->materialsChanged = true;
+            });
+        }
+    }
+
+    u32 modelIdx = load.request.modelIdx;
+    if (modelIdx == UINT32_MAX)
+        modelIdx = AddImportedModel(app, imported, baseMaterialIdx);
+    else
+        SetImportedModel(app, modelIdx, imported, baseMaterialIdx);
+
+    Mesh& mesh = app->meshes[app->models[modelIdx].meshIdx];
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        const StagedSubmesh& staged = load.stagedSubmeshes[i];
+        AllocateSubmeshGeometryFromBuffer(app, mesh.submeshes[i], load.stagingBuffer, staged.verticesOffset, staged.positionsOffset, staged.indicesOffset);
+    }
+
+    // released by the driver once the copies are done
+    glDeleteBuffers(1, &load.stagingBuffer);
+
+    if (load.request.modelIdx != UINT32_MAX)
+    {
+        // the placeholder's entities get real bounds and meshlets
+        RefreshModelEntityBounds(app, modelIdx);
+        InvalidateMeshletBuffer(app);
+    }
+
+    return modelIdx;
+}
+
+void ProcessCompletedLoads(App* app)
+{
+    {
+        std::lock_guard<std::mutex> lock(loader.mutex);
+        loader.waiting.insert(loader.waiting.end(), loader.completed.begin(), loader.completed.end());
+        loader.completed.clear();
+    }
+
+    // loads finish in any order, the unsignaled ones wait for the next frame
+    u32 waitingCount = 0;
+    for (u32 i = 0; i < loader.waiting.size(); ++i)
+    {
+        Load* load = loader.waiting[i];
+        u32 resourceIdx = UINT32_MAX;
+
+        if (load->fence)
+        {
+            const GLenum status = glClientWaitSync(load->fence, 0, 0);
+            if (status == GL_TIMEOUT_EXPIRED)
+            {
+                loader.waiting[waitingCount++] = load;
+                continue;
+            }
+            glDeleteSync(load->fence);
+
+            if (status == GL_WAIT_FAILED)
+            {
+                // the uploads can't be trusted, the load fails
+                ELOG("Waiting for the upload of %s failed (error 0x%x)", load->request.filepath.c_str(), glGetError());
+                switch (load->request.type)
+                {
+                    case LoadRequest_Texture2D: glDeleteTextures(1, &load->texture.handle); break;
+                    case LoadRequest_Model:     glDeleteBuffers(1, &load->stagingBuffer); break;
+                }
+            }
+            else
+            {
+                switch (load->request.type)
+                {
+                    case LoadRequest_Texture2D: resourceIdx = FinishTexture2D(app, *load); break;
+                    case LoadRequest_Model:     resourceIdx = FinishModel(app, *load); break;
+                }
+            }
+        }
+
+        if (load->request.onLoaded)
+            load->request.onLoaded(app, resourceIdx);
+
+        if (load->request.type == LoadRequest_Texture2D)
+        {
+            // out of the map first, a callback may request the file again
+            auto pending = loader.pendingTextures.find(std::make_pair(load->request.filepath, load->request.usage));
+            std::vector<LoadCallback> callbacks;
+            callbacks.swap(pending->second);
+            loader.pendingTextures.erase(pending);
+            for (const LoadCallback& callback : callbacks)
+                callback(app, resourceIdx);
+        }
+
+        loader.pendingCount--;
+        delete load;
+    }
+
+    loader.waiting.resize(waitingCount);
+}
+
+u32 PendingLoadCount()
+{
+    return loader.pendingCount;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "engine.h"
+#include <functional>
+
+// Runs on the render thread with the index of the loaded resource, UINT32_MAX if it failed
+typedef std::function<void(App* app, u32 resourceIdx)> LoadCallback;
+
+// Loader thread that owns the context shared with the main one (see
+// MakeLoaderContextCurrent). Files are decoded/imported by jobs on the
+// workers, the loader creates and fills their gl objects, fenced. The
+// render thread takes them over once their fence is signaled, models
+// through a gpu copy from the loader's staging buffer into the geometry
+// arenas, so the arenas stay render thread only.
+void InitResourceLoader();
+void ShutdownResourceLoader(); // before ShutdownJobSystem, it waits for the decode jobs
+
+// A file already loading with the same usage gets no second request, onLoaded joins the first one
+void LoadTexture2DAsync(App* app, const char* filepath, TextureUsage usage, const LoadCallback& onLoaded);
+void LoadModelAsync(App* app, const char* filename, const LoadCallback& onLoaded); // material textures load async too
+
+// Returns the model right away, with an empty mesh that draws nothing. Its
+// entities show up once the mesh arrives, with the white texture in the
+// material slots still loading.
+u32  StreamModel(App* app, const char* filename, const LoadCallback& onLoaded = nullptr);
+
+// Takes over the loads whose fence is signaled, once per frame before the
+// materials are packed. No simulation may be running, callbacks may create entities.
+void ProcessCompletedLoads(App* app);
+u32  PendingLoadCount();
@@ -0,0 +1,151 @@
+#include "simd_math.h"
+
+// scalar path of CullSpheresSoA, also its tail
+static void CullSphere(const mat4& view, const vec4 planes[6], vec3 center, f32 radius, f32& viewDepth, u8& visible)
+{
+    const vec3 viewCenter = vec3(view * vec4(center, 1.f));
+
+    visible = 1;
+    for (u32 p = 0; p < 6; ++p)
+        visible &= dot(vec3(planes[p]), viewCenter) + planes[p].w >= -radius;
+
+    viewDepth = -viewCenter.z;
+}
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define SIMD_MATH_SSE
+#include <xmmintrin.h>
+#endif
+
+#ifdef SIMD_MATH_SSE
+
+// column major: result = c0 * p.x + c1 * p.y + c2 * p.z + c3 * p.w
+static inline __m128 TransformPoint(__m128 c0, __m128 c1, __m128 c2, __m128 c3, __m128 p)
+{
+    __m128 r = _mm_mul_ps(c0, _mm_shuffle_ps(p, p, _MM_SHUFFLE(0, 0, 0, 0)));
+    r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1))));
+    r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2))));
+    r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3))));
+    return r;
+}
+
+void TransformPointsArraySoA(const mat4* matrices, const vec4* points, f32* outX, f32* outY, f32* outZ, u32 count)
+{
+    u32 i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 r[4];
+        for (u32 j = 0; j < 4; ++j)
+        {
+            const float* m = &matrices[i + j][0][0];
+            r[j] = TransformPoint(_mm_loadu_ps(m), _mm_loadu_ps(m + 4), _mm_loadu_ps(m + 8), _mm_loadu_ps(m + 12), _mm_loadu_ps(&points[i + j][0]));
+        }
+
+        // four xyzw results to x, y and z lanes
+        _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+        _mm_storeu_ps(outX + i, r[0]);
+        _mm_storeu_ps(outY + i, r[1]);
+        _mm_storeu_ps(outZ + i, r[2]);
+    }
+
+    for (; i < count; ++i)
+    {
+        const vec4 p = matrices[i] * points[i];
+        outX[i] = p.x;
+        outY[i] = p.y;
+        outZ[i] = p.z;
+    }
+}
+
+void CullSpheresSoA(const mat4& view, const vec4 planes[6], const f32* x, const f32* y, const f32* z, const f32* radii, f32* outViewDepths, u8* outVisible, u32 count)
+{
+    // every element broadcast: lane k of a register belongs to sphere i + k
+    __m128 v[4][3];
+    for (u32 c = 0; c < 4; ++c)
+        for (u32 r = 0; r < 3; ++r)
+            v[c][r] = _mm_set1_ps(view[c][r]);
+
+    __m128 p[6][4];
+    for (u32 i = 0; i < 6; ++i)
+        for (u32 c = 0; c < 4; ++c)
+            p[i][c] = _mm_set1_ps(planes[i][c]);
+
+    const __m128 zero = _mm_setzero_ps();
+
+    u32 i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128 wx = _mm_loadu_ps(x + i);
+        const __m128 wy = _mm_loadu_ps(y + i);
+        const __m128 wz = _mm_loadu_ps(z + i);
+        const __m128 negRadius = _mm_sub_ps(zero, _mm_loadu_ps(radii + i));
+
+        __m128 vc[3];
+        for (u32 r = 0; r < 3; ++r)
+        {
+            vc[r] = _mm_add_ps(_mm_mul_ps(v[0][r], wx), _mm_mul_ps(v[1][r], wy));
+            vc[r] = _mm_add_ps(vc[r], _mm_add_ps(_mm_mul_ps(v[2][r], wz), v[3][r]));
+        }
+
+        __m128 inside = _mm_cmpeq_ps(zero, zero);
+        for (u32 plane = 0; plane < 6; ++plane)
+        {
+            __m128 d = _mm_add_ps(_mm_mul_ps(p[plane][0], vc[0]), _mm_mul_ps(p[plane][1], vc[1]));
+            d = _mm_add_ps(d, _mm_add_ps(_mm_mul_ps(p[plane][2], vc[2]), p[plane][3]));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negRadius));
+        }
+
+        _mm_storeu_ps(outViewDepths + i, _mm_sub_ps(zero, vc[2]));
+
+        const int mask = _mm_movemask_ps(inside);
+        for (u32 k = 0; k < 4; ++k)
+            outVisible[i + k] = (mask >> k) & 1;
+    }
+
+    for (; i < count; ++i)
+        CullSphere(view, planes, vec3(x[i], y[i], z[i]), radii[i], outViewDepths[i], outVisible[i]);
+}
+
+void MultiplyMatrices(const mat4& a, const mat4& b, mat4& out)
+{
+    const __m128 c0 = _mm_loadu_ps(&a[0][0]);
+    const __m128 c1 = _mm_loadu_ps(&a[1][0]);
+    const __m128 c2 = _mm_loadu_ps(&a[2][0]);
+    const __m128 c3 = _mm_loadu_ps(&a[3][0]);
+
+    // every column of b is a point transformed by a
+    const __m128 r0 = TransformPoint(c0, c1, c2, c3, _mm_loadu_ps(&b[0][0]));
+    const __m128 r1 = TransformPoint(c0, c1, c2, c3, _mm_loadu_ps(&b[1][0]));
+    const __m128 r2 = TransformPoint(c0, c1, c2, c3, _mm_loadu_ps(&b[2][0]));
+    const __m128 r3 = TransformPoint(c0, c1, c2, c3, _mm_loadu_ps(&b[3][0]));
+    _mm_storeu_ps(&out[0][0], r0);
+    _mm_storeu_ps(&out[1][0], r1);
+    _mm_storeu_ps(&out[2][0], r2);
+    _mm_storeu_ps(&out[3][0], r3);
+}
+
+#else
+
+void TransformPointsArraySoA(const mat4* matrices, const vec4* points, f32* outX, f32* outY, f32* outZ, u32 count)
+{
+    for (u32 i = 0; i < count; ++i)
+    {
+        const vec4 p = matrices[i] * points[i];
+        outX[i] = p.x;
+        outY[i] = p.y;
+        outZ[i] = p.z;
+    }
+}
+
+void CullSpheresSoA(const mat4& view, const vec4 planes[6], const f32* x, const f32* y, const f32* z, const f32* radii, f32* outViewDepths, u8* outVisible, u32 count)
+{
+    for (u32 i = 0; i < count; ++i)
+        CullSphere(view, planes, vec3(x[i], y[i], z[i]), radii[i], outViewDepths[i], outVisible[i]);
+}
+
+void MultiplyMatrices(const mat4& a, const mat4& b, mat4& out)
+{
+    out = a * b;
+}
+
+#endif
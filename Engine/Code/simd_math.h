@@ -0,0 +1,18 @@
+#pragma once
+
+#include "platform.h"
+
+using namespace glm;
+
+// 4x4 matrix kernels over contiguous arrays, SSE when available. The *SoA
+// ones keep every component in its own array and work on four items at a time.
+
+// out[i] = matrices[i] * points[i], xyz written to separate arrays
+void TransformPointsArraySoA(const mat4* matrices, const vec4* points, f32* outX, f32* outY, f32* outZ, u32 count);
+
+// Spheres moved to view space and tested against the view space frustum
+// planes: depth along -z and 1 if they intersect the frustum
+void CullSpheresSoA(const mat4& view, const vec4 planes[6], const f32* x, const f32* y, const f32* z, const f32* radii, f32* outViewDepths, u8* outVisible, u32 count);
+
+// out = a * b, out may alias a or b
+void MultiplyMatrices(const mat4& a, const mat4& b, mat4& out);
@@ -0,0 +1,108 @@
+#include "simulation.h"
+#include "entities.h"
+
+// Only the local transforms of the roots of the motion change, the
+// children follow in UpdateEntityHierarchy
+static void AnimateScene(App* app)
+{
+    if (app->orbitPivotEntity == ENTITY_NO_PARENT)
+        return;
+
+    app->sceneTime += app->simulation.deltaTime;
+    const f32 t = app->sceneTime;
+
+    SetEntityLocalTransform(app, app->orbitPivotEntity, MakeTransform(vec3(0.f, 3.f, 5.f), vec3(0.f, t * 30.f, 0.f), vec3(1.f)));
+    SetEntityLocalTransform(app, app->orbitPlanetEntity, MakeTransform(vec3(4.f, 0.f, 0.f), vec3(0.f, t * 90.f, 0.f), vec3(0.6f)));
+}
+
+void Simulate(App* app)
+{
+    Simulation& simulation = app->simulation;
+    ConsumeInputEvents(app->inputQueue, simulation.input);
+
+    UpdateCamera(app);
+    UpdateProjectionView(app);
+    AnimateScene(app);
+
+    f64 start = GetTimeSeconds();
+    UpdateEntityHierarchy(app);
+    f64 boundsStart = GetTimeSeconds();
+    UpdateEntityBounds(app);
+    f64 visibilityStart = GetTimeSeconds();
+    UpdateEntityVisibility(app);
+    f64 end = GetTimeSeconds();
+
+    simulation.entityUpdateMs = (f32)((end - start) * 1000.0);
+    simulation.entityBoundsMs = (f32)((visibilityStart - boundsStart) * 1000.0);
+    simulation.entityVisibilityMs = (f32)((end - visibilityStart) * 1000.0);
+}
+
+void PublishFrame(App* app)
+{
+    FrameSnapshot& frame = app->frame;
+    Entities& entities = app->entities;
+
+    frame.cameraPosition = app->camera.position;
+    frame.view = app->view;
+    frame.projection = app->projection;
+    frame.lights = app->lights;
+
+    // moved world matrices, the bits stay set in the frame until they are uploaded
+    frame.entityCount = entities.count;
+    frame.worldMatrices.resize(entities.count);
+    frame.dirtyBits.resize(entities.dirtyBits.size(), 0);
+    for (u32 word = 0; word < entities.dirtyBits.size(); ++word)
+    {
+        const u64 bits = entities.dirtyBits[word];
+        if (bits == 0)
+            continue;
+
+        for (u32 bit = 0; bit < 64; ++bit)
+            if ((bits >> bit) & 1)
+                frame.worldMatrices[word * 64 + bit] = entities.worldMatrices[word * 64 + bit];
+
+        frame.dirtyBits[word] |= bits;
+        entities.dirtyBits[word] = 0;
+    }
+
+    // rewritten whole by every simulation, the old arrays are reused
+    frame.visible.swap(entities.visible);
+    frame.viewDepths.swap(entities.viewDepths);
+    entities.visible.resize(entities.count);
+    entities.viewDepths.resize(entities.count);
+
+    frame.entityUpdateMs = app->simulation.entityUpdateMs;
+    frame.entityBoundsMs = app->simulation.entityBoundsMs;
+    frame.entityVisibilityMs = app->simulation.entityVisibilityMs;
+}
+
+void FinishSimulation(App* app)
+{
+    Simulation& simulation = app->simulation;
+    if (simulation.inFlight)
+    {
+        WaitForCounter(&simulation.counter);
+        PublishFrame(app);
+        simulation.inFlight = false;
+    }
+}
+
+void UpdateSimulation(App* app)
+{
+    Simulation& simulation = app->simulation;
+    FinishSimulation(app);
+
+    simulation.deltaTime = app->deltaTime;
+    simulation.displaySize = app->displaySize;
+
+    if (app->pipelinedUpdate)
+    {
+        RunJob([app]() { Simulate(app); }, &simulation.counter);
+        simulation.inFlight = true;
+    }
+    else
+    {
+        Simulate(app);
+        PublishFrame(app);
+    }
+}
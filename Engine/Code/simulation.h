@@ -0,0 +1,21 @@
+#pragma once
+
+#include "engine.h"
+
+// The cpu side of Update that doesn't touch GL: input, camera, projection
+// and the entity hierarchy/bounds/visibility. Reads app->simulation, never
+// app->frame.
+void Simulate(App* app);
+
+// Copies what Render needs of the simulation into app->frame, the moved
+// world matrices only. No simulation may be running.
+void PublishFrame(App* app);
+
+// Waits for and publishes the simulation started in the previous frame, if
+// any. Entities may be created after it until UpdateSimulation.
+void FinishSimulation(App* app);
+
+// Publishes the simulation started in the previous frame, if any, then
+// simulates the next frame: right away, or on a worker with
+// app->pipelinedUpdate so it overlaps the rendering of this one.
+void UpdateSimulation(App* app);
@@ -0,0 +1,131 @@
+#include "static_batching.h"
+#include "model_loading.h"
+#include "vertex_compression.h"
+#include "entities.h"
+
+struct StaticBatch
+{
+    ivec3              chunk;
+    u32                materialIdx;
+    std::vector<float> vertices; // position, normal, texcoord, tangent, bitangent
+    std::vector<u32>   indices;
+};
+
+static StaticBatch& FindOrCreateBatch(std::vector<StaticBatch>& batches, ivec3 chunk, u32 materialIdx)
+{
+    for (StaticBatch& batch : batches)
+    {
+        if (batch.chunk == chunk && batch.materialIdx == materialIdx)
+            return batch;
+    }
+
+    batches.push_back(StaticBatch{});
+    StaticBatch& batch = batches.back();
+    batch.chunk = chunk;
+    batch.materialIdx = materialIdx;
+    return batch;
+}
+
+void BuildStaticBatches(App* app)
+{
+    std::vector<StaticBatch> batches;
+
+    const Entities& entities = app->entities;
+    for (u32 entityIdx = 0; entityIdx < entities.count; ++entityIdx)
+    {
+        if (!(entities.flags[entityIdx] & EntityFlag_Static) || entities.modelIndices[entityIdx] == ENTITY_NO_MODEL)
+            continue;
+
+        const mat4& worldMatrix = entities.worldMatrices[entityIdx];
+        const Model& model = app->models[entities.modelIndices[entityIdx]];
+        const Mesh& mesh = app->meshes[model.meshIdx];
+        const mat3 normalMatrix = transpose(inverse(mat3(worldMatrix)));
+
+        // a mirroring transform flips the winding, swapping two indices restores it
+        const bool mirrored = determinant(mat3(worldMatrix)) < 0.f;
+
+        for (u32 submeshIdx = 0; submeshIdx < mesh.submeshes.size(); ++submeshIdx)
+        {
+            const Submesh& submesh = mesh.submeshes[submeshIdx];
+
+            // the whole submesh goes to the chunk of its center, chunks may overlap a bit
+            const vec3 center = vec3(worldMatrix * vec4(submesh.positionBias, 1.f));
+            const ivec3 chunk = ivec3(floor(center / STATIC_BATCH_CHUNK_SIZE));
+            StaticBatch& batch = FindOrCreateBatch(batches, chunk, model.materialIdx[submeshIdx]);
+
+            const u32 baseVertex = batch.vertices.size() / 14;
+            const u32 vertexCount = SubmeshVertexCount(submesh);
+            for (u32 i = 0; i < vertexCount; ++i)
+            {
+                const vec3 position = vec3(worldMatrix * vec4(ReadVertexPosition(submesh, i), 1.f));
+                const vec3 normal = normalize(normalMatrix * ReadVertexNormal(submesh, i));
+                const vec4 texCoord = ReadVertexAttribute(submesh, i, 2);
+
+                vec3 tangent, bitangent;
+                ReadVertexTangentFrame(submesh, i, tangent, bitangent);
+                tangent = normalize(mat3(worldMatrix) * tangent);
+                bitangent = normalize(mat3(worldMatrix) * bitangent);
+
+                const float vertex[] = {
+                    position.x, position.y, position.z, normal.x, normal.y, normal.z, texCoord.x, texCoord.y,
+                    tangent.x, tangent.y, tangent.z, bitangent.x, bitangent.y, bitangent.z
+                };
+                batch.vertices.insert(batch.vertices.end(), vertex, vertex + ARRAY_COUNT(vertex));
+            }
+
+            for (u32 i = 0; i + 2 < submesh.indices.size(); i += 3)
+            {
+                batch.indices.push_back(baseVertex + submesh.indices[i]);
+                batch.indices.push_back(baseVertex + submesh.indices[mirrored ? i + 2 : i + 1]);
+                batch.indices.push_back(baseVertex + submesh.indices[mirrored ? i + 1 : i + 2]);
+            }
+        }
+    }
+
+    if (batches.empty())
+        return;
+
+    VertexBufferLayout vertexBufferLayout = {};
+    vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
+    vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float) });
+    vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, 6 * sizeof(float) });
+    vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 3, 3, 8 * sizeof(float) });
+    vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 4, 3, 11 * sizeof(float) });
+    vertexBufferLayout.stride = 14 * sizeof(float);
+
+    app->meshes.push_back(Mesh{});
+    Mesh& mesh = app->meshes.back();
+    const u32 meshIdx = (u32)app->meshes.size() - 1u;
+
+    app->models.push_back(Model{});
+    Model& model = app->models.back();
+    model.meshIdx = meshIdx;
+    const u32 modelIdx = (u32)app->models.size() - 1u;
+
+    for (StaticBatch& batch : batches)
+    {
+        // compressed again, now relative to the bounds of the whole chunk
+        Submesh submesh = {};
+        CompressSubmeshVertices(submesh, batch.vertices, vertexBufferLayout);
+        submesh.indices.swap(batch.indices);
+        mesh.submeshes.push_back(submesh);
+        model.materialIdx.push_back(batch.materialIdx);
+    }
+
+    LoadMeshGlBuffers(app, mesh);
+
+    CreateEntity(app, modelIdx, Transform(), ENTITY_NO_PARENT, EntityFlag_StaticBatch);
+
+    ILOG("Static batching: %u chunk submeshes", (u32)mesh.submeshes.size());
+}
+
+bool ShouldDrawEntity(const App* app, u32 entityIdx)
+{
+    if (app->entities.modelIndices[entityIdx] == ENTITY_NO_MODEL)
+        return false;
+
+    const u8 flags = app->entities.flags[entityIdx];
+    if (flags & EntityFlag_StaticBatch)
+        return app->staticBatching;
+    return !((flags & EntityFlag_Static) && app->staticBatching);
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "engine.h"
+
+#define STATIC_BATCH_CHUNK_SIZE 16.f // world units per side of the cells grouping static geometry
+
+// Merges the geometry of every static entity into one batch entity whose
+// submeshes hold, per spatial chunk and material, the pre-transformed
+// triangles of all the static submeshes in that chunk. Call once, after
+// the scene is built.
+void BuildStaticBatches(App* app);
+
+// Static entities are drawn through the batch while static batching is on
+bool ShouldDrawEntity(const App* app, u32 entityIdx);
@@ -0,0 +1,506 @@
+#include "texture_cooker.h"
+#include "gl_extensions.h"
+
+#include <stb_image.h>
+#include <stdio.h>
+
+#define TEXTURE_CACHE_MAGIC 0x58455443u // "CTEX"
+
+enum TextureCookFlags
+{
+    TextureCookFlag_FlipVertically = 1 << 0,
+    TextureCookFlag_S3TC           = 1 << 1,
+    TextureCookFlag_NormalMap      = 1 << 2,
+};
+
+struct TextureCacheHeader
+{
+    u32 magic;
+    u32 version;
+    u64 sourceTimestamp;
+    u32 cookFlags;
+    u32 internalFormat;
+    i32 width;
+    i32 height;
+    u32 levelCount;
+    u32 padding;
+    u64 fileSize; // a file cut short by a crashed write never matches
+};
+
+static std::string TextureCachePath(const char* filepath)
+{
+    return std::string(filepath) + ".texcache";
+}
+
+static ivec2 LevelSize(ivec2 size, u32 level)
+{
+    return ivec2(std::max(size.x >> level, 1), std::max(size.y >> level, 1));
+}
+
+static u32 LevelCount(ivec2 size)
+{
+    u32 levels = 1;
+    for (i32 maxSize = std::max(size.x, size.y); maxSize > 1; maxSize >>= 1)
+        ++levels;
+    return levels;
+}
+
+u32 CompressedBlockSize(GLenum internalFormat)
+{
+    switch (internalFormat)
+    {
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_RED_RGTC1:
+            return 8;
+        default:
+            return 16;
+    }
+}
+
+u32 CompressedLevelSize(GLenum internalFormat, ivec2 levelSize)
+{
+    return ((levelSize.x + 3) / 4) * ((levelSize.y + 3) / 4) * CompressedBlockSize(internalFormat);
+}
+
+// Block encoders, 4x4 texels in, row major
+
+// BC4 block of one channel of the texels, the 8 value palette mode
+static void EncodeBC4Block(const u8 values[16], u8* out)
+{
+    u8 minValue = 255, maxValue = 0;
+    for (u32 i = 0; i < 16; ++i)
+    {
+        minValue = std::min(minValue, values[i]);
+        maxValue = std::max(maxValue, values[i]);
+    }
+
+    out[0] = maxValue;
+    out[1] = minValue;
+
+    // palette: 0 max, 1 min, 2..7 from max to min in sevenths
+    u64 indices = 0;
+    if (maxValue > minValue)
+    {
+        const f32 range = maxValue - minValue;
+        for (u32 i = 0; i < 16; ++i)
+        {
+            const u32 step = (u32)((values[i] - minValue) / range * 7.f + 0.5f);
+            const u64 index = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+            indices |= index << (3 * i);
+        }
+    }
+
+    for (u32 i = 0; i < 6; ++i)
+        out[2 + i] = (u8)(indices >> (8 * i));
+}
+
+static u16 PackRGB565(vec3 color)
+{
+    const u32 r = (u32)(clamp(color.r, 0.f, 255.f) * 31.f / 255.f + 0.5f);
+    const u32 g = (u32)(clamp(color.g, 0.f, 255.f) * 63.f / 255.f + 0.5f);
+    const u32 b = (u32)(clamp(color.b, 0.f, 255.f) * 31.f / 255.f + 0.5f);
+    return (u16)((r << 11) | (g << 5) | b);
+}
+
+static vec3 UnpackRGB565(u16 color)
+{
+    const u32 r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+    return vec3((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2));
+}
+
+// BC1 block of the texels rgb, always the 4 color mode. The endpoints are
+// the extremes of the colors along their principal axis, inset a little.
+static void EncodeBC1Block(const vec3 colors[16], u8* out)
+{
+    vec3 mean(0.f);
+    for (u32 i = 0; i < 16; ++i)
+        mean += colors[i];
+    mean /= 16.f;
+
+    mat3 covariance(0.f);
+    for (u32 i = 0; i < 16; ++i)
+    {
+        const vec3 d = colors[i] - mean;
+        covariance += outerProduct(d, d);
+    }
+
+    // a few power iterations from the luminance axis
+    vec3 axis(0.299f, 0.587f, 0.114f);
+    for (u32 i = 0; i < 4; ++i)
+    {
+        const vec3 next = covariance * axis;
+        const f32 len = length(next);
+        if (len < 1e-6f)
+            break;
+        axis = next / len;
+    }
+
+    f32 minProj = FLT_MAX, maxProj = -FLT_MAX;
+    for (u32 i = 0; i < 16; ++i)
+    {
+        const f32 proj = dot(colors[i] - mean, axis);
+        minProj = std::min(minProj, proj);
+        maxProj = std::max(maxProj, proj);
+    }
+    const f32 inset = (maxProj - minProj) / 16.f;
+
+    u16 c0 = PackRGB565(mean + axis * (maxProj - inset));
+    u16 c1 = PackRGB565(mean + axis * (minProj + inset));
+    if (c0 < c1)
+        std::swap(c0, c1);
+
+    const vec3 e0 = UnpackRGB565(c0), e1 = UnpackRGB565(c1);
+    const vec3 palette[4] = { e0, e1, (2.f * e0 + e1) / 3.f, (e0 + 2.f * e1) / 3.f };
+
+    u32 indices = 0;
+    if (c0 != c1)
+    {
+        for (u32 i = 0; i < 16; ++i)
+        {
+            u32 best = 0;
+            f32 bestDistance = FLT_MAX;
+            for (u32 p = 0; p < 4; ++p)
+            {
+                const vec3 d = colors[i] - palette[p];
+                const f32 distance = dot(d, d);
+                if (distance < bestDistance)
+                {
+                    bestDistance = distance;
+                    best = p;
+                }
+            }
+            indices |= best << (2 * i);
+        }
+    }
+
+    memcpy(out + 0, &c0, sizeof(u16));
+    memcpy(out + 2, &c1, sizeof(u16));
+    memcpy(out + 4, &indices, sizeof(u32));
+}
+
+static void EncodeLevel(const u8* pixels, ivec2 size, u32 channels, GLenum internalFormat, u8* out)
+{
+    const u32 blockSize = CompressedBlockSize(internalFormat);
+    for (i32 by = 0; by < size.y; by += 4)
+    {
+        for (i32 bx = 0; bx < size.x; bx += 4)
+        {
+            // the edge blocks repeat the last row/column
+            u8 texels[16][4];
+            for (u32 i = 0; i < 16; ++i)
+            {
+                const i32 x = std::min(bx + (i32)(i & 3), size.x - 1);
+                const i32 y = std::min(by + (i32)(i >> 2), size.y - 1);
+                const u8* p = &pixels[(y * size.x + x) * channels];
+                for (u32 c = 0; c < 4; ++c)
+                    texels[i][c] = c < channels ? p[c] : 255;
+            }
+
+            u8 channel[16];
+            vec3 colors[16];
+            switch (internalFormat)
+            {
+                case GL_COMPRESSED_RED_RGTC1:
+                case GL_COMPRESSED_RG_RGTC2:
+                    for (u32 c = 0; c < blockSize / 8; ++c)
+                    {
+                        for (u32 i = 0; i < 16; ++i) channel[i] = texels[i][c];
+                        EncodeBC4Block(channel, out + 8 * c);
+                    }
+                    break;
+                case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+                    for (u32 i = 0; i < 16; ++i) channel[i] = texels[i][3];
+                    EncodeBC4Block(channel, out); // the bc3 alpha block is a bc4 one
+                    for (u32 i = 0; i < 16; ++i) colors[i] = vec3(texels[i][0], texels[i][1], texels[i][2]);
+                    EncodeBC1Block(colors, out + 8);
+                    break;
+                default:
+                    for (u32 i = 0; i < 16; ++i) colors[i] = vec3(texels[i][0], texels[i][1], texels[i][2]);
+                    EncodeBC1Block(colors, out);
+                    break;
+            }
+            out += blockSize;
+        }
+    }
+}
+
+// Next level, 2x2 box filter. Odd sizes repeat their last row/column.
+static void DownsampleLevel(const u8* src, ivec2 srcSize, u32 channels, u8* dst, ivec2 dstSize)
+{
+    for (i32 y = 0; y < dstSize.y; ++y)
+    {
+        const i32 y0 = std::min(2 * y, srcSize.y - 1), y1 = std::min(2 * y + 1, srcSize.y - 1);
+        for (i32 x = 0; x < dstSize.x; ++x)
+        {
+            const i32 x0 = std::min(2 * x, srcSize.x - 1), x1 = std::min(2 * x + 1, srcSize.x - 1);
+            for (u32 c = 0; c < channels; ++c)
+            {
+                const u32 sum = src[(y0 * srcSize.x + x0) * channels + c] + src[(y0 * srcSize.x + x1) * channels + c] +
+                                src[(y1 * srcSize.x + x0) * channels + c] + src[(y1 * srcSize.x + x1) * channels + c];
+                dst[(y * dstSize.x + x) * channels + c] = (u8)((sum + 2) / 4);
+            }
+        }
+    }
+}
+
+static GLenum ChooseCompressedFormat(const u8* pixels, ivec2 size, u32 channels, bool s3tcSupported, TextureUsage usage)
+{
+    // the xy of a normal map fill both bc5 channels, no more dxt1 color bleeding between them
+    if (usage == TextureUsage_NormalMap && channels >= 2)
+        return GL_COMPRESSED_RG_RGTC2;
+
+    switch (channels)
+    {
+        case 1: return GL_COMPRESSED_RED_RGTC1;
+        case 2: return GL_COMPRESSED_RG_RGTC2;
+        case 3: return s3tcSupported ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_NONE;
+        case 4:
+            if (!s3tcSupported)
+                return GL_NONE;
+            for (i32 i = 0; i < size.x * size.y; ++i)
+                if (pixels[i * 4 + 3] != 255)
+                    return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+            return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        default: return GL_NONE;
+    }
+}
+
+static bool ReadTextureCache(const char* filepath, u32 cookFlags, CookedTexture& cooked)
+{
+    const std::string cachePath = TextureCachePath(filepath);
+    MappedFile file = MapFile(cachePath.c_str());
+    if (!file.data)
+        return false;
+
+    TextureCacheHeader header = {};
+    if (file.size >= sizeof(header))
+        memcpy(&header, file.data, sizeof(header));
+
+    const bool knownFormat = header.internalFormat == GL_COMPRESSED_RED_RGTC1 ||
+                             header.internalFormat == GL_COMPRESSED_RG_RGTC2 ||
+                             header.internalFormat == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ||
+                             header.internalFormat == GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+
+    bool valid = header.magic == TEXTURE_CACHE_MAGIC && knownFormat &&
+                 header.version == TEXTURE_CACHE_VERSION &&
+                 header.fileSize == file.size &&
+                 header.cookFlags == cookFlags &&
+                 header.sourceTimestamp == GetFileLastWriteTimestamp(filepath) &&
+                 header.width > 0 && header.height > 0 &&
+                 header.levelCount == LevelCount(ivec2(header.width, header.height));
+
+    if (valid)
+    {
+        u64 dataSize = 0;
+        for (u32 level = 0; level < header.levelCount; ++level)
+            dataSize += CompressedLevelSize(header.internalFormat, LevelSize(ivec2(header.width, header.height), level));
+        valid = sizeof(header) + dataSize == file.size;
+    }
+
+    if (!valid)
+    {
+        ILOG("Texture cache %s is stale, cooking %s again", cachePath.c_str(), filepath);
+        UnmapFile(file);
+        return false;
+    }
+
+    cooked.internalFormat = header.internalFormat;
+    cooked.size = ivec2(header.width, header.height);
+    cooked.levelCount = header.levelCount;
+    cooked.levels = file.data + sizeof(header);
+    cooked.file = file;
+    return true;
+}
+
+static void WriteTextureCache(const char* filepath, u32 cookFlags, const CookedTexture& cooked)
+{
+    TextureCacheHeader header = {};
+    header.magic = TEXTURE_CACHE_MAGIC;
+    header.version = TEXTURE_CACHE_VERSION;
+    header.sourceTimestamp = GetFileLastWriteTimestamp(filepath);
+    header.cookFlags = cookFlags;
+    header.internalFormat = cooked.internalFormat;
+    header.width = cooked.size.x;
+    header.height = cooked.size.y;
+    header.levelCount = cooked.levelCount;
+    header.fileSize = sizeof(header) + cooked.cookedData.size();
+
+    const FileChunk chunks[2] = { { &header, sizeof(header) }, { cooked.cookedData.data(), cooked.cookedData.size() } };
+    WriteFileAtomically(TextureCachePath(filepath).c_str(), chunks, 2);
+}
+
+// Full mip chain of a decoded image, false if its format isn't compressed
+static bool CookImage(const Image& image, bool s3tcSupported, TextureUsage usage, CookedTexture& cooked)
+{
+    const u8* pixels = (const u8*)image.pixels;
+    const ivec2 size = image.size;
+    const u32 channels = image.nchannels;
+
+    const GLenum internalFormat = ChooseCompressedFormat(pixels, size, channels, s3tcSupported, usage);
+    if (internalFormat == GL_NONE)
+        return false;
+
+    cooked.internalFormat = internalFormat;
+    cooked.size = size;
+    cooked.levelCount = LevelCount(size);
+
+    u64 dataSize = 0;
+    for (u32 level = 0; level < cooked.levelCount; ++level)
+        dataSize += CompressedLevelSize(internalFormat, LevelSize(size, level));
+    cooked.cookedData.resize(dataSize);
+
+    // every level from the previous one
+    std::vector<u8> level(pixels, pixels + size.x * size.y * channels);
+    std::vector<u8> nextLevel;
+
+    u8* out = cooked.cookedData.data();
+    for (u32 levelIdx = 0; levelIdx < cooked.levelCount; ++levelIdx)
+    {
+        const ivec2 levelSize = LevelSize(size, levelIdx);
+        EncodeLevel(level.data(), levelSize, channels, internalFormat, out);
+        out += CompressedLevelSize(internalFormat, levelSize);
+
+        if (levelIdx + 1 < cooked.levelCount)
+        {
+            const ivec2 nextSize = LevelSize(size, levelIdx + 1);
+            nextLevel.resize(nextSize.x * nextSize.y * channels);
+            DownsampleLevel(level.data(), levelSize, channels, nextLevel.data(), nextSize);
+            level.swap(nextLevel);
+        }
+    }
+
+    cooked.levels = cooked.cookedData.data();
+    return true;
+}
+
+bool DecodeTexture(const char* filepath, bool flipVertically, bool s3tcSupported, TextureUsage usage, DecodedTexture& decoded, bool keepImage)
+{
+    const u32 cookFlags = (flipVertically ? TextureCookFlag_FlipVertically : 0) |
+                          (s3tcSupported ? TextureCookFlag_S3TC : 0) |
+                          (usage == TextureUsage_NormalMap ? TextureCookFlag_NormalMap : 0);
+
+    decoded.cooked = CookedTexture{};
+    decoded.cooked.usage = usage;
+    decoded.image = {};
+    if (ReadTextureCache(filepath, cookFlags, decoded.cooked))
+        return true;
+
+    Image& image = decoded.image;
+    stbi_set_flip_vertically_on_load_thread(flipVertically);
+    image.pixels = stbi_load(filepath, &image.size.x, &image.size.y, &image.nchannels, 0);
+    if (!image.pixels)
+    {
+        ELOG("Could not open file %s", filepath);
+        return false;
+    }
+    image.stride = image.size.x * image.nchannels;
+
+    if (CookImage(image, s3tcSupported, usage, decoded.cooked))
+    {
+        WriteTextureCache(filepath, cookFlags, decoded.cooked);
+        if (!keepImage)
+        {
+            FreeImage(image);
+            image = {};
+        }
+    }
+    return true;
+}
+
+bool CookTexture(const char* filepath, bool flipVertically, bool s3tcSupported, TextureUsage usage, CookedTexture& cooked)
+{
+    DecodedTexture decoded;
+    const bool decodedOk = DecodeTexture(filepath, flipVertically, s3tcSupported, usage, decoded);
+    FreeImage(decoded.image);
+
+    cooked = std::move(decoded.cooked);
+    return decodedOk && cooked.levels != NULL;
+}
+
+void FreeCookedTexture(CookedTexture& cooked)
+{
+    UnmapFile(cooked.file);
+    cooked = CookedTexture{};
+}
+
+void CreateTextureFromDecoded(const char* filepath, DecodedTexture& decoded, Texture& tex)
+{
+    tex = {};
+    tex.filepath = filepath;
+    tex.usage = decoded.cooked.usage;
+    if (decoded.cooked.levels)
+    {
+        tex.handle = CreateTexture2DFromCooked(decoded.cooked);
+        tex.size = decoded.cooked.size;
+        tex.internalFormat = decoded.cooked.internalFormat;
+        FreeCookedTexture(decoded.cooked);
+    }
+    else
+    {
+        tex.handle = CreateTexture2DFromImage(decoded.image);
+        tex.size = decoded.image.size;
+        tex.internalFormat = decoded.image.nchannels == 4 ? GL_RGBA8 : GL_RGB8;
+        FreeImage(decoded.image);
+        decoded.image = {};
+    }
+}
+
+void SetCookedTextureSwizzle(GLenum target, GLenum internalFormat, TextureUsage usage)
+{
+    if (usage == TextureUsage_NormalMap)
+        return;
+
+    if (internalFormat == GL_COMPRESSED_RED_RGTC1 || internalFormat == GL_COMPRESSED_RG_RGTC2)
+    {
+        const GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, internalFormat == GL_COMPRESSED_RG_RGTC2 ? GL_GREEN : GL_ONE };
+        glTexParameteriv(target, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+}
+
+static void UploadCookedLevels(GLenum target, const CookedTexture& cooked)
+{
+    const u8* data = cooked.levels;
+    for (u32 level = 0; level < cooked.levelCount; ++level)
+    {
+        const ivec2 levelSize = LevelSize(cooked.size, level);
+        const u32 levelDataSize = CompressedLevelSize(cooked.internalFormat, levelSize);
+        glCompressedTexSubImage2D(target, level, 0, 0, levelSize.x, levelSize.y, cooked.internalFormat, levelDataSize, data);
+        data += levelDataSize;
+    }
+}
+
+GLuint CreateTexture2DFromCooked(const CookedTexture& cooked)
+{
+    GLuint texHandle;
+    glGenTextures(1, &texHandle);
+    glBindTexture(GL_TEXTURE_2D, texHandle);
+    glTexStorage2D(GL_TEXTURE_2D, cooked.levelCount, cooked.internalFormat, cooked.size.x, cooked.size.y);
+    UploadCookedLevels(GL_TEXTURE_2D, cooked);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    SetCookedTextureSwizzle(GL_TEXTURE_2D, cooked.internalFormat, cooked.usage);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    return texHandle;
+}
+
+GLuint CreateCubemapFromCooked(const CookedTexture faces[6])
+{
+    GLuint texHandle;
+    glGenTextures(1, &texHandle);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, texHandle);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, faces[0].levelCount, faces[0].internalFormat, faces[0].size.x, faces[0].size.y);
+    for (u32 i = 0; i < 6; ++i)
+        UploadCookedLevels(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, faces[i]);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    SetCookedTextureSwizzle(GL_TEXTURE_CUBE_MAP, faces[0].internalFormat, faces[0].usage);
+    glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+    return texHandle;
+}
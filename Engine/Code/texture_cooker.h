@@ -0,0 +1,54 @@
+#pragma once
+
+#include "engine.h"
+
+// Bump whenever the cooked output changes: mip filter, encoders or the container
+#define TEXTURE_CACHE_VERSION 2
+
+// Images are cooked once into <image>.texcache next to the source: a header
+// keyed on the source last write time and the cook flags (usage included),
+// then the full block compressed mip chain, level 0 first.
+//   1 channel  (grey)       BC4 / RGTC1, sampled as grey
+//   2 channels (grey alpha) BC5 / RGTC2, sampled as grey alpha
+//   3 channels, or 4 opaque BC1 / DXT1 \ with GL_EXT_texture_compression_s3tc,
+//   4 channels              BC3 / DXT5 / uncompressed without it
+//   normal maps, 2+ channels BC5 / RGTC2 of their xy, sampled as they are
+struct CookedTexture
+{
+    GLenum       internalFormat;
+    TextureUsage usage;
+    ivec2        size;
+    u32          levelCount;
+    const u8*    levels;     // every level back to back, in the mapped cache file or in cookedData
+    MappedFile   file;
+    std::vector<u8> cookedData;
+};
+
+// Any thread. False if the image can't be read or its format isn't compressed.
+bool CookTexture(const char* filepath, bool flipVertically, bool s3tcSupported, TextureUsage usage, CookedTexture& cooked);
+void FreeCookedTexture(CookedTexture& cooked);
+
+u32 CompressedBlockSize(GLenum internalFormat);
+u32 CompressedLevelSize(GLenum internalFormat, ivec2 levelSize);
+
+// Cooked texture or, for the images the cooker leaves uncompressed, the decoded pixels
+struct DecodedTexture
+{
+    CookedTexture cooked; // levels is NULL if the image isn't compressed
+    Image         image;
+};
+
+// Any thread. With keepImage the pixels of a freshly cooked image stay in
+// image too, a cache hit never has them.
+bool DecodeTexture(const char* filepath, bool flipVertically, bool s3tcSupported, TextureUsage usage, DecodedTexture& decoded, bool keepImage = false);
+
+// GL thread, the decoded data is freed
+void CreateTextureFromDecoded(const char* filepath, DecodedTexture& decoded, Texture& tex);
+
+// Immutable storage of all the levels, uploaded as they are. Cube map faces in +X, -X, +Y, -Y, +Z, -Z order.
+GLuint CreateTexture2DFromCooked(const CookedTexture& cooked);
+GLuint CreateCubemapFromCooked(const CookedTexture faces[6]);
+
+// The one and two channel formats read as grey (alpha), like the uncompressed
+// ones. Normal maps read their xy as they are.
+void SetCookedTextureSwizzle(GLenum target, GLenum internalFormat, TextureUsage usage);
@@ -0,0 +1,241 @@
+#include "vertex_compression.h"
+
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#define COMPRESSED_POSITION_OFFSET      0
+#define COMPRESSED_NORMAL_OFFSET        8
+#define COMPRESSED_TEXCOORD_OFFSET      12 // the tangent frame follows the last attribute
+
+static const VertexBufferAttribute* FindAttribute(const VertexBufferLayout& layout, u8 location)
+{
+    for (u32 i = 0; i < layout.attributes.size(); ++i)
+    {
+        if (layout.attributes[i].location == location)
+            return &layout.attributes[i];
+    }
+    return nullptr;
+}
+
+static vec3 ReadFloat3(const std::vector<float>& vertices, u32 vertexBase, const VertexBufferAttribute* attribute)
+{
+    const float* p = &vertices[vertexBase + attribute->offset / sizeof(float)];
+    return vec3(p[0], p[1], p[2]);
+}
+
+static void WriteSnorm16(u8* dst, const float* values, u32 count)
+{
+    for (u32 i = 0; i < count; ++i)
+    {
+        u16 packed = packSnorm1x16(values[i]);
+        memcpy(dst + i * sizeof(u16), &packed, sizeof(u16));
+    }
+}
+
+static vec2 OctEncode(vec3 n)
+{
+    n /= (std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z));
+    vec2 e = vec2(n.x, n.y);
+    if (n.z < 0.f)
+    {
+        const vec2 signs = vec2(e.x >= 0.f ? 1.f : -1.f, e.y >= 0.f ? 1.f : -1.f);
+        e = (vec2(1.f) - abs(vec2(e.y, e.x))) * signs;
+    }
+    return e;
+}
+
+static vec3 OctDecode(vec2 e)
+{
+    vec3 n = vec3(e.x, e.y, 1.f - std::fabs(e.x) - std::fabs(e.y));
+    const float t = std::fmax(-n.z, 0.f);
+    n.x += n.x >= 0.f ? -t : t;
+    n.y += n.y >= 0.f ? -t : t;
+    return normalize(n);
+}
+
+// Any tangent basis around a normal, for vertices without one (Duff et al. 2017)
+static void OrthonormalBasis(vec3 n, vec3& tangent, vec3& bitangent)
+{
+    const float sign = n.z >= 0.f ? 1.f : -1.f;
+    const float a = -1.f / (sign + n.z);
+    const float b = n.x * n.y * a;
+    tangent = vec3(1.f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+    bitangent = vec3(b, sign + n.y * n.y * a, -n.y);
+}
+
+static quat EncodeTangentFrame(vec3 normal, vec3 tangent, vec3 bitangent)
+{
+    // orthonormal right handed basis, the handedness of the original one goes to the sign of w
+    normal = normalize(normal);
+    tangent = normalize(tangent - normal * dot(normal, tangent));
+    const vec3 orthoBitangent = cross(normal, tangent);
+    const float handedness = dot(orthoBitangent, bitangent) < 0.f ? -1.f : 1.f;
+
+    quat q = normalize(quat_cast(mat3(tangent, orthoBitangent, normal)));
+    if (q.w < 0.f)
+        q = -q; // same rotation, keeps w free for the sign
+
+    // w must not quantize to zero or the sign would be lost
+    const float minW = 1.f / 32767.f;
+    if (q.w < minW)
+    {
+        const float xyzScale = std::sqrt(1.f - minW * minW);
+        q = quat(minW, q.x * xyzScale, q.y * xyzScale, q.z * xyzScale);
+    }
+
+    if (handedness < 0.f)
+        q.w = -q.w;
+    return q;
+}
+
+void CompressSubmeshVertices(Submesh& submesh, const std::vector<float>& vertices, const VertexBufferLayout& layout)
+{
+    const VertexBufferAttribute* position = FindAttribute(layout, 0);
+    const VertexBufferAttribute* normal = FindAttribute(layout, 1);
+    const VertexBufferAttribute* texCoord = FindAttribute(layout, 2);
+    const VertexBufferAttribute* tangent = FindAttribute(layout, 3);
+    const VertexBufferAttribute* bitangent = FindAttribute(layout, 4);
+    ASSERT(position, "Vertices need a position to be compressed");
+
+    const u32 strideInFloats = layout.stride / sizeof(float);
+    const u32 vertexCount = vertices.size() / strideInFloats;
+
+    // positions are stored relative to the aabb of the submesh
+    vec3 aabbMin(0.f), aabbMax(0.f);
+    for (u32 i = 0; i < vertexCount; ++i)
+    {
+        const vec3 p = ReadFloat3(vertices, i * strideInFloats, position);
+        aabbMin = i == 0 ? p : min(aabbMin, p);
+        aabbMax = i == 0 ? p : max(aabbMax, p);
+    }
+
+    vec3 halfExtent = (aabbMax - aabbMin) * 0.5f;
+    for (u32 c = 0; c < 3; ++c)
+    {
+        if (halfExtent[c] <= 0.f)
+            halfExtent[c] = 1.f; // flat submesh, any scale works
+    }
+
+    submesh.positionScale = halfExtent;
+    submesh.positionBias = (aabbMin + aabbMax) * 0.5f;
+
+    // compressed format
+    VertexBufferLayout compressedLayout = {};
+    compressedLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, COMPRESSED_POSITION_OFFSET, GL_SHORT, true });
+    compressedLayout.attributes.push_back(VertexBufferAttribute{ 1, 2, COMPRESSED_NORMAL_OFFSET, GL_SHORT, true });
+    compressedLayout.stride = COMPRESSED_TEXCOORD_OFFSET;
+    if (texCoord)
+    {
+        compressedLayout.attributes.push_back(VertexBufferAttribute{ 2, 2, COMPRESSED_TEXCOORD_OFFSET, GL_HALF_FLOAT, false });
+        compressedLayout.stride += 2 * sizeof(u16);
+    }
+
+    // always present so every compressed submesh feeds the normal mapping inputs
+    const u32 tangentFrameOffset = compressedLayout.stride;
+    compressedLayout.attributes.push_back(VertexBufferAttribute{ 3, 4, (u8)tangentFrameOffset, GL_SHORT, true });
+    compressedLayout.stride += 4 * sizeof(u16);
+    const bool hasTangentSpace = texCoord && tangent && bitangent;
+
+    std::vector<u8> compressed(vertexCount * compressedLayout.stride, 0);
+    for (u32 i = 0; i < vertexCount; ++i)
+    {
+        const u32 src = i * strideInFloats;
+        u8* dst = &compressed[i * compressedLayout.stride];
+
+        const vec3 p = (ReadFloat3(vertices, src, position) - submesh.positionBias) / submesh.positionScale;
+        WriteSnorm16(dst + COMPRESSED_POSITION_OFFSET, &p[0], 3);
+
+        // the importers always give normals, anything else gets a default one
+        const vec3 n = normal ? ReadFloat3(vertices, src, normal) : vec3(0.f, 0.f, 1.f);
+        const vec2 octNormal = OctEncode(n);
+        WriteSnorm16(dst + COMPRESSED_NORMAL_OFFSET, &octNormal[0], 2);
+
+        if (texCoord)
+        {
+            const float* uv = &vertices[src + texCoord->offset / sizeof(float)];
+            const u32 packed = packHalf2x16(vec2(uv[0], uv[1]));
+            memcpy(dst + COMPRESSED_TEXCOORD_OFFSET, &packed, sizeof(u32));
+        }
+
+        vec3 t, b;
+        if (hasTangentSpace)
+        {
+            t = ReadFloat3(vertices, src, tangent);
+            b = ReadFloat3(vertices, src, bitangent);
+        }
+        else
+        {
+            OrthonormalBasis(normalize(n), t, b);
+        }
+
+        const quat q = EncodeTangentFrame(n, t, b);
+        const vec4 frame = vec4(q.x, q.y, q.z, q.w);
+        WriteSnorm16(dst + tangentFrameOffset, &frame[0], 4);
+    }
+
+    submesh.vertexBufferLayout = compressedLayout;
+    submesh.vertices.swap(compressed);
+}
+
+u32 SubmeshVertexCount(const Submesh& submesh)
+{
+    return submesh.vertices.size() / submesh.vertexBufferLayout.stride;
+}
+
+vec4 ReadVertexAttribute(const Submesh& submesh, u32 vertexIdx, u8 location)
+{
+    const VertexBufferAttribute* attribute = FindAttribute(submesh.vertexBufferLayout, location);
+    if (!attribute)
+        return vec4(0.f);
+
+    const u8* src = &submesh.vertices[vertexIdx * submesh.vertexBufferLayout.stride + attribute->offset];
+
+    vec4 value(0.f);
+    for (u32 c = 0; c < attribute->componentCount; ++c)
+    {
+        switch (attribute->type)
+        {
+            case GL_FLOAT:
+            {
+                memcpy(&value[c], src + c * sizeof(float), sizeof(float));
+            } break;
+            case GL_HALF_FLOAT:
+            {
+                u16 h;
+                memcpy(&h, src + c * sizeof(u16), sizeof(u16));
+                value[c] = unpackHalf1x16(h);
+            } break;
+            case GL_SHORT:
+            {
+                u16 s;
+                memcpy(&s, src + c * sizeof(u16), sizeof(u16));
+                value[c] = attribute->normalized ? unpackSnorm1x16(s) : (float)(i16)s;
+            } break;
+            default: assert(0 && "unsupported vertex attribute type");
+        }
+    }
+    return value;
+}
+
+vec3 ReadVertexPosition(const Submesh& submesh, u32 vertexIdx)
+{
+    return vec3(ReadVertexAttribute(submesh, vertexIdx, 0)) * submesh.positionScale + submesh.positionBias;
+}
+
+vec3 ReadVertexNormal(const Submesh& submesh, u32 vertexIdx)
+{
+    const VertexBufferAttribute* attribute = FindAttribute(submesh.vertexBufferLayout, 1);
+    const vec4 value = ReadVertexAttribute(submesh, vertexIdx, 1);
+    if (attribute && attribute->componentCount == 2)
+        return OctDecode(vec2(value));
+    return vec3(value);
+}
+
+void ReadVertexTangentFrame(const Submesh& submesh, u32 vertexIdx, vec3& tangent, vec3& bitangent)
+{
+    // same decoding as TangentFrame() in shaders.glsl
+    const vec4 frame = ReadVertexAttribute(submesh, vertexIdx, 3);
+    const quat q = quat(std::fabs(frame.w), frame.x, frame.y, frame.z);
+    tangent = q * vec3(1.f, 0.f, 0.f);
+    bitangent = q * vec3(0.f, 1.f, 0.f) * (frame.w < 0.f ? -1.f : 1.f);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "engine.h"
+
+// Float vertex layout produced by the importers, locations:
+// 0 position (3), 1 normal (3), 2 texcoord (2), 3 tangent (3), 4 bitangent (3)
+//
+// Compressed layout stored in the submesh:
+// 0 position: snorm16 x3 relative to the submesh aabb (see Submesh::positionScale)
+// 1 normal:   snorm16 x2 octahedral
+// 2 texcoord: half x2
+// 3 tangent frame: snorm16 x4 quaternion, the sign of w is the bitangent sign.
+//   Always present, built around the normal when the vertices have no tangents.
+void CompressSubmeshVertices(Submesh& submesh, const std::vector<float>& vertices, const VertexBufferLayout& layout);
+
+u32  SubmeshVertexCount(const Submesh& submesh);
+vec4 ReadVertexAttribute(const Submesh& submesh, u32 vertexIdx, u8 location); // unpacked, not dequantized
+vec3 ReadVertexPosition(const Submesh& submesh, u32 vertexIdx);
+vec3 ReadVertexNormal(const Submesh& submesh, u32 vertexIdx);
+void ReadVertexTangentFrame(const Submesh& submesh, u32 vertexIdx, vec3& tangent, vec3& bitangent);
@@ -0,0 +1,93 @@
+#include "tests.h"
+#include "buddy_allocator.h"
+
+struct BuddyBlock
+{
+    u32 offset;
+    u32 size;
+};
+
+static bool Overlap(BuddyBlock a, BuddyBlock b)
+{
+    return a.offset < b.offset + b.size && b.offset < a.offset + a.size;
+}
+
+// The whole range is free again when a single block of maxOrder is left
+static bool IsFullyFree(const BuddyAllocator& allocator)
+{
+    for (u32 order = 0; order < allocator.maxOrder; ++order)
+        if (!allocator.freeBlocks[order].empty())
+            return false;
+    return allocator.freeBlocks[allocator.maxOrder].size() == 1 && allocator.freeBlocks[allocator.maxOrder][0] == 0;
+}
+
+TEST(BuddyAllocatorRoundsCapacityAndSizesUp)
+{
+    BuddyAllocator allocator = CreateBuddyAllocator(1000, 16);
+    CHECK(BuddyCapacity(allocator) == 1024);
+
+    // 17 units take a 32 unit block, the next allocation starts after it
+    const u32 first = BuddyAllocate(allocator, 17);
+    const u32 second = BuddyAllocate(allocator, 1);
+    CHECK(first != BUDDY_ALLOCATION_FAILED && first % 32 == 0);
+    CHECK(second != BUDDY_ALLOCATION_FAILED && second % 16 == 0);
+    CHECK(!Overlap(BuddyBlock{ first, 32 }, BuddyBlock{ second, 16 }));
+}
+
+TEST(BuddyAllocatorFailsWhenFull)
+{
+    BuddyAllocator allocator = CreateBuddyAllocator(256, 64);
+    for (u32 i = 0; i < 4; ++i)
+        CHECK(BuddyAllocate(allocator, 64) != BUDDY_ALLOCATION_FAILED);
+    CHECK(BuddyAllocate(allocator, 1) == BUDDY_ALLOCATION_FAILED);
+
+    BuddyAllocator small = CreateBuddyAllocator(256, 64);
+    CHECK(BuddyAllocate(small, 257) == BUDDY_ALLOCATION_FAILED);
+}
+
+TEST(BuddyAllocatorMergesFreedBuddies)
+{
+    BuddyAllocator allocator = CreateBuddyAllocator(4096, 8);
+
+    // mixed sizes, freed in a different order than they were allocated
+    const u32 sizes[] = { 8, 100, 33, 512, 8, 1000, 64, 9, 200, 16 };
+    std::vector<BuddyBlock> blocks;
+    for (u32 size : sizes)
+    {
+        const u32 offset = BuddyAllocate(allocator, size);
+        CHECK(offset != BUDDY_ALLOCATION_FAILED && offset + size <= BuddyCapacity(allocator));
+        for (const BuddyBlock& block : blocks)
+            CHECK(!Overlap(block, BuddyBlock{ offset, size }));
+        blocks.push_back(BuddyBlock{ offset, size });
+    }
+
+    for (u32 i = 0; i < blocks.size(); i += 2)
+        BuddyFree(allocator, blocks[i].offset, blocks[i].size);
+    for (u32 i = 1; i < blocks.size(); i += 2)
+        BuddyFree(allocator, blocks[i].offset, blocks[i].size);
+
+    CHECK(IsFullyFree(allocator));
+    CHECK(BuddyAllocate(allocator, 4096) == 0);
+}
+
+TEST(BuddyAllocatorGrowsAroundLiveBlocks)
+{
+    BuddyAllocator allocator = CreateBuddyAllocator(128, 32);
+    const u32 live = BuddyAllocate(allocator, 128);
+    CHECK(live == 0);
+    CHECK(BuddyAllocate(allocator, 32) == BUDDY_ALLOCATION_FAILED);
+
+    // the old range is the lower half, the new upper half is free
+    BuddyGrow(allocator);
+    CHECK(BuddyCapacity(allocator) == 256);
+    CHECK(BuddyAllocate(allocator, 128) == 128);
+
+    BuddyFree(allocator, 128, 128);
+    BuddyFree(allocator, live, 128);
+    CHECK(IsFullyFree(allocator));
+
+    // growing a free range keeps a single free block
+    BuddyGrow(allocator);
+    CHECK(IsFullyFree(allocator));
+    CHECK(BuddyAllocate(allocator, 512) == 0);
+}
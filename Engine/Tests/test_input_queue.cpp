@@ -0,0 +1,140 @@
+#include "tests.h"
+
+#include <thread>
+
+static InputEvent KeyEvent(u32 code, ButtonState state)
+{
+    InputEvent event = {};
+    event.type = INPUT_EVENT_KEY;
+    event.code = code;
+    event.state = state;
+    return event;
+}
+
+static InputEvent MouseEvent(InputEventType type, glm::vec2 mousePos, glm::vec2 scroll = glm::vec2(0.f))
+{
+    InputEvent event = {};
+    event.type = type;
+    event.mousePos = mousePos;
+    event.scroll = scroll;
+    return event;
+}
+
+TEST(InputQueueCoalescesMovesAndScrolls)
+{
+    InputQueue* queue = new InputQueue();
+
+    PushInputEvent(*queue, MouseEvent(INPUT_EVENT_MOUSE_MOVE, glm::vec2(1.f, 1.f)));
+    PushInputEvent(*queue, MouseEvent(INPUT_EVENT_MOUSE_SCROLL, glm::vec2(2.f, 2.f), glm::vec2(0.f, 1.f)));
+    PushInputEvent(*queue, MouseEvent(INPUT_EVENT_MOUSE_MOVE, glm::vec2(3.f, 4.f)));
+    PushInputEvent(*queue, MouseEvent(INPUT_EVENT_MOUSE_SCROLL, glm::vec2(3.f, 4.f), glm::vec2(0.f, 2.f)));
+
+    // nothing is published before a flush or a button event
+    InputEvent event;
+    CHECK(!PopInputEvent(*queue, event));
+
+    // the click comes after the move, at the last cursor position
+    InputEvent click = KeyEvent(LEFT, BUTTON_PRESS);
+    click.type = INPUT_EVENT_MOUSE_BUTTON;
+    PushInputEvent(*queue, click);
+
+    CHECK(PopInputEvent(*queue, event) && event.type == INPUT_EVENT_MOUSE_MOVE && event.mousePos == glm::vec2(3.f, 4.f));
+    CHECK(PopInputEvent(*queue, event) && event.type == INPUT_EVENT_MOUSE_SCROLL && event.scroll == glm::vec2(0.f, 3.f));
+    CHECK(PopInputEvent(*queue, event) && event.type == INPUT_EVENT_MOUSE_BUTTON && event.state == BUTTON_PRESS);
+    CHECK(!PopInputEvent(*queue, event));
+
+    delete queue;
+}
+
+TEST(InputQueueKeepsWhatDoesNotFit)
+{
+    InputQueue* queue = new InputQueue();
+
+    const u32 eventCount = INPUT_QUEUE_SIZE + 40;
+    for (u32 i = 0; i < eventCount; ++i)
+        PushInputEvent(*queue, KeyEvent(i, BUTTON_PRESS));
+    CHECK(queue->overflow.size() == eventCount - INPUT_QUEUE_SIZE);
+
+    // the ring drains in order, the overflow follows after the next flush
+    u32 popped = 0;
+    InputEvent event;
+    while (PopInputEvent(*queue, event))
+        CHECK(event.code == popped++);
+    CHECK(popped == INPUT_QUEUE_SIZE);
+
+    FlushInputEvents(*queue);
+    CHECK(queue->overflow.empty());
+    while (PopInputEvent(*queue, event))
+        CHECK(event.code == popped++);
+    CHECK(popped == eventCount);
+
+    delete queue;
+}
+
+TEST(InputQueueHandsEventsToAnotherThread)
+{
+    InputQueue* queue = new InputQueue();
+    const u32 eventCount = 100000;
+
+    std::atomic<bool> inOrder{ true };
+    std::thread consumer([queue, &inOrder]() {
+        u32 expected = 0;
+        InputEvent event;
+        while (expected < eventCount)
+        {
+            if (!PopInputEvent(*queue, event))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            if (event.code != expected++)
+                inOrder = false;
+        }
+    });
+
+    // like the GLFW callbacks: a burst of events, then a flush per frame
+    for (u32 i = 0; i < eventCount; ++i)
+    {
+        PushInputEvent(*queue, KeyEvent(i, i & 1 ? BUTTON_RELEASE : BUTTON_PRESS));
+        if (i % 1000 == 999)
+            FlushInputEvents(*queue);
+    }
+    while (!queue->overflow.empty())
+    {
+        std::this_thread::yield();
+        FlushInputEvents(*queue);
+    }
+
+    consumer.join();
+    CHECK(inOrder);
+
+    delete queue;
+}
+
+TEST(ConsumeInputEventsAdvancesButtonStates)
+{
+    InputQueue* queue = new InputQueue();
+    Input input = {};
+
+    PushInputEvent(*queue, KeyEvent(K_W, BUTTON_PRESS));
+    PushInputEvent(*queue, MouseEvent(INPUT_EVENT_MOUSE_MOVE, glm::vec2(10.f, 5.f)));
+    PushInputEvent(*queue, MouseEvent(INPUT_EVENT_MOUSE_MOVE, glm::vec2(12.f, 8.f)));
+    PushInputEvent(*queue, MouseEvent(INPUT_EVENT_MOUSE_SCROLL, glm::vec2(12.f, 8.f), glm::vec2(0.f, -1.f)));
+    FlushInputEvents(*queue);
+    ConsumeInputEvents(*queue, input);
+
+    CHECK(input.keys[K_W] == BUTTON_PRESS);
+    CHECK(input.mousePos == glm::vec2(12.f, 8.f) && input.mouseDelta == glm::vec2(12.f, 8.f));
+    CHECK(input.mouseScroll == glm::vec2(0.f, -1.f));
+
+    // the next frame moves the states along and clears the deltas
+    PushInputEvent(*queue, KeyEvent(K_S, BUTTON_RELEASE));
+    ConsumeInputEvents(*queue, input);
+    CHECK(input.keys[K_W] == BUTTON_PRESSED && input.keys[K_S] == BUTTON_RELEASE);
+    CHECK(input.mouseDelta == glm::vec2(0.f) && input.mouseScroll == glm::vec2(0.f));
+
+    ConsumeInputEvents(*queue, input);
+    CHECK(input.keys[K_S] == BUTTON_IDLE);
+
+    delete queue;
+}
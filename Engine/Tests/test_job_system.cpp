@@ -0,0 +1,129 @@
+#include "tests.h"
+#include "job_system.h"
+
+#include <chrono>
+#include <thread>
+
+#define TEST_WORKER_COUNT 3
+
+TEST(JobCounterWaitsForEveryJob)
+{
+    InitJobSystem(TEST_WORKER_COUNT);
+
+    std::atomic<u32> done{ 0 };
+    JobCounter counter;
+    for (u32 i = 0; i < 100; ++i)
+        RunJob([&done]() { done++; }, &counter);
+
+    WaitForCounter(&counter);
+    CHECK(IsJobCounterDone(&counter));
+    CHECK(done == 100);
+
+    // an untouched counter is already done, waiting on it returns at once
+    JobCounter empty;
+    CHECK(IsJobCounterDone(&empty));
+    WaitForCounter(&empty);
+
+    ShutdownJobSystem();
+}
+
+TEST(JobsRunAfterTheirDependency)
+{
+    InitJobSystem(TEST_WORKER_COUNT);
+
+    std::atomic<u32> firstDone{ 0 };
+    std::atomic<u32> seenByContinuations{ 0 };
+    JobCounter first, second;
+    for (u32 i = 0; i < 8; ++i)
+    {
+        RunJob([&firstDone]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            firstDone++;
+        }, &first);
+    }
+    for (u32 i = 0; i < 8; ++i)
+        RunJobAfter(&first, [&]() { seenByContinuations += firstDone; }, &second);
+
+    WaitForCounter(&second);
+    CHECK(seenByContinuations == 8 * 8);
+
+    // a dependency that is already done runs the job right away
+    std::atomic<u32> late{ 0 };
+    JobCounter third;
+    RunJobAfter(&first, [&late]() { late++; }, &third);
+    WaitForCounter(&third);
+    CHECK(late == 1);
+
+    ShutdownJobSystem();
+}
+
+TEST(ParallelForVisitsEveryItemOnce)
+{
+    InitJobSystem(TEST_WORKER_COUNT);
+
+    const u32 counts[] = { 0, 1, 7, 64, 1000 };
+    for (u32 count : counts)
+    {
+        std::vector<std::atomic<u32>> visits(count);
+        for (std::atomic<u32>& v : visits)
+            v = 0;
+
+        // nested: each range runs another ParallelFor from inside a job
+        ParallelFor(count, 16, [&visits](u32 begin, u32 end) {
+            ParallelFor(end - begin, 3, [&visits, begin](u32 nestedBegin, u32 nestedEnd) {
+                for (u32 i = begin + nestedBegin; i < begin + nestedEnd; ++i)
+                    visits[i]++;
+            });
+        });
+
+        bool onceEach = true;
+        for (const std::atomic<u32>& v : visits)
+            onceEach = onceEach && v == 1;
+        CHECK(onceEach);
+    }
+
+    ShutdownJobSystem();
+}
+
+TEST(FrameWaitsSkipBackgroundJobs)
+{
+    InitJobSystem(TEST_WORKER_COUNT);
+
+    const std::thread::id mainThread = std::this_thread::get_id();
+    std::atomic<bool> inFrameWait{ false };
+    std::atomic<u32>  backgroundOnMainThread{ 0 };
+
+    JobCounter background;
+    for (u32 frame = 0; frame < 10; ++frame)
+    {
+        // the workers steal the oldest job first, the frame job, and leave
+        // the main thread alone with the background ones while it waits
+        JobCounter frameJobs;
+        std::atomic<u32> done{ 0 };
+        RunJob([&done]() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            done++;
+        }, &frameJobs);
+
+        for (u32 i = 0; i < 8; ++i)
+        {
+            RunJob([&]() {
+                if (inFrameWait && std::this_thread::get_id() == mainThread)
+                    backgroundOnMainThread++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }, &background, JobKind_Background);
+        }
+
+        inFrameWait = true;
+        WaitForCounter(&frameJobs);
+        inFrameWait = false;
+        CHECK(done == 1);
+    }
+    CHECK(backgroundOnMainThread == 0);
+
+    // waiting on the background counter itself runs them on any thread
+    WaitForCounter(&background);
+    CHECK(IsJobCounterDone(&background));
+
+    ShutdownJobSystem();
+}
@@ -0,0 +1,49 @@
+//
+// test_main.cpp: Runs the registered tests, the exit code is the number of failed ones.
+//
+
+#include "tests.h"
+
+static std::vector<TestCase>& RegisteredTests()
+{
+    // built on first use, the tests register themselves during static initialization
+    static std::vector<TestCase> tests;
+    return tests;
+}
+
+static u32 FailedCheckCount = 0;
+
+bool RegisterTest(const char* name, TestFunction function)
+{
+    RegisteredTests().push_back(TestCase{ name, function });
+    return true;
+}
+
+void CheckCondition(bool condition, const char* expression, const char* file, int line)
+{
+    if (!condition)
+    {
+        ELOG("%s(%d): CHECK(%s) failed", file, line, expression);
+        FailedCheckCount++;
+    }
+}
+
+int main()
+{
+    const std::vector<TestCase>& tests = RegisteredTests();
+
+    u32 failedTestCount = 0;
+    for (const TestCase& test : tests)
+    {
+        const u32 failedChecksBefore = FailedCheckCount;
+        test.function();
+
+        const bool passed = FailedCheckCount == failedChecksBefore;
+        ILOG("%s %s", passed ? "[  OK  ]" : "[FAILED]", test.name);
+        if (!passed)
+            failedTestCount++;
+    }
+
+    ILOG("%u of %u tests failed", failedTestCount, (u32)tests.size());
+    return (int)failedTestCount;
+}
@@ -0,0 +1,215 @@
+#include "tests.h"
+#include "mesh_cache.h"
+
+#define TEST_MODEL_PATH  "test_mesh_cache.obj"
+#define TEST_CACHE_PATH  TEST_MODEL_PATH ".0000002a.meshcache"
+#define TEST_IMPORT_FLAGS 0x2A
+
+static const u8 TestPositions[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+static const u8 TestIndices[] = { 0, 0, 1, 0, 2, 0 };
+
+static void WriteTestFile(const char* path, const void* data, u64 size)
+{
+    FILE* file = fopen(path, "wb");
+    CHECK(file != NULL);
+    if (file)
+    {
+        fwrite(data, 1, size, file);
+        fclose(file);
+    }
+}
+
+static std::vector<u8> ReadTestFile(const char* path)
+{
+    std::vector<u8> bytes;
+    MappedFile file = MapFile(path);
+    if (file.data)
+        bytes.assign(file.data, file.data + file.size);
+    UnmapFile(file);
+    return bytes;
+}
+
+// One material, two submeshes, the second with a meshlet, and a node table
+// where both submeshes are referenced twice, written to the cache of a
+// freshly created source file
+static ImportedModel WriteTestMeshCache()
+{
+    WriteTestFile(TEST_MODEL_PATH, "o test", 6);
+
+    ImportedModel model;
+    Material material = {};
+    material.name = "test material";
+    material.albedo = vec3(0.25f, 0.5f, 1.f);
+    material.smoothness = 0.75f;
+    model.materials.push_back(material);
+    model.texturePaths.resize(MATERIAL_TEXTURE_COUNT);
+    model.texturePaths[0] = "albedo.png";
+    model.texturePaths[3] = "normals.png";
+
+    for (u32 i = 0; i < 2; ++i)
+    {
+        Submesh submesh = {};
+        submesh.vertexBufferLayout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0, GL_SHORT, true });
+        submesh.vertexBufferLayout.stride = 8;
+        submesh.vertices.assign(3 * 8, (u8)(i + 1));
+        submesh.indices = { 0, 1, 2 };
+        submesh.positionScale = vec3(2.f, 3.f, 4.f);
+        submesh.positionBias = vec3(-1.f);
+        submesh.indexType = GL_UNSIGNED_SHORT;
+        if (i == 1)
+            submesh.meshlets.push_back(Meshlet{ vec3(1.f), 2.f, vec3(0.f, 0.f, 1.f), 0.5f, 0, 3 });
+
+        model.mesh.submeshes.push_back(submesh);
+        model.submeshMaterials.push_back(0);
+    }
+
+    model.geometry.resize(2);
+    for (SubmeshGeometryData& geometry : model.geometry)
+    {
+        geometry.positions = TestPositions;
+        geometry.positionsSize = sizeof(TestPositions);
+        geometry.indices = TestIndices;
+        geometry.indicesSize = sizeof(TestIndices);
+    }
+
+    // a root without meshes, a child drawing both submeshes and a grandchild drawing them again
+    for (u32 i = 0; i < 3; ++i)
+    {
+        ImportedNode node = {};
+        node.transform.position = vec3((f32)i, 0.f, 0.f);
+        node.transform.scale = vec3(0.5f);
+        node.parentIdx = i == 0 ? UINT32_MAX : i - 1;
+        node.firstMesh = i == 0 ? 0 : (i - 1) * 2;
+        node.meshCount = i == 0 ? 0 : 2;
+        model.nodes.push_back(node);
+    }
+    model.nodeMeshes = { 0, 1, 1, 0 };
+
+    WriteMeshCache(TEST_MODEL_PATH, TEST_IMPORT_FLAGS, model);
+    return model;
+}
+
+static void RemoveTestFiles()
+{
+    remove(TEST_CACHE_PATH);
+    remove(TEST_MODEL_PATH);
+}
+
+TEST(MeshCacheRoundTrip)
+{
+    const ImportedModel written = WriteTestMeshCache();
+
+    // the write went through a temporary file, it is gone
+    FILE* temp = fopen(TEST_CACHE_PATH ".tmp", "rb");
+    CHECK(temp == NULL);
+    if (temp)
+        fclose(temp);
+
+    ImportedModel read;
+    CHECK(ReadMeshCache(TEST_MODEL_PATH, TEST_IMPORT_FLAGS, read));
+    CHECK(read.cacheFile.data != NULL);
+
+    CHECK(read.materials.size() == 1 && read.materials[0].name == "test material");
+    CHECK(read.materials[0].albedo == written.materials[0].albedo && read.materials[0].smoothness == 0.75f);
+    CHECK(read.materials[0].albedoTextureIdx == UINT32_MAX && read.materials[0].normalsTextureIdx == UINT32_MAX);
+    CHECK(read.texturePaths == written.texturePaths);
+    CHECK(read.submeshMaterials == written.submeshMaterials);
+
+    CHECK(read.mesh.submeshes.size() == 2 && read.geometry.size() == 2);
+    for (u32 i = 0; i < read.mesh.submeshes.size() && i < 2; ++i)
+    {
+        const Submesh& a = written.mesh.submeshes[i];
+        const Submesh& b = read.mesh.submeshes[i];
+        CHECK(b.vertexBufferLayout.stride == a.vertexBufferLayout.stride);
+        CHECK(b.vertexBufferLayout.attributes.size() == 1);
+        CHECK(b.vertexBufferLayout.attributes[0].type == GL_SHORT && b.vertexBufferLayout.attributes[0].normalized);
+        CHECK(b.vertices == a.vertices && b.indices == a.indices);
+        CHECK(b.positionScale == a.positionScale && b.positionBias == a.positionBias);
+        CHECK(b.indexType == GL_UNSIGNED_SHORT);
+        CHECK(b.meshlets.size() == a.meshlets.size());
+        if (!b.meshlets.empty())
+            CHECK(b.meshlets[0].indexCount == 3 && b.meshlets[0].coneCutoff == 0.5f);
+
+        // the streams point into the mapping
+        const SubmeshGeometryData& geometry = read.geometry[i];
+        const u8* mappingEnd = read.cacheFile.data + read.cacheFile.size;
+        CHECK(geometry.positions >= read.cacheFile.data && geometry.positions + geometry.positionsSize <= mappingEnd);
+        CHECK(geometry.positionsSize == sizeof(TestPositions) && memcmp(geometry.positions, TestPositions, sizeof(TestPositions)) == 0);
+        CHECK(geometry.indicesSize == sizeof(TestIndices) && memcmp(geometry.indices, TestIndices, sizeof(TestIndices)) == 0);
+    }
+
+    CHECK(read.nodes.size() == 3 && read.nodeMeshes == written.nodeMeshes);
+    for (u32 i = 0; i < read.nodes.size() && i < 3; ++i)
+    {
+        const ImportedNode& a = written.nodes[i];
+        const ImportedNode& b = read.nodes[i];
+        CHECK(b.transform.position == a.transform.position && b.transform.rotation == a.transform.rotation && b.transform.scale == a.transform.scale);
+        CHECK(b.parentIdx == a.parentIdx && b.firstMesh == a.firstMesh && b.meshCount == a.meshCount);
+    }
+
+    UnmapFile(read.cacheFile);
+    RemoveTestFiles();
+}
+
+TEST(MeshCacheRejectsStaleFiles)
+{
+    WriteTestMeshCache();
+    const std::vector<u8> cache = ReadTestFile(TEST_CACHE_PATH);
+    CHECK(!cache.empty());
+
+    // other flags have their own file, even copied over the header keeps them apart
+    ImportedModel otherFlags = {};
+    CHECK(!ReadMeshCache(TEST_MODEL_PATH, TEST_IMPORT_FLAGS + 1, otherFlags));
+    WriteTestFile(TEST_MODEL_PATH ".0000002b.meshcache", cache.data(), cache.size());
+    CHECK(!ReadMeshCache(TEST_MODEL_PATH, TEST_IMPORT_FLAGS + 1, otherFlags));
+    CHECK(otherFlags.mesh.submeshes.empty() && otherFlags.cacheFile.data == NULL);
+    remove(TEST_MODEL_PATH ".0000002b.meshcache");
+
+    // cut short, like a write that crashed halfway
+    WriteTestFile(TEST_CACHE_PATH, cache.data(), cache.size() / 2);
+    ImportedModel truncated;
+    CHECK(!ReadMeshCache(TEST_MODEL_PATH, TEST_IMPORT_FLAGS, truncated));
+
+    WriteTestFile(TEST_CACHE_PATH, "", 0);
+    ImportedModel empty;
+    CHECK(!ReadMeshCache(TEST_MODEL_PATH, TEST_IMPORT_FLAGS, empty));
+
+    RemoveTestFiles();
+    ImportedModel missing;
+    CHECK(!ReadMeshCache(TEST_MODEL_PATH, TEST_IMPORT_FLAGS, missing));
+}
+
+TEST(MeshCacheSurvivesCorruptedBytes)
+{
+    WriteTestMeshCache();
+    const std::vector<u8> cache = ReadTestFile(TEST_CACHE_PATH);
+
+    // every byte in turn, sizes and counts included: a read may fail but it
+    // must stay inside the mapping
+    for (u32 i = 0; i < cache.size(); ++i)
+    {
+        std::vector<u8> corrupted = cache;
+        corrupted[i] ^= 0xFF;
+        WriteTestFile(TEST_CACHE_PATH, corrupted.data(), corrupted.size());
+
+        ImportedModel model;
+        if (ReadMeshCache(TEST_MODEL_PATH, TEST_IMPORT_FLAGS, model))
+        {
+            CHECK(model.mesh.submeshes.size() == 2);
+
+            // LoadModelInstances follows the node table without checks
+            for (u32 n = 0; n < model.nodes.size(); ++n)
+            {
+                const ImportedNode& node = model.nodes[n];
+                CHECK(node.parentIdx == UINT32_MAX || node.parentIdx < n);
+                CHECK((u64)node.firstMesh + node.meshCount <= model.nodeMeshes.size());
+            }
+            for (u32 submeshIdx : model.nodeMeshes)
+                CHECK(submeshIdx < 2);
+
+            UnmapFile(model.cacheFile);
+        }
+    }
+
+    RemoveTestFiles();
+}
@@ -0,0 +1,49 @@
+//
+// test_stubs.cpp: The functions of the platform layer and the engine that the
+// tested modules call, without a window, a GL context or assimp behind them.
+//
+
+#include "assimp_model_loading.h"
+
+#include <chrono>
+#include <stb_image.h>
+
+void LogString(const char* str)
+{
+    printf("%s\n", str);
+}
+
+f64 GetTimeSeconds()
+{
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The real one is in assimp_model_loading.cpp, which needs assimp
+u32& MaterialTextureIdx(Material& material, u32 slot)
+{
+    switch (slot)
+    {
+        case 0:  return material.albedoTextureIdx;
+        case 1:  return material.emissiveTextureIdx;
+        case 2:  return material.specularTextureIdx;
+        case 3:  return material.normalsTextureIdx;
+        default: return material.bumpTextureIdx;
+    }
+}
+
+// Textures are only cooked, never created
+void* GetGLProcAddress(const char* name)
+{
+    return NULL;
+}
+
+GLuint CreateTexture2DFromImage(Image image)
+{
+    return 0;
+}
+
+void FreeImage(Image image)
+{
+    stbi_image_free(image.pixels);
+}
@@ -0,0 +1,284 @@
+#include "tests.h"
+#include "texture_cooker.h"
+#include "gl_extensions.h"
+
+#include <stb_image_write.h>
+
+#define TEST_WIDTH  37 // not a multiple of the block size
+#define TEST_HEIGHT 21
+
+// Reference decoders of the block formats, as the gpu reads them
+
+static vec3 UnpackColor565(u16 color)
+{
+    const u32 r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+    return vec3((f32)((r << 3) | (r >> 2)), (f32)((g << 2) | (g >> 4)), (f32)((b << 3) | (b >> 2)));
+}
+
+static void DecodeBC1Block(const u8* block, vec3 colors[16])
+{
+    u16 color0, color1;
+    u32 indices;
+    memcpy(&color0, block, 2);
+    memcpy(&color1, block + 2, 2);
+    memcpy(&indices, block + 4, 4);
+
+    const vec3 e0 = UnpackColor565(color0), e1 = UnpackColor565(color1);
+    vec3 palette[4] = { e0, e1, (2.f * e0 + e1) / 3.f, (e0 + 2.f * e1) / 3.f };
+    if (color0 <= color1)
+    {
+        palette[2] = (e0 + e1) * 0.5f;
+        palette[3] = vec3(0.f);
+    }
+    for (u32 i = 0; i < 16; ++i)
+        colors[i] = palette[(indices >> (2 * i)) & 3];
+}
+
+static void DecodeBC4Block(const u8* block, f32 values[16])
+{
+    const f32 e0 = block[0], e1 = block[1];
+    f32 palette[8] = { e0, e1 };
+    if (block[0] > block[1])
+    {
+        for (u32 i = 1; i < 7; ++i)
+            palette[1 + i] = ((7 - i) * e0 + i * e1) / 7.f;
+    }
+    else
+    {
+        for (u32 i = 1; i < 5; ++i)
+            palette[1 + i] = ((5 - i) * e0 + i * e1) / 5.f;
+        palette[6] = 0.f;
+        palette[7] = 255.f;
+    }
+
+    u64 indices = 0;
+    memcpy(&indices, block + 2, 6);
+    for (u32 i = 0; i < 16; ++i)
+        values[i] = palette[(indices >> (3 * i)) & 7];
+}
+
+// Root mean square error of level 0 against the source pixels, over the
+// channels the format keeps
+static f32 Level0Error(const CookedTexture& cooked, const std::vector<u8>& pixels, u32 channels)
+{
+    const u32 blockSize = CompressedBlockSize(cooked.internalFormat);
+    const u32 blocksPerRow = (cooked.size.x + 3) / 4;
+
+    f64 squaredError = 0.0;
+    u32 valueCount = 0;
+    for (i32 by = 0; by < (cooked.size.y + 3) / 4; ++by)
+    {
+        for (i32 bx = 0; bx < (cooked.size.x + 3) / 4; ++bx)
+        {
+            const u8* block = cooked.levels + (by * blocksPerRow + bx) * blockSize;
+
+            // decoded[i][c], channel c of texel i of the block
+            f32 decoded[16][4] = {};
+            vec3 colors[16];
+            f32 values[16];
+            switch (cooked.internalFormat)
+            {
+                case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+                    DecodeBC1Block(block, colors);
+                    for (u32 i = 0; i < 16; ++i)
+                        for (u32 c = 0; c < 3; ++c)
+                            decoded[i][c] = colors[i][c];
+                    break;
+                case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+                    DecodeBC4Block(block, values);
+                    DecodeBC1Block(block + 8, colors);
+                    for (u32 i = 0; i < 16; ++i)
+                    {
+                        for (u32 c = 0; c < 3; ++c)
+                            decoded[i][c] = colors[i][c];
+                        decoded[i][3] = values[i];
+                    }
+                    break;
+                case GL_COMPRESSED_RED_RGTC1:
+                case GL_COMPRESSED_RG_RGTC2:
+                    // one bc4 block per channel
+                    for (u32 c = 0; c * 8 < blockSize; ++c)
+                    {
+                        DecodeBC4Block(block + c * 8, values);
+                        for (u32 i = 0; i < 16; ++i)
+                            decoded[i][c] = values[i];
+                    }
+                    break;
+            }
+
+            for (u32 i = 0; i < 16; ++i)
+            {
+                const i32 x = bx * 4 + (i & 3), y = by * 4 + (i >> 2);
+                if (x >= cooked.size.x || y >= cooked.size.y)
+                    continue;
+                for (u32 c = 0; c < channels; ++c)
+                {
+                    const f64 difference = decoded[i][c] - pixels[(y * cooked.size.x + x) * channels + c];
+                    squaredError += difference * difference;
+                    valueCount++;
+                }
+            }
+        }
+    }
+    return (f32)sqrt(squaredError / valueCount);
+}
+
+// Smooth gradients with some detail, what the encoders see in practice
+static std::vector<u8> TestImage(u32 channels, bool opaque)
+{
+    std::vector<u8> pixels(TEST_WIDTH * TEST_HEIGHT * channels);
+    for (u32 y = 0; y < TEST_HEIGHT; ++y)
+    {
+        for (u32 x = 0; x < TEST_WIDTH; ++x)
+        {
+            u8* pixel = &pixels[(y * TEST_WIDTH + x) * channels];
+            const u8 values[4] = { (u8)(x * 255 / TEST_WIDTH), (u8)(y * 255 / TEST_HEIGHT), (u8)((x * y) & 255), (u8)(opaque ? 255 : (x + y) * 6) };
+            memcpy(pixel, values, channels);
+        }
+    }
+    return pixels;
+}
+
+static void WriteTestImage(const char* path, const std::vector<u8>& pixels, u32 channels)
+{
+    CHECK(stbi_write_png(path, TEST_WIDTH, TEST_HEIGHT, channels, pixels.data(), TEST_WIDTH * channels) != 0);
+}
+
+static void RemoveTestImage(const char* path)
+{
+    remove(path);
+    remove((std::string(path) + ".texcache").c_str());
+}
+
+static u64 MipChainSize(const CookedTexture& cooked)
+{
+    u64 size = 0;
+    for (u32 level = 0; level < cooked.levelCount; ++level)
+        size += CompressedLevelSize(cooked.internalFormat, max(cooked.size >> i32(level), ivec2(1)));
+    return size;
+}
+
+TEST(TextureCookerEncodesEveryFormat)
+{
+    struct FormatCase
+    {
+        const char*  path;
+        u32          channels;
+        bool         opaque;
+        TextureUsage usage;
+        GLenum       internalFormat;
+        f32          maxError;
+    };
+    const FormatCase cases[] = {
+        { "test_cook_grey.png",   1, true,  TextureUsage_Color,     GL_COMPRESSED_RED_RGTC1,         2.f },
+        { "test_cook_rg.png",     2, false, TextureUsage_Color,     GL_COMPRESSED_RG_RGTC2,          2.f },
+        { "test_cook_rgb.png",    3, true,  TextureUsage_Color,     GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 12.f },
+        { "test_cook_opaque.png", 4, true,  TextureUsage_Color,     GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 12.f },
+        { "test_cook_rgba.png",   4, false, TextureUsage_Color,     GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 12.f },
+        { "test_cook_normal.png", 3, true,  TextureUsage_NormalMap, GL_COMPRESSED_RG_RGTC2,          2.f },
+    };
+
+    for (const FormatCase& test : cases)
+    {
+        const std::vector<u8> pixels = TestImage(test.channels, test.opaque);
+        WriteTestImage(test.path, pixels, test.channels);
+
+        CookedTexture cooked;
+        const bool cookedOk = CookTexture(test.path, false, true, test.usage, cooked);
+        CHECK(cookedOk);
+        if (cookedOk)
+        {
+            CHECK(cooked.internalFormat == test.internalFormat && cooked.usage == test.usage);
+            CHECK(cooked.size == ivec2(TEST_WIDTH, TEST_HEIGHT) && cooked.levelCount == 6);
+            CHECK(cooked.cookedData.size() == MipChainSize(cooked));
+
+            // normal maps keep their xy only, the opaque image is compared without its alpha
+            const u32 comparedChannels = test.usage == TextureUsage_NormalMap ? 2 : test.opaque ? min(test.channels, 3u) : test.channels;
+            std::vector<u8> compared;
+            for (u32 i = 0; i < TEST_WIDTH * TEST_HEIGHT; ++i)
+                compared.insert(compared.end(), &pixels[i * test.channels], &pixels[i * test.channels] + comparedChannels);
+            const f32 error = Level0Error(cooked, compared, comparedChannels);
+            if (error > test.maxError)
+                ILOG("%s: level 0 error %.2f", test.path, error);
+            CHECK(error <= test.maxError);
+        }
+
+        FreeCookedTexture(cooked);
+        RemoveTestImage(test.path);
+    }
+}
+
+TEST(TextureCookerReusesItsCache)
+{
+    const char* path = "test_cook_cache.png";
+    WriteTestImage(path, TestImage(3, true), 3);
+
+    CookedTexture first;
+    CHECK(CookTexture(path, false, true, TextureUsage_Color, first) && first.file.data == NULL);
+
+    // same flags, read back from the mapped cache with the same blocks
+    CookedTexture cached;
+    CHECK(CookTexture(path, false, true, TextureUsage_Color, cached) && cached.file.data != NULL);
+    CHECK(cached.levelCount == first.levelCount);
+    CHECK(cached.levels && memcmp(cached.levels, first.levels, first.cookedData.size()) == 0);
+    FreeCookedTexture(cached);
+
+    FILE* temp = fopen("test_cook_cache.png.texcache.tmp", "rb");
+    CHECK(temp == NULL);
+    if (temp)
+        fclose(temp);
+
+    // other flags or usage cook again
+    CookedTexture flipped;
+    CHECK(CookTexture(path, true, true, TextureUsage_Color, flipped) && flipped.file.data == NULL);
+    FreeCookedTexture(flipped);
+
+    CookedTexture normalMap;
+    CHECK(CookTexture(path, true, true, TextureUsage_NormalMap, normalMap) && normalMap.file.data == NULL);
+    CHECK(normalMap.internalFormat == GL_COMPRESSED_RG_RGTC2);
+    FreeCookedTexture(normalMap);
+
+    // a cache cut short is cooked again
+    FILE* cache = fopen("test_cook_cache.png.texcache", "wb");
+    CHECK(cache != NULL);
+    if (cache)
+    {
+        fwrite(first.cookedData.data(), 1, 16, cache);
+        fclose(cache);
+    }
+    CookedTexture truncated;
+    CHECK(CookTexture(path, false, true, TextureUsage_Color, truncated) && truncated.file.data == NULL);
+    FreeCookedTexture(truncated);
+
+    FreeCookedTexture(first);
+    RemoveTestImage(path);
+}
+
+TEST(TextureCookerLeavesUncompressedImagesDecoded)
+{
+    const char* path = "test_cook_plain.png";
+    WriteTestImage(path, TestImage(4, false), 4);
+
+    // without s3tc a color image has no compressed format, its pixels are kept
+    DecodedTexture decoded;
+    CHECK(DecodeTexture(path, false, false, TextureUsage_Color, decoded));
+    CHECK(decoded.cooked.levels == NULL && decoded.image.pixels != NULL);
+    CHECK(decoded.image.nchannels == 4 && decoded.image.size == ivec2(TEST_WIDTH, TEST_HEIGHT));
+    FreeImage(decoded.image);
+
+    CookedTexture cooked;
+    CHECK(!CookTexture(path, false, false, TextureUsage_Color, cooked));
+    FreeCookedTexture(cooked);
+
+    // keepImage also keeps the pixels of a compressed one
+    DecodedTexture kept;
+    CHECK(DecodeTexture(path, false, false, TextureUsage_NormalMap, kept, true));
+    CHECK(kept.cooked.levels != NULL && kept.image.pixels != NULL);
+    FreeImage(kept.image);
+    FreeCookedTexture(kept.cooked);
+
+    DecodedTexture missing;
+    CHECK(!DecodeTexture("test_cook_missing.png", false, true, TextureUsage_Color, missing));
+
+    RemoveTestImage(path);
+}
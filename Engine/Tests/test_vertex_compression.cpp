@@ -0,0 +1,123 @@
+#include "tests.h"
+#include "vertex_compression.h"
+
+// Float vertices in the layout of the importers (see vertex_compression.h)
+static VertexBufferLayout FloatVertexLayout(bool tangentSpace)
+{
+    VertexBufferLayout layout = {};
+    layout.attributes.push_back(VertexBufferAttribute{ 0, 3, 0 });
+    layout.attributes.push_back(VertexBufferAttribute{ 1, 3, 3 * sizeof(float) });
+    layout.attributes.push_back(VertexBufferAttribute{ 2, 2, 6 * sizeof(float) });
+    layout.stride = 8 * sizeof(float);
+    if (tangentSpace)
+    {
+        layout.attributes.push_back(VertexBufferAttribute{ 3, 3, layout.stride });
+        layout.attributes.push_back(VertexBufferAttribute{ 4, 3, (u8)(layout.stride + 3 * sizeof(float)) });
+        layout.stride += 6 * sizeof(float);
+    }
+    return layout;
+}
+
+static void PushFloats(std::vector<float>& vertices, vec3 v)
+{
+    vertices.push_back(v.x);
+    vertices.push_back(v.y);
+    vertices.push_back(v.z);
+}
+
+static bool NearlyEqual(vec3 a, vec3 b, f32 tolerance)
+{
+    return length(a - b) <= tolerance;
+}
+
+TEST(VertexCompressionRoundTripsPositionsAndNormals)
+{
+    std::vector<vec3> positions, normals;
+    for (u32 i = 0; i < 64; ++i)
+    {
+        const f32 angle = i * 0.37f;
+        positions.push_back(vec3(cosf(angle) * 12.f, i * 0.25f - 3.f, sinf(angle) * 5.f));
+        normals.push_back(normalize(vec3(cosf(angle), sinf(angle * 3.f), -0.5f + (i % 5) * 0.2f)));
+    }
+
+    std::vector<float> vertices;
+    for (u32 i = 0; i < positions.size(); ++i)
+    {
+        PushFloats(vertices, positions[i]);
+        PushFloats(vertices, normals[i]);
+        vertices.push_back(i / 64.f);
+        vertices.push_back(1.f - i / 64.f);
+    }
+
+    Submesh submesh = {};
+    CompressSubmeshVertices(submesh, vertices, FloatVertexLayout(false));
+
+    CHECK(SubmeshVertexCount(submesh) == positions.size());
+    CHECK(submesh.vertexBufferLayout.stride == 24); // padded position, normal, uv, tangent frame
+    for (u32 i = 0; i < positions.size(); ++i)
+    {
+        // snorm16 over a 24 unit wide aabb, octahedral snorm16 normals
+        CHECK(NearlyEqual(ReadVertexPosition(submesh, i), positions[i], 1e-3f));
+        CHECK(NearlyEqual(ReadVertexNormal(submesh, i), normals[i], 1e-3f));
+
+        const vec4 uv = ReadVertexAttribute(submesh, i, 2);
+        CHECK(fabsf(uv.x - i / 64.f) < 1e-3f && fabsf(uv.y - (1.f - i / 64.f)) < 1e-3f);
+    }
+}
+
+TEST(VertexCompressionKeepsTheTangentFrame)
+{
+    const vec3 normal = normalize(vec3(0.2f, 0.9f, 0.3f));
+    const vec3 tangent = normalize(cross(vec3(0.f, 0.f, 1.f), normal));
+    const vec3 bitangent = cross(normal, tangent);
+
+    std::vector<float> vertices;
+    for (u32 i = 0; i < 2; ++i)
+    {
+        // the second vertex has a mirrored uv mapping, its bitangent flips
+        PushFloats(vertices, vec3((f32)i, 0.f, 0.f));
+        PushFloats(vertices, normal);
+        vertices.push_back(0.f);
+        vertices.push_back(0.f);
+        PushFloats(vertices, tangent);
+        PushFloats(vertices, i == 0 ? bitangent : -bitangent);
+    }
+
+    Submesh submesh = {};
+    CompressSubmeshVertices(submesh, vertices, FloatVertexLayout(true));
+
+    for (u32 i = 0; i < 2; ++i)
+    {
+        vec3 t, b;
+        ReadVertexTangentFrame(submesh, i, t, b);
+        CHECK(NearlyEqual(t, tangent, 1e-3f));
+        CHECK(NearlyEqual(b, i == 0 ? bitangent : -bitangent, 1e-3f));
+    }
+}
+
+TEST(VertexCompressionHandlesFlatSubmeshes)
+{
+    // every vertex in the z = 2 plane, the aabb has no depth
+    std::vector<float> vertices;
+    for (u32 i = 0; i < 3; ++i)
+    {
+        PushFloats(vertices, vec3((f32)(i & 1), (f32)(i >> 1), 2.f));
+        PushFloats(vertices, vec3(0.f, 0.f, 1.f));
+        vertices.push_back(0.f);
+        vertices.push_back(0.f);
+    }
+
+    Submesh submesh = {};
+    CompressSubmeshVertices(submesh, vertices, FloatVertexLayout(false));
+
+    for (u32 i = 0; i < 3; ++i)
+    {
+        CHECK(NearlyEqual(ReadVertexPosition(submesh, i), vec3((f32)(i & 1), (f32)(i >> 1), 2.f), 1e-4f));
+
+        // without tangents the frame is built around the normal
+        vec3 t, b;
+        ReadVertexTangentFrame(submesh, i, t, b);
+        CHECK(fabsf(dot(t, vec3(0.f, 0.f, 1.f))) < 1e-3f && fabsf(dot(b, vec3(0.f, 0.f, 1.f))) < 1e-3f);
+        CHECK(fabsf(length(t) - 1.f) < 1e-3f && fabsf(length(b) - 1.f) < 1e-3f);
+    }
+}
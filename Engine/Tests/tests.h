@@ -0,0 +1,29 @@
+//
+// tests.h: Minimal harness of the Tests project, it checks the engine
+// modules that run on the cpu alone, without a window or a GL context.
+//
+
+#pragma once
+
+#include "platform.h"
+
+typedef void (*TestFunction)();
+
+struct TestCase
+{
+    const char*  name;
+    TestFunction function;
+};
+
+// Called by TEST at static initialization, test_main.cpp runs every registered test
+bool RegisterTest(const char* name, TestFunction function);
+
+#define TEST(name)                                          \
+static void name();                                         \
+static bool name##Registered = RegisterTest(#name, name);   \
+static void name()
+
+// Logs the failed condition and carries on with the test
+#define CHECK(condition) CheckCondition((condition), #condition, __FILE__, __LINE__)
+
+void CheckCondition(bool condition, const char* expression, const char* file, int line);
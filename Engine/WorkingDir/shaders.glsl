@@ -1,3 +1,205 @@
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+// Compressed vertex format of the imported meshes: positions are snorm16
+// relative to the submesh bounds (scale/bias set per draw), normals are
+// octahedral snorm16, texcoords half floats and the tangent frame a
+// snorm16 quaternion whose w sign is the bitangent sign.
+#if defined(VERTEX)
+
+uniform vec3 uPositionScale;
+uniform vec3 uPositionBias;
+
+vec3 DequantizePosition(vec3 p)
+{
+	return p * uPositionScale + uPositionBias;
+}
+
+vec3 OctDecode(vec2 e)
+{
+	vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+void TangentFrame(vec4 q, out vec3 tangent, out vec3 bitangent)
+{
+	float w = abs(q.w);
+	tangent = vec3(1.0 - 2.0 * (q.y * q.y + q.z * q.z), 2.0 * (q.x * q.y + w * q.z), 2.0 * (q.x * q.z - w * q.y));
+	bitangent = vec3(2.0 * (q.x * q.y - w * q.z), 1.0 - 2.0 * (q.x * q.x + q.z * q.z), 2.0 * (q.y * q.z + w * q.x));
+	bitangent *= q.w < 0.0 ? -1.0 : 1.0;
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////
+// Scene transforms: world matrices stay resident in an ssbo indexed by
+// entity (only moved entities are uploaded), the camera is per frame.
+#if (defined(Z_PRE_PASS) || defined(GEOMETRY_PASS) || defined(FORWARD)) && defined(VERTEX)
+
+layout(binding = 3, std140) uniform CameraParams
+{
+	mat4 uView;
+	mat4 uProjection;
+	mat4 uViewProjection;
+};
+
+layout(binding = 6, std430) readonly buffer EntityTransforms
+{
+	mat4 worldMatrices[];
+};
+
+uniform uint uEntityIdx;
+
+#endif
+
+///////////////////////////////////////////////////////////////////////
+// Programmable vertex pulling: programs loaded with VERTEX_PULLING fetch
+// their attributes from the geometry arena buffers by gl_VertexID instead
+// of going through a VAO. Attribute offsets/stride are in 32-bit words and
+// the arena is expected to hold the compressed vertex format.
+#if defined(VERTEX_PULLING) && defined(VERTEX)
+
+layout(binding = 3, std430) readonly buffer VertexData
+{
+	uint vertexWords[];
+};
+
+layout(binding = 4, std430) readonly buffer IndexData
+{
+	uint indices[];
+};
+
+uniform int   uBaseVertex;
+uniform int   uVertexStride;
+uniform ivec4 uAttributeOffsets; // position, normal, texcoord, tangent frame (-1 if missing)
+uniform bool  uShortIndices;     // two u16 indices per word
+uniform int   uPositionStride;   // PullPosition(): stride of the position-only stream
+
+vec3 aPosition;
+vec2 aNormal;
+vec2 aTexCoord;
+vec4 aTangentFrame;
+
+vec3 PullSnorm16x3(uint base, int offset)
+{
+	if (offset < 0) return vec3(0.0);
+	uint i = base + uint(offset);
+	return vec3(unpackSnorm2x16(vertexWords[i]), unpackSnorm2x16(vertexWords[i + 1]).x);
+}
+
+vec4 PullSnorm16x4(uint base, int offset)
+{
+	if (offset < 0) return vec4(0.0, 0.0, 0.0, 1.0);
+	uint i = base + uint(offset);
+	return vec4(unpackSnorm2x16(vertexWords[i]), unpackSnorm2x16(vertexWords[i + 1]));
+}
+
+vec2 PullSnorm16x2(uint base, int offset)
+{
+	if (offset < 0) return vec2(0.0);
+	return unpackSnorm2x16(vertexWords[base + uint(offset)]);
+}
+
+vec2 PullHalf2(uint base, int offset)
+{
+	if (offset < 0) return vec2(0.0);
+	return unpackHalf2x16(vertexWords[base + uint(offset)]);
+}
+
+uint PullIndex()
+{
+	if (uShortIndices)
+		return (indices[gl_VertexID >> 1] >> (16 * (gl_VertexID & 1))) & 0xFFFFu;
+	return indices[gl_VertexID];
+}
+
+void PullVertex()
+{
+	uint vertex = uint(uBaseVertex) + PullIndex();
+	uint base = vertex * uint(uVertexStride);
+	aPosition = PullSnorm16x3(base, uAttributeOffsets.x);
+	aNormal   = PullSnorm16x2(base, uAttributeOffsets.y);
+	aTexCoord = PullHalf2(base, uAttributeOffsets.z);
+	aTangentFrame = PullSnorm16x4(base, uAttributeOffsets.w);
+}
+
+// Depth only passes: reads the position stream bound instead of the vertices
+void PullPosition()
+{
+	uint vertex = uint(uBaseVertex) + PullIndex();
+	aPosition = PullSnorm16x3(vertex * uint(uPositionStride), 0);
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////
+// Materials of the scene passes: every material lives in one ssbo and
+// its textures are layers of texture arrays grouped by size and format
+// (or resident bindless handles when BINDLESS_TEXTURES is defined),
+// so only the material index changes between draws.
+#if (defined(GEOMETRY_PASS) || defined(FORWARD)) && defined(FRAGMENT)
+
+struct MaterialData
+{
+	vec4  albedoSmoothness;
+	vec4  emissive;
+	uvec4 textures;     // albedo, emissive, specular, normals as (texture array << 16 | layer)
+	uvec4 moreTextures; // bump
+	uvec2 textureHandles[6]; // BINDLESS_TEXTURES: handles in the same order, last one unused
+};
+
+layout(binding = 5, std430) readonly buffer Materials
+{
+	MaterialData materials[];
+};
+
+layout(binding = 8) uniform sampler2DArray uTextureArrays[8];
+
+uniform uint uMaterialIdx;
+
+vec4 SampleMaterialTexture(uint packedTexture, vec2 uv)
+{
+	uint arrayIdx = packedTexture >> 16;
+	float layer = float(packedTexture & 0xFFFFu);
+	return texture(uTextureArrays[arrayIdx], vec3(uv, layer));
+}
+
+vec4 SampleMaterialAlbedo(vec2 uv)
+{
+#ifdef BINDLESS_TEXTURES
+	return texture(sampler2D(materials[uMaterialIdx].textureHandles[0]), uv);
+#else
+	return SampleMaterialTexture(materials[uMaterialIdx].textures.x, uv);
+#endif
+}
+
+// Normal in the tangent frame of the vertex, the z of the normal maps is
+// reconstructed from xy (two channel textures work as well as rgb ones)
+vec3 SampleMaterialNormal(vec2 uv)
+{
+	if (materials[uMaterialIdx].textures.w == 0xFFFFFFFFu)
+		return vec3(0.0, 0.0, 1.0); // no normal map
+
+#ifdef BINDLESS_TEXTURES
+	vec2 xy = texture(sampler2D(materials[uMaterialIdx].textureHandles[3]), uv).xy;
+#else
+	vec2 xy = SampleMaterialTexture(materials[uMaterialIdx].textures.w, uv).xy;
+#endif
+	xy = xy * 2.0 - 1.0;
+	return vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0)));
+}
+
+vec3 PerturbNormal(vec3 normal, vec3 tangent, vec3 bitangent, vec2 uv)
+{
+	vec3 n = SampleMaterialNormal(uv);
+	return normalize(normalize(tangent) * n.x + normalize(bitangent) * n.y + normalize(normal) * n.z);
+}
+
+#endif
+
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////
@@ -38,18 +240,19 @@ void main()
 
 #if defined(VERTEX) //////////////////////////////////////////////////
 
+#ifndef VERTEX_PULLING
 layout(location = 0) in vec3 aPosition;
-//layout(location = 1) in vec3 aNormal;
+//layout(location = 1) in vec2 aNormal;
+#endif
 
-layout(binding = 1, std140) uniform LocalParams
-{
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
-};
 
 void main()
 {
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+#ifdef VERTEX_PULLING
+	PullPosition();
+#endif
+	mat4 worldMatrix = worldMatrices[uEntityIdx];
+	gl_Position = uViewProjection * (worldMatrix * vec4(DequantizePosition(aPosition), 1.0));
 }
 
 #endif
@@ -79,7 +282,10 @@ layout(binding = 0) uniform sampler2D gPosition;
 layout(binding = 1) uniform sampler2D gNormal;
 layout(binding = 2) uniform sampler2D texNoise;
 
-uniform vec3 samples[64];
+layout(binding = 2, std140) uniform SSAOKernel
+{
+	vec4 samples[64]; // xyz used
+};
 uniform mat4 projection;
 uniform mat4 view;
 
@@ -131,7 +337,7 @@ void main()
 //		if(dot(sampleDirr, normal) < 0.15)
 //			continue;
 
-		vec4 samplePos = view * vec4(fragPos + TBN * samples[i] * radius, 1.0);
+		vec4 samplePos = view * vec4(fragPos + TBN * samples[i].xyz * radius, 1.0);
 
 		// project sample pos to get position
 		vec4 offset = vec4(samplePos.xyz, 1.0);
@@ -211,26 +417,34 @@ void main()
 
 #if defined(VERTEX)
 
+#ifndef VERTEX_PULLING
 layout(location = 0) in vec3 aPosition;
-layout(location = 1) in vec3 aNormal;
+layout(location = 1) in vec2 aNormal;
 layout(location = 2) in vec2 aTexCoord;
+layout(location = 3) in vec4 aTangentFrame;
+#endif
 
-layout(binding = 1, std140) uniform LocalParams
-{
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
-};
 
 out vec3 vPosition;
 out vec3 vNormal;
+out vec3 vTangent;
+out vec3 vBitangent;
 out vec2 vTexCoord;
 
 void main()
 {
+#ifdef VERTEX_PULLING
+	PullVertex();
+#endif
+	mat4 worldMatrix = worldMatrices[uEntityIdx];
+	vec3 tangent, bitangent;
+	TangentFrame(aTangentFrame, tangent, bitangent);
 	vTexCoord = aTexCoord;
-	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
-	vNormal = vec3(uWorldMatrix * vec4(aNormal, 0.0));
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	vPosition = vec3(worldMatrix * vec4(DequantizePosition(aPosition), 1.0));
+	vNormal = vec3(worldMatrix * vec4(OctDecode(aNormal), 0.0));
+	vTangent = vec3(worldMatrix * vec4(tangent, 0.0));
+	vBitangent = vec3(worldMatrix * vec4(bitangent, 0.0));
+	gl_Position = uViewProjection * vec4(vPosition, 1.0);
 }
 
 #elif defined(FRAGMENT)
@@ -242,15 +456,15 @@ layout(location = 3) out vec4 gDepthGray;
 
 in vec3 vPosition;
 in vec3 vNormal;
+in vec3 vTangent;
+in vec3 vBitangent;
 in vec2 vTexCoord;
 
-uniform sampler2D uTexture;
-
 void main()
 {
 	gPosition = vec4(vPosition,1.0);
-	gNormal = vec4(normalize(vNormal), 1.0);
-	gAlbedoSpec = texture(uTexture, vTexCoord);
+	gNormal = vec4(PerturbNormal(vNormal, vTangent, vBitangent, vTexCoord), 1.0);
+	gAlbedoSpec = SampleMaterialAlbedo(vTexCoord);
 	gDepthGray = vec4(gl_FragCoord.zzz, 1.0);
 }
 
@@ -275,7 +489,7 @@ uniform mat4 WVP;
 void main()
 {
 	//vTexCoord = aTexCoord;
-	gl_Position = WVP * vec4(aPosition, 1.0);
+	gl_Position = WVP * vec4(DequantizePosition(aPosition), 1.0);
 }
 
 #elif defined(FRAGMENT)
@@ -413,11 +627,12 @@ struct Light
 
 #if defined(VERTEX) ///////////////////////////////////////////////////
 
+#ifndef VERTEX_PULLING
 layout(location = 0) in vec3 aPosition;
-layout(location = 1) in vec3 aNormal;
+layout(location = 1) in vec2 aNormal;
 layout(location = 2) in vec2 aTexCoord;
-//layout(location = 3) in vec3 aTangent;
-//layout(location = 4) in vec3 aBitangent;
+layout(location = 3) in vec4 aTangentFrame; // quaternion, w sign is the bitangent sign
+#endif
 
 layout(binding = 0, std140) uniform GlobalParams
 {
@@ -426,24 +641,29 @@ layout(binding = 0, std140) uniform GlobalParams
 	Light uLight[16];
 };
 
-layout(binding = 1, std140) uniform LocalParams
-{
-	mat4 uWorldMatrix;
-	mat4 uWorldViewProjectionMatrix;
-};
 
 out vec2 vTexCoord;
 out vec3 vPosition; // in worldspace
 out vec3 vNormal;   // in worldspace
+out vec3 vTangent;  // in worldspace
+out vec3 vBitangent;
 out vec3 vViewDir;  // in worldspace
 
 void main()
 {
+#ifdef VERTEX_PULLING
+	PullVertex();
+#endif
+	mat4 worldMatrix = worldMatrices[uEntityIdx];
+	vec3 tangent, bitangent;
+	TangentFrame(aTangentFrame, tangent, bitangent);
 	vTexCoord = aTexCoord;
-	vPosition = vec3(uWorldMatrix * vec4(aPosition, 1.0));
-	vNormal = vec3(uWorldMatrix * vec4(aNormal, 0.0));
+	vPosition = vec3(worldMatrix * vec4(DequantizePosition(aPosition), 1.0));
+	vNormal = vec3(worldMatrix * vec4(OctDecode(aNormal), 0.0));
+	vTangent = vec3(worldMatrix * vec4(tangent, 0.0));
+	vBitangent = vec3(worldMatrix * vec4(bitangent, 0.0));
 	vViewDir = uCameraPosition - vPosition;
-	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition, 1.0);
+	gl_Position = uViewProjection * vec4(vPosition, 1.0);
 }
 
 #elif defined(FRAGMENT) ///////////////////////////////////////////////
@@ -451,11 +671,12 @@ void main()
 in vec2 vTexCoord;
 in vec3 vPosition;
 in vec3 vNormal;
+in vec3 vTangent;
+in vec3 vBitangent;
 in vec3 vViewDir;
 
 uniform bool doFakeReflections;
 layout(binding = 0) uniform samplerCube uSkybox;
-layout(binding = 1) uniform sampler2D uTexture;
 
 
 layout(location = 0) out vec4 oColor;
@@ -469,7 +690,7 @@ layout(binding = 0, std140) uniform GlobalParams
 
 void main()
 {
-	vec3 uNormal = normalize(vNormal);
+	vec3 uNormal = PerturbNormal(vNormal, vTangent, vBitangent, vTexCoord);
 	vec3 diffuse, ambient, specular;
 
 	float ambientFactor = 0.2;
@@ -540,7 +761,7 @@ void main()
 		    specularColor += specular;
 		}
 
-	vec4 baseColor = texture(uTexture, vTexCoord);
+	vec4 baseColor = SampleMaterialAlbedo(vTexCoord);
 	vec4 objColor = baseColor * (	vec4(ambient, 1.0) + // ambient
 								vec4(diffuse, 1.0) + // diffuse
 								vec4(specularColor, 1.0)); // specular
@@ -569,8 +790,9 @@ out vec3 vTexCoord;
 
 void main()
 {
-	vTexCoord = vec3(-aPosition.x ,aPosition.y, aPosition.z);
-	vec4 pos = uProjection * uView * vec4(aPosition, 1.0);
+	vec3 position = DequantizePosition(aPosition);
+	vTexCoord = vec3(-position.x ,position.y, position.z);
+	vec4 pos = uProjection * uView * vec4(position, 1.0);
 	gl_Position = pos.xyww;
 }
 
@@ -591,6 +813,127 @@ void main()
 #endif
 
 
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+
+#ifdef MESHLET_CULLING
+
+#if defined(COMPUTE)
+
+layout(local_size_x = 64) in;
+
+struct Meshlet
+{
+	vec4  sphere; // xyz center, w radius (object space)
+	vec4  cone;   // xyz axis, w cutoff (sin of the cone half angle)
+	uvec4 range;  // x first index (relative to the submesh), y index count
+};
+
+struct DrawElementsCommand
+{
+	uint count;
+	uint instanceCount;
+	uint firstIndex;
+	int  baseVertex;
+	uint baseInstance;
+};
+
+layout(binding = 0, std430) readonly buffer Meshlets
+{
+	Meshlet meshlets[];
+};
+
+layout(binding = 1, std430) writeonly buffer DrawCommands
+{
+	DrawElementsCommand commands[];
+};
+
+layout(binding = 2, std430) buffer DrawCounts
+{
+	uint drawCounts[];
+};
+
+// one workgroup per visible entity submesh (MeshletCullJob in engine.h)
+struct CullJob
+{
+	uint entityIdx;
+	uint firstMeshlet;
+	uint meshletCount;
+	uint firstCommand;
+	uint firstIndex;
+	int  baseVertex;
+	uint padding[2];
+};
+
+layout(binding = 6, std430) readonly buffer EntityTransforms
+{
+	mat4 worldMatrices[];
+};
+
+layout(binding = 7, std430) readonly buffer CullJobs
+{
+	CullJob jobs[];
+};
+
+uniform vec4 uFrustumPlanes[6];
+uniform vec3 uCameraPosition;
+
+void CullMeshlet(CullJob job, mat4 worldMatrix, mat3 normalMatrix, float maxScale, uint meshletIdx)
+{
+	Meshlet meshlet = meshlets[job.firstMeshlet + meshletIdx];
+
+	vec3 center = vec3(worldMatrix * vec4(meshlet.sphere.xyz, 1.0));
+	float radius = meshlet.sphere.w * maxScale;
+
+	// frustum culling
+	for (int i = 0; i < 6; ++i)
+	{
+		if (dot(uFrustumPlanes[i].xyz, center) + uFrustumPlanes[i].w < -radius)
+			return;
+	}
+
+	// cone culling: every triangle of the meshlet faces away from the camera
+	float cutoff = meshlet.cone.w;
+	if (cutoff <= 1.0)
+	{
+		vec3 axis = normalize(normalMatrix * meshlet.cone.xyz);
+		vec3 view = center - uCameraPosition;
+		if (dot(view, axis) > cutoff * length(view) + radius * (1.0 + cutoff))
+			return;
+	}
+
+	// compact the visible meshlets at the start of the submesh command range
+	uint slot = atomicAdd(drawCounts[job.firstCommand], 1u);
+
+	DrawElementsCommand command;
+	command.count = meshlet.range.y;
+	command.instanceCount = 1u;
+	command.firstIndex = job.firstIndex + meshlet.range.x;
+	command.baseVertex = job.baseVertex;
+	command.baseInstance = 0u;
+	commands[job.firstCommand + slot] = command;
+}
+
+void main()
+{
+	CullJob job = jobs[gl_WorkGroupID.x];
+	mat4 worldMatrix = worldMatrices[job.entityIdx];
+
+	// cofactor matrix: the inverse transpose scaled by the determinant,
+	// enough for a direction that gets normalized once the sign is fixed
+	mat3 m = mat3(worldMatrix);
+	mat3 normalMatrix = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));
+	normalMatrix *= sign(dot(m[0], normalMatrix[0]));
+	float maxScale = max(max(length(m[0]), length(m[1])), length(m[2]));
+
+	for (uint i = gl_LocalInvocationID.x; i < job.meshletCount; i += gl_WorkGroupSize.x)
+		CullMeshlet(job, worldMatrix, normalMatrix, maxScale, i);
+}
+
+#endif
+#endif
+
+
 // NOTE: You can write several shaders in the same file if you want as
 // long as you embrace them within an #ifdef block (as you can see above).
 // The third parameter of the LoadProgram function in engine.cpp allows